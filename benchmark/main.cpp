@@ -0,0 +1,161 @@
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QPainter>
+#include <QStringList>
+#include <QTextStream>
+
+#include "imagescaler.h"
+#include "framebuffermemory.h"
+
+#define DEFAULT_ITERATIONS 50
+#define FRAMEBUFFER_WIDTH 3840
+#define FRAMEBUFFER_HEIGHT 2160
+
+namespace {
+
+QImage createSource(const QSize &size, QImage::Format format) {
+    // gradients and text, so that neither flat areas nor noise dominate
+    QImage image(size, QImage::Format_RGB32);
+    QPainter painter(&image);
+    QLinearGradient gradient(0, 0, size.width(), size.height());
+    gradient.setColorAt(0, Qt::darkBlue);
+    gradient.setColorAt(0.5, Qt::white);
+    gradient.setColorAt(1, Qt::darkRed);
+    painter.fillRect(image.rect(), gradient);
+    for (int y = 0; y < size.height(); y += 20) {
+        painter.drawText(0, y, QString("The quick brown fox jumps over the lazy dog %1 ").arg(y).repeated(8));
+    }
+    painter.end();
+    return image.convertToFormat(format);
+}
+
+/**
+ * Returns the fastest of @a iterations runs of @a scale in milliseconds.
+ */
+template<typename Function>
+double measure(int iterations, Function scale) {
+    qint64 fastest = -1;
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; i++) {
+        timer.start();
+        scale();
+        auto elapsed = timer.nsecsElapsed();
+        if (fastest < 0 || elapsed < fastest) {
+            fastest = elapsed;
+        }
+    }
+    return fastest / 1000000.0;
+}
+
+const char *pageTypeName(FramebufferMemory::PageType type) {
+    switch (type) {
+    case FramebufferMemory::NormalPages:
+        return "normal pages";
+    case FramebufferMemory::TransparentHugePages:
+        return "transparent huge pages";
+    case FramebufferMemory::ExplicitHugePages:
+        return "explicit huge pages";
+    default:
+        return "no pages";
+    }
+}
+
+/**
+ * Compares scanning and scaling a 4K framebuffer allocated from normal pages
+ * and from huge pages, whichever the system provides.
+ */
+void benchmarkPageTypes(QTextStream &out, int iterations) {
+    QSize size(FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT);
+    auto source = createSource(size, QImage::Format_RGB32);
+    out << "Framebuffer " << size.width() << "x" << size.height() << " RGB32, scaled to "
+        << size.width() / 2 << "x" << size.height() / 2 << ":\n";
+
+    bool hugePages[] = { false, true };
+    for (int i = 0; i < 2; i++) {
+        FramebufferMemory memory(hugePages[i]);
+        if (!memory.resize(source.byteCount())) {
+            out << "  " << (hugePages[i] ? "Huge" : "Normal") << " pages could not be allocated\n";
+            continue;
+        }
+        memcpy(memory.data(), source.constBits(), source.byteCount());
+        QImage framebuffer(memory.data(), size.width(), size.height(), source.bytesPerLine(),
+            source.format());
+        QImage destination(size / 2, QImage::Format_RGB32);
+        ImageScaler box(ImageScaler::Box);
+
+        // down the columns a cache line apart, so that every read is on a
+        // different row and, with normal pages, on a different page
+        volatile quint32 sum = 0;
+        auto scanMsecs = measure(iterations, [&] {
+            quint32 columnSum = 0;
+            for (int x = 0; x < size.width(); x += 16) {
+                for (int y = 0; y < size.height(); y++) {
+                    columnSum += ((const quint32*)framebuffer.constScanLine(y))[x];
+                }
+            }
+            sum = columnSum;
+        });
+        auto scaleMsecs = measure(iterations, [&] { box.scale(framebuffer, &destination); });
+
+        out << "  " << pageTypeName(memory.pageType()) << ":\n";
+        out << "    column scan            " << scanMsecs << " ms\n";
+        out << "    ImageScaler Box        " << scaleMsecs << " ms\n";
+    }
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    // text is drawn into the source images, but no windows are shown
+    QApplication a(argc, argv, false);
+    QTextStream out(stdout);
+
+    auto args = a.arguments();
+    QSize sourceSize(2560, 1440);
+    QSize destinationSize(1280, 720);
+    int iterations = DEFAULT_ITERATIONS;
+    if (args.size() == 6) {
+        sourceSize = QSize(args[1].toInt(), args[2].toInt());
+        destinationSize = QSize(args[3].toInt(), args[4].toInt());
+        iterations = args[5].toInt();
+    } else if (args.size() != 1) {
+        out << "Usage: " << args[0] << " [sourceWidth sourceHeight "
+            "destinationWidth destinationHeight iterations]\n";
+        return 1;
+    }
+
+    out << "Scaling " << sourceSize.width() << "x" << sourceSize.height() << " to "
+        << destinationSize.width() << "x" << destinationSize.height()
+        << ", fastest of " << iterations << " runs, scaler uses "
+        << ImageScaler::instructionSet() << "\n";
+
+    QImage::Format formats[] = { QImage::Format_RGB16, QImage::Format_RGB32 };
+    const char *formatNames[] = { "RGB16", "RGB32" };
+    for (int i = 0; i < 2; i++) {
+        auto source = createSource(sourceSize, formats[i]);
+        QImage destination(destinationSize, QImage::Format_RGB32);
+        ImageScaler box(ImageScaler::Box);
+        ImageScaler bilinear(ImageScaler::Bilinear);
+
+        auto boxMsecs = measure(iterations, [&] { box.scale(source, &destination); });
+        auto bilinearMsecs = measure(iterations, [&] { bilinear.scale(source, &destination); });
+        auto smoothMsecs = measure(iterations, [&] {
+            destination = source.scaled(destinationSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        });
+        auto fastMsecs = measure(iterations, [&] {
+            destination = source.scaled(destinationSize, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+        });
+
+        out << formatNames[i] << ":\n";
+        out << "  ImageScaler Box          " << boxMsecs << " ms ("
+            << smoothMsecs / boxMsecs << "x QImage smooth)\n";
+        out << "  ImageScaler Bilinear     " << bilinearMsecs << " ms ("
+            << smoothMsecs / bilinearMsecs << "x QImage smooth)\n";
+        out << "  QImage::scaled smooth    " << smoothMsecs << " ms\n";
+        out << "  QImage::scaled fast      " << fastMsecs << " ms\n";
+    }
+
+    benchmarkPageTypes(out, iterations);
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include "audiodecoder.h"
+
+#include <limits.h>
+#include <string.h>
+
+// sizes of the per channel headers of the ADPCM blocks
+#define IMA_HEADER_BYTES 4
+#define MS_HEADER_BYTES 7
+#define MS_PREDICTOR_COUNT 7
+#define MS_MIN_DELTA 16
+// keeps corrupt audio from overflowing the adaptation
+#define MS_MAX_DELTA (INT_MAX / 768)
+#define IMA_MAX_INDEX 88
+
+namespace {
+
+const int imaIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+const int imaStepTable[IMA_MAX_INDEX + 1] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const int msAdaptationTable[16] = {
+    230, 230, 230, 230, 307, 409, 512, 614,
+    768, 614, 512, 409, 307, 230, 230, 230
+};
+
+// the standard coefficients, which Windows always uses
+const int msCoefficient1[MS_PREDICTOR_COUNT] = { 256, 512, 0, 192, 240, 460, 392 };
+const int msCoefficient2[MS_PREDICTOR_COUNT] = { 0, -256, 0, 64, 0, -208, -232 };
+
+inline int clampSample(int sample) {
+    return qBound(-32768, sample, 32767);
+}
+
+inline int readSample(const uchar *data) {
+    return qint16(data[0] | data[1] << 8);
+}
+
+struct ImaChannel {
+    int predictor;
+    int index;
+
+    inline qint16 decode(int nibble) {
+        int step = imaStepTable[index];
+        // the reference decoder's bit tests as masks, without branches
+        int diff = step >> 3;
+        diff += -(nibble & 1) & (step >> 2);
+        diff += -((nibble >> 1) & 1) & (step >> 1);
+        diff += -((nibble >> 2) & 1) & step;
+        int sign = -((nibble >> 3) & 1);
+        predictor = clampSample(predictor + ((diff ^ sign) - sign));
+        index = qBound(0, index + imaIndexTable[nibble], IMA_MAX_INDEX);
+        return predictor;
+    }
+};
+
+struct MsChannel {
+    int coefficient1;
+    int coefficient2;
+    int delta;
+    int sample1;
+    int sample2;
+
+    inline qint16 decode(int nibble) {
+        int predicted = (sample1 * coefficient1 + sample2 * coefficient2) >> 8;
+        int sample = clampSample(predicted + (nibble - ((nibble & 8) << 1)) * delta);
+        sample2 = sample1;
+        sample1 = sample;
+        delta = qBound(MS_MIN_DELTA, (msAdaptationTable[nibble] * delta) >> 8, MS_MAX_DELTA);
+        return sample;
+    }
+};
+
+void decodeImaBlock(const uchar *block, int channels, int frames, qint16 *output) {
+    ImaChannel state[2];
+    for (int channel = 0; channel < channels; channel++) {
+        auto header = block + channel * IMA_HEADER_BYTES;
+        state[channel].predictor = readSample(header);
+        state[channel].index = qMin<int>(header[2], IMA_MAX_INDEX);
+        output[channel] = state[channel].predictor;
+    }
+
+    // the channels take turns in chunks of 4 bytes holding 8 samples, low
+    // nibble first
+    auto data = block + channels * IMA_HEADER_BYTES;
+    for (int frame = 1; frame < frames; frame += 8) {
+        for (int channel = 0; channel < channels; channel++) {
+            auto out = output + frame * channels + channel;
+            for (int i = 0; i < 4; i++) {
+                int byte = *data++;
+                out[2 * i * channels] = state[channel].decode(byte & 0xf);
+                out[(2 * i + 1) * channels] = state[channel].decode(byte >> 4);
+            }
+        }
+    }
+}
+
+void decodeMsBlock(const uchar *block, int channels, int frames, qint16 *output) {
+    MsChannel state[2];
+    for (int channel = 0; channel < channels; channel++) {
+        int predictor = qMin<int>(block[channel], MS_PREDICTOR_COUNT - 1);
+        state[channel].coefficient1 = msCoefficient1[predictor];
+        state[channel].coefficient2 = msCoefficient2[predictor];
+        state[channel].delta = readSample(block + channels + channel * 2);
+        state[channel].sample1 = readSample(block + channels * 3 + channel * 2);
+        state[channel].sample2 = readSample(block + channels * 5 + channel * 2);
+        // the header holds the first two frames, the older one last
+        output[channel] = state[channel].sample2;
+        output[channels + channel] = state[channel].sample1;
+    }
+
+    // the samples follow interleaved, high nibble first
+    auto data = block + channels * MS_HEADER_BYTES;
+    auto out = output + 2 * channels;
+    int samples = (frames - 2) * channels;
+    for (int i = 0; i < samples; i += 2) {
+        int byte = *data++;
+        out[i] = state[i % channels].decode(byte >> 4);
+        out[i + 1] = state[(i + 1) % channels].decode(byte & 0xf);
+    }
+}
+
+}
+
+AudioDecoder::Format::Format()
+    : formatTag(0), channels(0), sampleRate(0), bitsPerSample(0), blockAlign(0) {
+}
+
+AudioDecoder::AudioDecoder() : frames(0) {
+}
+
+bool AudioDecoder::isSupported(const Format &format) {
+    int channels = format.channels;
+    if (channels < 1 || channels > 2 || format.sampleRate <= 0) {
+        return false;
+    }
+    switch (format.formatTag) {
+    case Pcm:
+        return format.bitsPerSample == 8 || format.bitsPerSample == 16;
+    case ImaAdpcm:
+        // the data after the headers is in chunks of 4 bytes per channel
+        return format.bitsPerSample == 4 && format.blockAlign > IMA_HEADER_BYTES * channels &&
+            (format.blockAlign - IMA_HEADER_BYTES * channels) % (4 * channels) == 0;
+    case MsAdpcm:
+        return format.bitsPerSample == 4 && format.blockAlign > MS_HEADER_BYTES * channels;
+    default:
+        return false;
+    }
+}
+
+void AudioDecoder::setFormat(const Format &format) {
+    currentFormat = format;
+    int channels = format.channels;
+    switch (format.formatTag) {
+    case ImaAdpcm:
+        frames = (format.blockAlign - IMA_HEADER_BYTES * channels) * 2 / channels + 1;
+        break;
+    case MsAdpcm:
+        frames = (format.blockAlign - MS_HEADER_BYTES * channels) * 2 / channels + 2;
+        break;
+    default:
+        frames = 1;
+        break;
+    }
+}
+
+const AudioDecoder::Format &AudioDecoder::format() const {
+    return currentFormat;
+}
+
+int AudioDecoder::blockBytes() const {
+    if (currentFormat.formatTag == Pcm) {
+        return currentFormat.channels * currentFormat.bitsPerSample / 8;
+    }
+    return currentFormat.blockAlign;
+}
+
+int AudioDecoder::blockFrames() const {
+    return frames;
+}
+
+void AudioDecoder::decode(const char *input, int blocks, qint16 *output) const {
+    auto data = (const uchar*)input;
+    int channels = currentFormat.channels;
+    int samples = blocks * frames * channels;
+    switch (currentFormat.formatTag) {
+    case Pcm:
+        if (currentFormat.bitsPerSample == 16) {
+            memcpy(output, data, samples * 2);
+        } else {
+            // 8-bit samples are unsigned
+            for (int i = 0; i < samples; i++) {
+                output[i] = (data[i] - 128) * 256;
+            }
+        }
+        break;
+    case ImaAdpcm:
+        for (int i = 0; i < blocks; i++) {
+            decodeImaBlock(data + i * currentFormat.blockAlign, channels, frames,
+                output + i * frames * channels);
+        }
+        break;
+    case MsAdpcm:
+        for (int i = 0; i < blocks; i++) {
+            decodeMsBlock(data + i * currentFormat.blockAlign, channels, frames,
+                output + i * frames * channels);
+        }
+        break;
+    }
+}
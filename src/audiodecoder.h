@@ -0,0 +1,71 @@
+#ifndef AUDIODECODER_H
+#define AUDIODECODER_H
+
+#include <QtGlobal>
+#include <QMetaType>
+
+/**
+ * The AudioDecoder class decodes audio received from the remote host to
+ * signed 16-bit PCM.
+ *
+ * Supported are PCM of 8 and 16 bits, and IMA and Microsoft ADPCM of 4 bits,
+ * which compress 16-bit audio to a quarter. The audio is decoded in whole
+ * blocks, each ADPCM block starting with the decoder state of its channels,
+ * so blocks decode independently of each other.
+ */
+class AudioDecoder {
+public:
+    // values of WAVEFORMATEX's wFormatTag
+    enum FormatTag {
+        Pcm = 0x0001,
+        MsAdpcm = 0x0002,
+        ImaAdpcm = 0x0011
+    };
+
+    struct Format {
+        Format();
+
+        int formatTag;
+        int channels;
+        int sampleRate;
+        int bitsPerSample;
+        int blockAlign;
+    };
+
+    AudioDecoder();
+
+    /**
+     * Returns true if audio of @a format can be decoded.
+     */
+    static bool isSupported(const Format &format);
+
+    /**
+     * Sets @a format of the audio to decode.
+     */
+    void setFormat(const Format &format);
+    const Format &format() const;
+
+    /**
+     * Returns size in bytes of a block of encoded audio.
+     */
+    int blockBytes() const;
+
+    /**
+     * Returns count of frames decoded from a block.
+     */
+    int blockFrames() const;
+
+    /**
+     * Decodes @a blocks blocks from @a input to @a output, which has room
+     * for blocks * blockFrames() frames.
+     */
+    void decode(const char *input, int blocks, qint16 *output) const;
+
+private:
+    Format currentFormat;
+    int frames;
+};
+
+Q_DECLARE_METATYPE(AudioDecoder::Format)
+
+#endif // AUDIODECODER_H
@@ -0,0 +1,307 @@
+#include "audiojitterbuffer.h"
+#include "performancecounters.h"
+
+#include <string.h>
+
+#define DEFAULT_TARGET_MSEC 50
+#define MAX_TARGET_MSEC 500
+// the target is raised by this fraction of the minimum target on underrun
+// and lowered by TARGET_STEP_MSEC after STABLE_PERIOD_MSEC without underruns
+#define UNDERRUN_STEP_DIVISOR 2
+#define TARGET_STEP_MSEC 10
+#define STABLE_PERIOD_MSEC 10000
+// buffer deeper than this many times the target is cut back to the target
+#define OVERRUN_FACTOR 4
+// one frame in this many is dropped or repeated to adjust the depth
+#define STRETCH_INTERVAL_FRAMES 64
+#define SILENCE_THRESHOLD_16BIT 64
+#define COMPACT_THRESHOLD_BYTES 65536
+#define RING_BUFFER_MSEC 1000
+// checkpoints kept if the played position is not asked for
+#define MAX_CHECKPOINTS 1000
+// fraction bits of AudioResampler::inputStep()
+#define POSITION_FRACTION_BITS 16
+
+AudioJitterBuffer::AudioJitterBuffer(QObject *parent)
+    : QIODevice(parent), performanceCounters(nullptr), channels(0), frameBytes(0),
+      sampleRate(0), readOffset(0), playing(false), minimumTarget(DEFAULT_TARGET_MSEC),
+      targetFrames(0), stableFrames(0), pushedFrames(0), decodedFrames(0), consumedPosition(0),
+      writtenFrames(0), playedFrames(0) {
+    open(QIODevice::ReadOnly);
+}
+
+void AudioJitterBuffer::setFormat(const AudioDecoder::Format &format, int outputRate) {
+    decoder.setFormat(format);
+    resampler.setRates(format.channels, format.sampleRate, outputRate);
+    channels = format.channels;
+    frameBytes = channels * sizeof(qint16);
+    sampleRate = outputRate;
+    targetFrames = msecsToFrames(minimumTarget);
+    // allocated up front, push() must not allocate
+    int ringBlocks = qint64(format.sampleRate) * RING_BUFFER_MSEC / 1000 / decoder.blockFrames() + 1;
+    ring.setCapacity(ringBlocks * decoder.blockBytes());
+    received.clear();
+    received.reserve(ring.capacity());
+    decoded.reserve(ringBlocks * decoder.blockFrames() * channels);
+    pending.clear();
+    pending.reserve(resampler.maxOutputFrames(ringBlocks * decoder.blockFrames()) * frameBytes);
+    readOffset = 0;
+    playing = false;
+    stableFrames = 0;
+    clearRequested = 0;
+    pushedFrames = 0;
+    decodedFrames = 0;
+    consumedPosition = 0;
+    writtenFrames = 0;
+    checkpoints.clear();
+    playedFrames = 0;
+}
+
+void AudioJitterBuffer::setTargetLatency(int msecs) {
+    minimumTarget = msecs > 0 ? qMin(msecs, MAX_TARGET_MSEC) : DEFAULT_TARGET_MSEC;
+    targetFrames = msecsToFrames(minimumTarget);
+    stableFrames = 0;
+}
+
+int AudioJitterBuffer::targetLatency() const {
+    return framesToMsecs(targetFrames);
+}
+
+void AudioJitterBuffer::setPerformanceCounters(PerformanceCounters *counters) {
+    performanceCounters = counters;
+}
+
+qint64 AudioJitterBuffer::push(const char *data, int size) {
+    // a part of the audio would break the blocks, so it fits whole or not at
+    // all
+    if (ring.capacity() - ring.bytesAvailable() >= size) {
+        ring.write(data, size);
+        pushedFrames += size / decoder.blockBytes() * decoder.blockFrames();
+    } else if (performanceCounters) {
+        // the audio thread has not read for a second
+        performanceCounters->add(PerformanceCounters::AudioOverruns);
+        if (decoder.blockBytes()) {
+            performanceCounters->add(PerformanceCounters::AudioFramesDropped,
+                size / decoder.blockBytes() * decoder.blockFrames());
+        }
+    }
+    return pushedFrames;
+}
+
+void AudioJitterBuffer::clear() {
+    // done by the audio thread on its next read
+    clearRequested.fetchAndStoreRelease(1);
+}
+
+int AudioJitterBuffer::depth() const {
+    if (frameBytes == 0) {
+        return 0;
+    }
+    // the audio in the ring is still encoded and at the remote host's rate
+    int ringFrames = ring.bytesAvailable() / decoder.blockBytes() * decoder.blockFrames();
+    return framesToMsecs((pending.size() - readOffset) / frameBytes) +
+        qint64(ringFrames) * 1000 / decoder.format().sampleRate;
+}
+
+qint64 AudioJitterBuffer::playedPosition(qint64 deviceFrames) {
+    while (!checkpoints.isEmpty() && checkpoints.head().first <= deviceFrames) {
+        playedFrames = checkpoints.dequeue().second;
+    }
+    return playedFrames;
+}
+
+bool AudioJitterBuffer::isSequential() const {
+    return true;
+}
+
+qint64 AudioJitterBuffer::readData(char *data, qint64 maxSize) {
+    if (frameBytes == 0) {
+        memset(data, 0, maxSize);
+        return maxSize;
+    }
+    takeReceived();
+
+    int maxFrames = maxSize / frameBytes;
+    int size = maxFrames * frameBytes;
+    int available = (pending.size() - readOffset) / frameBytes;
+    if (performanceCounters) {
+        performanceCounters->record(PerformanceCounters::AudioBufferDepth,
+            available * Q_INT64_C(1000000000) / sampleRate);
+    }
+
+    // the device is fed with silence until the buffer has filled up
+    if (!playing && available < targetFrames) {
+        memset(data, 0, size);
+        writtenFrames += maxFrames;
+        return size;
+    }
+    playing = true;
+
+    int frames = copyFrames(data, maxFrames);
+    if (frames < maxFrames) {
+        memset(data + frames * frameBytes, 0, (maxFrames - frames) * frameBytes);
+        playing = false;
+        targetFrames = qMin(targetFrames + msecsToFrames(minimumTarget) / UNDERRUN_STEP_DIVISOR,
+            msecsToFrames(MAX_TARGET_MSEC));
+        stableFrames = 0;
+        if (performanceCounters) {
+            performanceCounters->add(PerformanceCounters::AudioUnderruns);
+        }
+    } else {
+        stableFrames += frames;
+        if (stableFrames >= msecsToFrames(STABLE_PERIOD_MSEC)) {
+            targetFrames = qMax(targetFrames - msecsToFrames(TARGET_STEP_MSEC),
+                msecsToFrames(minimumTarget));
+            stableFrames = 0;
+        }
+    }
+
+    // the frame consumed last is heard when the device has played what has
+    // been written to it
+    writtenFrames += maxFrames;
+    checkpoints.enqueue(qMakePair(writtenFrames, consumedPosition >> POSITION_FRACTION_BITS));
+    if (checkpoints.size() > MAX_CHECKPOINTS) {
+        checkpoints.dequeue();
+    }
+
+    if (readOffset == pending.size()) {
+        pending.clear();
+        readOffset = 0;
+    } else if (readOffset >= COMPACT_THRESHOLD_BYTES) {
+        pending.remove(0, readOffset);
+        readOffset = 0;
+    }
+    return size;
+}
+
+qint64 AudioJitterBuffer::writeData(const char *data, qint64 maxSize) {
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    // written with push()
+    return -1;
+}
+
+void AudioJitterBuffer::takeReceived() {
+    if (clearRequested.fetchAndStoreAcquire(0)) {
+        // the dropped audio counts as played
+        int dropped = ring.clear() + received.size();
+        decodedFrames += dropped / decoder.blockBytes() * decoder.blockFrames();
+        consumedPosition = decodedFrames << POSITION_FRACTION_BITS;
+        resampler.reset();
+        received.clear();
+        pending.clear();
+        readOffset = 0;
+        playing = false;
+    }
+
+    int size = ring.bytesAvailable();
+    if (size > 0) {
+        int oldSize = received.size();
+        received.resize(oldSize + size);
+        ring.read(received.data() + oldSize, size);
+        decodeReceived();
+    }
+
+    // the device has been reading slower than the audio arrives, keep the
+    // latest audio
+    int available = (pending.size() - readOffset) / frameBytes;
+    int limit = qMax(targetFrames * OVERRUN_FACTOR, msecsToFrames(MAX_TARGET_MSEC));
+    if (available > limit) {
+        consumeFrames(available - targetFrames);
+        if (performanceCounters) {
+            performanceCounters->add(PerformanceCounters::AudioOverruns);
+            performanceCounters->add(PerformanceCounters::AudioFramesDropped, available - targetFrames);
+        }
+    }
+}
+
+void AudioJitterBuffer::decodeReceived() {
+    // decoded in whole blocks, the rest waits for the next read
+    int blocks = received.size() / decoder.blockBytes();
+    if (blocks == 0) {
+        return;
+    }
+    int frames = blocks * decoder.blockFrames();
+    decoded.resize(frames * channels);
+    decoder.decode(received.constData(), blocks, decoded.data());
+    received.remove(0, blocks * decoder.blockBytes());
+    decodedFrames += frames;
+
+    int oldSize = pending.size();
+    pending.resize(oldSize + resampler.maxOutputFrames(frames) * frameBytes);
+    int resampled = resampler.resample(decoded.constData(), frames, (qint16*)(pending.data() + oldSize));
+    pending.resize(oldSize + resampled * frameBytes);
+}
+
+int AudioJitterBuffer::copyFrames(char *data, int maxFrames) {
+    int frames = 0;
+    int dropped = 0;
+    int inserted = 0;
+    while (frames < maxFrames) {
+        int available = (pending.size() - readOffset) / frameBytes;
+        if (available == 0) {
+            break;
+        }
+        auto source = pending.constData() + readOffset;
+        bool tooDeep = available > targetFrames + targetFrames / 2;
+        bool tooShallow = available < targetFrames / 2;
+
+        // silence can be dropped without anyone noticing
+        if (tooDeep && isSilent(source)) {
+            consumeFrames(1);
+            dropped++;
+            continue;
+        }
+
+        int count = qMin(available, maxFrames - frames);
+        if (tooDeep || tooShallow) {
+            count = qMin(count, STRETCH_INTERVAL_FRAMES);
+        }
+        memcpy(data + frames * frameBytes, source, count * frameBytes);
+        consumeFrames(count);
+        frames += count;
+
+        if (tooDeep && available > count) {
+            consumeFrames(1);
+            dropped++;
+        } else if (tooShallow && frames < maxFrames) {
+            memcpy(data + frames * frameBytes, data + (frames - 1) * frameBytes, frameBytes);
+            frames++;
+            inserted++;
+        }
+    }
+
+    if (performanceCounters) {
+        if (dropped) {
+            performanceCounters->add(PerformanceCounters::AudioFramesDropped, dropped);
+        }
+        if (inserted) {
+            performanceCounters->add(PerformanceCounters::AudioFramesInserted, inserted);
+        }
+    }
+    return frames;
+}
+
+void AudioJitterBuffer::consumeFrames(int frames) {
+    readOffset += frames * frameBytes;
+    consumedPosition += frames * resampler.inputStep();
+}
+
+int AudioJitterBuffer::framesToMsecs(int frames) const {
+    return sampleRate ? qint64(frames) * 1000 / sampleRate : 0;
+}
+
+int AudioJitterBuffer::msecsToFrames(int msecs) const {
+    return qint64(msecs) * sampleRate / 1000;
+}
+
+bool AudioJitterBuffer::isSilent(const char *frame) const {
+    for (int i = 0; i < channels; i++) {
+        qint16 sample;
+        memcpy(&sample, frame + i * sizeof(sample), sizeof(sample));
+        if (qAbs(int(sample)) > SILENCE_THRESHOLD_16BIT) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,138 @@
+#ifndef AUDIOJITTERBUFFER_H
+#define AUDIOJITTERBUFFER_H
+
+#include <QIODevice>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QVector>
+#include <QQueue>
+#include <QPair>
+#include "audioringbuffer.h"
+#include "audiodecoder.h"
+#include "audioresampler.h"
+
+class PerformanceCounters;
+
+/**
+ * The AudioJitterBuffer class holds received audio until the audio device
+ * reads it, keeping only enough audio to ride out the variation in arrival
+ * times of the audio from the network.
+ *
+ * Playback starts when the buffer has been filled to the target latency.
+ * While playing, the buffer is kept near the target by dropping silent
+ * frames, or if there are none, every 64th frame when it runs too deep, and
+ * by repeating every 64th frame when it runs too shallow. The change in
+ * playback speed is under 2%, which is not audible. An underrun fills the
+ * device with silence and raises the target, and the target is lowered back
+ * towards its minimum after playing without underruns for a while.
+ *
+ * The device is read in pull mode by QAudioOutput in the audio thread and
+ * written with push() from the channel thread. The audio passes between the
+ * threads still encoded through a lock-free ring buffer holding up to a
+ * second of audio, so push() never waits for the audio thread. The audio
+ * thread decodes it to signed 16-bit PCM and resamples it to the device's
+ * rate when it is read. Other methods are called from the audio thread, or
+ * while push() is not called.
+ *
+ * Positions in the stream are counted in frames of the pushed audio since
+ * setFormat(). Dropped and repeated frames do not move the frames after them
+ * in the stream, so the position played tells which pushed audio has been
+ * heard.
+ */
+class AudioJitterBuffer : public QIODevice {
+public:
+    AudioJitterBuffer(QObject *parent = 0);
+
+    /**
+     * Sets @a format of the pushed audio and clears the buffer. The audio is
+     * read as signed 16-bit PCM at @a outputRate.
+     */
+    void setFormat(const AudioDecoder::Format &format, int outputRate);
+
+    /**
+     * Sets minimum target latency in milliseconds.
+     */
+    void setTargetLatency(int msecs);
+    int targetLatency() const;
+
+    /**
+     * Sets @a counters where buffer depth, underruns, overruns and dropped
+     * and repeated frames are recorded.
+     */
+    void setPerformanceCounters(PerformanceCounters *counters);
+
+    /**
+     * Appends @a size bytes of encoded audio to the buffer, which must be
+     * whole blocks of the format, and returns position in the stream where
+     * the audio ends. Audio which does not fit into the buffer is dropped
+     * and takes no room in the stream. Does not lock or allocate memory.
+     */
+    qint64 push(const char *data, int size);
+
+    /**
+     * Drops buffered audio. Playback starts again when the buffer has been
+     * filled to the target latency. Can be called from any thread.
+     */
+    void clear();
+
+    /**
+     * Returns milliseconds of audio in the buffer.
+     */
+    int depth() const;
+
+    /**
+     * Returns position in the stream played by the audio device, when the
+     * device has played @a deviceFrames frames since the format was set.
+     */
+    qint64 playedPosition(qint64 deviceFrames);
+
+    virtual bool isSequential() const;
+
+protected:
+    virtual qint64 readData(char *data, qint64 maxSize);
+    virtual qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+    int framesToMsecs(int frames) const;
+    int msecsToFrames(int msecs) const;
+    bool isSilent(const char *frame) const;
+    int copyFrames(char *data, int maxFrames);
+    void takeReceived();
+    void decodeReceived();
+    void consumeFrames(int frames);
+
+    PerformanceCounters *performanceCounters;
+    AudioRingBuffer ring;
+    QAtomicInt clearRequested;
+    AudioDecoder decoder;
+    AudioResampler resampler;
+    int channels;
+    int frameBytes;
+    int sampleRate;
+    // encoded audio taken from the ring and not yet a whole block, and
+    // decoded audio, accessed only in the audio thread
+    QByteArray received;
+    QVector<qint16> decoded;
+    // decoded and resampled audio to be played
+    QByteArray pending;
+    int readOffset;
+    bool playing;
+    int minimumTarget;
+    int targetFrames;
+    // frames played since the last underrun or lowering of the target
+    qint64 stableFrames;
+    // stream position at the end of the pushed audio, accessed only in the
+    // channel thread
+    qint64 pushedFrames;
+    // stream position at the end of the decoded audio, and at the next frame
+    // to play in 16.16 fixed point
+    qint64 decodedFrames;
+    qint64 consumedPosition;
+    // frames written to the device, and count of written frames when the
+    // device has played up to the paired stream position
+    qint64 writtenFrames;
+    QQueue<QPair<qint64, qint64> > checkpoints;
+    qint64 playedFrames;
+};
+
+#endif // AUDIOJITTERBUFFER_H
@@ -0,0 +1,139 @@
+#include "audioplayer.h"
+#include "playbackpositionsink.h"
+#include "performancecounters.h"
+
+#include <QAudioOutput>
+#include <QAudioFormat>
+#include <QAudioDeviceInfo>
+#include <QDebug>
+
+// size of the audio device's own buffer, which adds to the jitter buffer's
+// latency
+#define DEVICE_BUFFER_MSEC 30
+#define NULL_SINK_INTERVAL_MSEC 10
+#define POSITION_INTERVAL_MSEC 10
+// the clock drift is reported once measured for this long
+#define DRIFT_MIN_MSEC 10000
+
+AudioPlayer::AudioPlayer(QObject *parent)
+    : QObject(parent), jitterBuffer(this), performanceCounters(nullptr), positionSink(nullptr),
+      outputRate(0), positionTimer(this), driftStartFrames(0), outputFrameBytes(0),
+      nullSinkTimer(this), nullSinkFrames(0) {
+    nullSinkTimer.setInterval(NULL_SINK_INTERVAL_MSEC);
+    connect(&nullSinkTimer, SIGNAL(timeout()), this, SLOT(onNullSinkTimeout()));
+    positionTimer.setInterval(POSITION_INTERVAL_MSEC);
+    connect(&positionTimer, SIGNAL(timeout()), this, SLOT(onPositionTimeout()));
+}
+
+AudioPlayer::~AudioPlayer() {
+    stop();
+}
+
+AudioJitterBuffer *AudioPlayer::buffer() {
+    return &jitterBuffer;
+}
+
+void AudioPlayer::setPerformanceCounters(PerformanceCounters *counters) {
+    performanceCounters = counters;
+    jitterBuffer.setPerformanceCounters(counters);
+}
+
+void AudioPlayer::setPositionSink(PlaybackPositionSink *sink) {
+    positionSink = sink;
+}
+
+void AudioPlayer::start(const AudioDecoder::Format &format, int latency) {
+    stop();
+    QAudioFormat output;
+    output.setCodec("audio/pcm");
+    output.setSampleRate(format.sampleRate);
+    output.setChannelCount(format.channels);
+    output.setSampleSize(16);
+    output.setByteOrder(QAudioFormat::LittleEndian);
+    output.setSampleType(QAudioFormat::SignedInt);
+
+    auto device = QAudioDeviceInfo::defaultOutputDevice();
+    if (!device.isNull() && !device.isFormatSupported(output)) {
+        output.setSampleRate(device.nearestFormat(output).sampleRate());
+    }
+    jitterBuffer.setFormat(format, output.sampleRate());
+    jitterBuffer.setTargetLatency(latency);
+    outputRate = output.sampleRate();
+    outputFrameBytes = format.channels * sizeof(qint16);
+    driftClock.invalidate();
+    positionTimer.start();
+
+    if (qgetenv("REMOTEDISPLAY_AUDIO_SINK") == "null" || device.isNull()) {
+        nullSinkFrames = 0;
+        nullSinkClock.start();
+        nullSinkTimer.start();
+        return;
+    }
+
+    audioOut = new QAudioOutput(device, output, this);
+    audioOut->setBufferSize(outputRate * DEVICE_BUFFER_MSEC / 1000 * outputFrameBytes);
+    audioOut->start(&jitterBuffer);
+    if (audioOut->error() != QAudio::NoError) {
+        qWarning() << "Cannot start audio output" << audioOut->error();
+    }
+}
+
+void AudioPlayer::stop() {
+    positionTimer.stop();
+    nullSinkTimer.stop();
+    if (audioOut) {
+        audioOut->stop();
+        delete audioOut;
+    }
+}
+
+void AudioPlayer::onNullSinkTimeout() {
+    // consumes the audio at the rate a device would
+    qint64 frames = nullSinkClock.elapsed() * outputRate / 1000 - nullSinkFrames;
+    qint64 size = frames * outputFrameBytes;
+    if (size <= 0) {
+        return;
+    }
+    if (nullSinkBuffer.size() < size) {
+        nullSinkBuffer.resize(size);
+    }
+    jitterBuffer.read(nullSinkBuffer.data(), size);
+    nullSinkFrames += frames;
+}
+
+void AudioPlayer::onPositionTimeout() {
+    if (!audioOut) {
+        if (positionSink) {
+            positionSink->audioPlayed(jitterBuffer.playedPosition(nullSinkFrames));
+        }
+        return;
+    }
+
+    // the processed audio includes what is still queued in the device's
+    // buffer
+    qint64 frames = audioOut->processedUSecs() * outputRate / 1000000 -
+        (audioOut->bufferSize() - audioOut->bytesFree()) / outputFrameBytes;
+    if (frames <= 0) {
+        // nothing played yet, but the sink is still polled
+        if (positionSink) {
+            positionSink->audioPlayed(jitterBuffer.playedPosition(0));
+        }
+        return;
+    }
+    if (positionSink) {
+        positionSink->audioPlayed(jitterBuffer.playedPosition(frames));
+    }
+
+    if (!driftClock.isValid()) {
+        driftClock.start();
+        driftStartFrames = frames;
+        return;
+    }
+    qint64 elapsed = driftClock.nsecsElapsed();
+    if (performanceCounters && elapsed >= DRIFT_MIN_MSEC * Q_INT64_C(1000000)) {
+        // parts per million the device plays faster than the system clock
+        qint64 played = (frames - driftStartFrames) * 1000000 / outputRate * 1000;
+        performanceCounters->set(PerformanceCounters::AudioClockDrift,
+            (played - elapsed) * 1000000 / elapsed);
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef AUDIOPLAYER_H
+#define AUDIOPLAYER_H
+
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QByteArray>
+#include "audiojitterbuffer.h"
+
+class QAudioOutput;
+class PerformanceCounters;
+class PlaybackPositionSink;
+
+/**
+ * The AudioPlayer class plays audio from its jitter buffer with QAudioOutput
+ * in pull mode.
+ *
+ * The player lives in a thread of its own, which runs the event loop
+ * QAudioOutput needs for pulling the audio, so the channel thread only
+ * pushes the received audio into the buffer.
+ *
+ * The position played by the device is polled from the device's count of
+ * processed audio and fed to the PlaybackPositionSink. The count also tells
+ * how much the device's clock drifts from the system clock.
+ *
+ * If there is no audio output device, or environment variable
+ * REMOTEDISPLAY_AUDIO_SINK is "null", the audio is read from the buffer in
+ * real time and discarded, so the audio path can be run and measured on
+ * machines without sound hardware.
+ */
+class AudioPlayer : public QObject {
+    Q_OBJECT
+public:
+    AudioPlayer(QObject *parent = 0);
+    ~AudioPlayer();
+
+    /**
+     * Returns the buffer where the audio to play is pushed. Can be called
+     * from any thread.
+     */
+    AudioJitterBuffer *buffer();
+
+    /**
+     * Sets @a counters where the statistics of the player and its buffer are
+     * recorded. Must be called before starting.
+     */
+    void setPerformanceCounters(PerformanceCounters *counters);
+
+    /**
+     * Sets @a sink where the played position is fed. Must be called before
+     * starting.
+     */
+    void setPositionSink(PlaybackPositionSink *sink);
+
+public slots:
+    /**
+     * Starts playing audio of @a format, aiming for @a latency milliseconds
+     * of buffered audio, or the default if @a latency is not positive. The
+     * audio is resampled if the device does not support its rate.
+     */
+    void start(const AudioDecoder::Format &format, int latency);
+    void stop();
+
+private slots:
+    void onNullSinkTimeout();
+    void onPositionTimeout();
+
+private:
+    AudioJitterBuffer jitterBuffer;
+    PerformanceCounters *performanceCounters;
+    PlaybackPositionSink *positionSink;
+    QPointer<QAudioOutput> audioOut;
+    int outputRate;
+    QTimer positionTimer;
+    // device's count of played frames is compared to this clock, starting
+    // when the device has started playing
+    QElapsedTimer driftClock;
+    qint64 driftStartFrames;
+    int outputFrameBytes;
+    QTimer nullSinkTimer;
+    QElapsedTimer nullSinkClock;
+    qint64 nullSinkFrames;
+    QByteArray nullSinkBuffer;
+};
+
+#endif // AUDIOPLAYER_H
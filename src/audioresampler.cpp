@@ -0,0 +1,70 @@
+#include "audioresampler.h"
+
+#include <string.h>
+
+#define FRACTION_BITS 16
+#define FRACTION_MASK ((1 << FRACTION_BITS) - 1)
+
+AudioResampler::AudioResampler()
+    : channels(0), inputRate(0), outputRate(0), step(0), position(0) {
+}
+
+void AudioResampler::setRates(int channels, int inputRate, int outputRate) {
+    this->channels = channels;
+    this->inputRate = inputRate;
+    this->outputRate = outputRate;
+    step = outputRate > 0 ? (qint64(inputRate) << FRACTION_BITS) / outputRate : 0;
+    reset();
+}
+
+bool AudioResampler::isPassthrough() const {
+    return inputRate == outputRate;
+}
+
+qint64 AudioResampler::inputStep() const {
+    return step;
+}
+
+void AudioResampler::reset() {
+    // the first output frame is the first input frame
+    position = Q_INT64_C(1) << FRACTION_BITS;
+    previous.fill(0, channels);
+}
+
+int AudioResampler::maxOutputFrames(int frames) const {
+    if (isPassthrough()) {
+        return frames;
+    }
+    return step ? ((qint64(frames) << FRACTION_BITS) / step + 2) : 0;
+}
+
+int AudioResampler::resample(const qint16 *input, int frames, qint16 *output) {
+    if (isPassthrough()) {
+        memcpy(output, input, frames * channels * sizeof(qint16));
+        return frames;
+    }
+    if (frames == 0 || step == 0) {
+        return 0;
+    }
+
+    // frame 0 is the last frame of the previous input, frames from 1 on are
+    // the frames of this input
+    int count = 0;
+    qint64 end = qint64(frames) << FRACTION_BITS;
+    while (position < end) {
+        int index = position >> FRACTION_BITS;
+        int fraction = position & FRACTION_MASK;
+        auto from = index == 0 ? previous.constData() : input + (index - 1) * channels;
+        auto to = input + index * channels;
+        for (int channel = 0; channel < channels; channel++) {
+            output[channel] = from[channel] + ((qint64(to[channel] - from[channel]) * fraction) >> FRACTION_BITS);
+        }
+        output += channels;
+        position += step;
+        count++;
+    }
+
+    position -= end;
+    memcpy(previous.data(), input + (frames - 1) * channels, channels * sizeof(qint16));
+    return count;
+}
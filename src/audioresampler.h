@@ -0,0 +1,65 @@
+#ifndef AUDIORESAMPLER_H
+#define AUDIORESAMPLER_H
+
+#include <QtGlobal>
+#include <QVector>
+
+/**
+ * The AudioResampler class converts signed 16-bit PCM from the sample rate
+ * of the remote host to the sample rate of the audio device.
+ *
+ * The samples are interpolated linearly in 16.16 fixed point. The audio is
+ * resampled as a stream, so consecutive chunks join without clicks however
+ * they are split.
+ */
+class AudioResampler {
+public:
+    AudioResampler();
+
+    /**
+     * Sets @a channels and the @a inputRate and @a outputRate of the audio
+     * and resets the stream.
+     */
+    void setRates(int channels, int inputRate, int outputRate);
+
+    /**
+     * Returns true if the rates are equal and the audio passes unchanged.
+     */
+    bool isPassthrough() const;
+
+    /**
+     * Returns count of input frames per output frame in 16.16 fixed point.
+     * Output frame n of the stream is at input frame n * inputStep().
+     */
+    qint64 inputStep() const;
+
+    /**
+     * Starts a new stream.
+     */
+    void reset();
+
+    /**
+     * Returns the most frames resample() can output from @a frames input
+     * frames.
+     */
+    int maxOutputFrames(int frames) const;
+
+    /**
+     * Resamples @a frames frames from @a input to @a output, which has room
+     * for maxOutputFrames() frames, and returns count of output frames.
+     */
+    int resample(const qint16 *input, int frames, qint16 *output);
+
+private:
+    int channels;
+    int inputRate;
+    int outputRate;
+    // input frames per output frame in 16.16 fixed point
+    qint64 step;
+    // position of the next output frame from the last frame of the previous
+    // input in 16.16 fixed point
+    qint64 position;
+    QVector<qint16> previous;
+};
+
+#endif // AUDIORESAMPLER_H
@@ -0,0 +1,67 @@
+#include "audioringbuffer.h"
+
+#include <string.h>
+
+AudioRingBuffer::AudioRingBuffer() : mask(0) {
+}
+
+void AudioRingBuffer::setCapacity(int bytes) {
+    int size = 1;
+    while (size < bytes) {
+        size *= 2;
+    }
+    buffer.fill(0, size);
+    mask = size - 1;
+    writePosition = 0;
+    readPosition = 0;
+}
+
+int AudioRingBuffer::capacity() const {
+    return buffer.size();
+}
+
+int AudioRingBuffer::write(const char *data, int size) {
+    // the write position is only changed by this thread, the read position
+    // is acquired so that the consumer has finished with the bytes before
+    // they are overwritten
+    quint32 writeAt = writePosition;
+    quint32 used = writeAt - quint32(readPosition.fetchAndAddAcquire(0));
+    size = qMin(size, int(buffer.size() - used));
+    if (size <= 0) {
+        return 0;
+    }
+
+    int offset = writeAt & mask;
+    int first = qMin(size, buffer.size() - offset);
+    memcpy(buffer.data() + offset, data, first);
+    memcpy(buffer.data(), data + first, size - first);
+    // publishes the bytes to the consumer
+    writePosition.fetchAndStoreRelease(writeAt + size);
+    return size;
+}
+
+int AudioRingBuffer::read(char *data, int maxSize) {
+    quint32 readAt = readPosition;
+    int size = qMin(maxSize, int(quint32(writePosition.fetchAndAddAcquire(0)) - readAt));
+    if (size <= 0) {
+        return 0;
+    }
+
+    int offset = readAt & mask;
+    int first = qMin(size, buffer.size() - offset);
+    memcpy(data, buffer.constData() + offset, first);
+    memcpy(data + first, buffer.constData(), size - first);
+    // releases the bytes to the producer
+    readPosition.fetchAndStoreRelease(readAt + size);
+    return size;
+}
+
+int AudioRingBuffer::bytesAvailable() const {
+    return quint32(writePosition.fetchAndAddAcquire(0)) - quint32(readPosition);
+}
+
+int AudioRingBuffer::clear() {
+    quint32 writeAt = writePosition.fetchAndAddAcquire(0);
+    quint32 readAt = readPosition.fetchAndStoreRelease(writeAt);
+    return writeAt - readAt;
+}
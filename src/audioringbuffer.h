@@ -0,0 +1,64 @@
+#ifndef AUDIORINGBUFFER_H
+#define AUDIORINGBUFFER_H
+
+#include <QAtomicInt>
+#include <QVector>
+
+/**
+ * The AudioRingBuffer class is a lock-free ring buffer of bytes between one
+ * producer thread and one consumer thread.
+ *
+ * The memory is allocated by setCapacity(), after which write() and read()
+ * neither lock nor allocate, so a slow consumer can never block the
+ * producer. The read and write positions grow monotonically and wrap around
+ * at 2^32, the capacity being a power of two.
+ */
+class AudioRingBuffer {
+public:
+    AudioRingBuffer();
+
+    /**
+     * Allocates room for at least @a bytes and empties the buffer. Must not
+     * be called while the producer or the consumer uses the buffer.
+     */
+    void setCapacity(int bytes);
+    int capacity() const;
+
+    /**
+     * Appends up to @a size bytes from @a data and returns count of bytes
+     * appended, which is less than @a size if the buffer is full. Called
+     * only from the producer thread.
+     */
+    int write(const char *data, int size);
+
+    /**
+     * Moves up to @a maxSize bytes to @a data and returns count of bytes
+     * moved. Called only from the consumer thread.
+     */
+    int read(char *data, int maxSize);
+
+    /**
+     * Returns count of bytes which can be read. Called only from the
+     * consumer thread.
+     */
+    int bytesAvailable() const;
+
+    /**
+     * Drops all readable bytes and returns their count. Called only from the
+     * consumer thread.
+     */
+    int clear();
+
+private:
+    QVector<char> buffer;
+    int mask;
+    // padded to separate cache lines, so that the producer and the consumer
+    // do not bounce each other's position between cores
+    char padding1[64];
+    mutable QAtomicInt writePosition;
+    char padding2[64];
+    mutable QAtomicInt readPosition;
+    char padding3[64];
+};
+
+#endif // AUDIORINGBUFFER_H
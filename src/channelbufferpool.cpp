@@ -0,0 +1,53 @@
+#include "channelbufferpool.h"
+
+#include <stdlib.h>
+
+// released buffers beyond this are freed
+#define MAX_POOLED_BYTES (1024 * 1024)
+
+ChannelBufferPool::ChannelBufferPool() : pooled(0) {
+}
+
+ChannelBufferPool::~ChannelBufferPool() {
+    for (int i = 0; i < SizeClassCount; i++) {
+        for (int j = 0; j < freeBuffers[i].size(); j++) {
+            free(freeBuffers[i][j]);
+        }
+    }
+}
+
+int ChannelBufferPool::sizeClass(int size) {
+    int index = 0;
+    while ((MinBufferSize << index) < size) {
+        index++;
+    }
+    return index;
+}
+
+char *ChannelBufferPool::allocate(int size, int *capacity) {
+    Q_ASSERT(size <= MaxBufferSize);
+    int index = sizeClass(size);
+    *capacity = MinBufferSize << index;
+
+    auto &buffers = freeBuffers[index];
+    if (!buffers.isEmpty()) {
+        pooled -= *capacity;
+        auto buffer = buffers.last();
+        buffers.pop_back();
+        return buffer;
+    }
+    return (char*)malloc(*capacity);
+}
+
+void ChannelBufferPool::release(char *buffer, int capacity) {
+    if (pooled + capacity > MAX_POOLED_BYTES) {
+        free(buffer);
+        return;
+    }
+    freeBuffers[sizeClass(capacity)] << buffer;
+    pooled += capacity;
+}
+
+qint64 ChannelBufferPool::pooledBytes() const {
+    return pooled;
+}
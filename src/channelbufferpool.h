@@ -0,0 +1,54 @@
+#ifndef CHANNELBUFFERPOOL_H
+#define CHANNELBUFFERPOOL_H
+
+#include <QVector>
+
+/**
+ * The ChannelBufferPool class recycles the buffers which virtual channel
+ * PDUs are reassembled into.
+ *
+ * Buffers are allocated in power of two size classes from MinBufferSize to
+ * MaxBufferSize, and released buffers are kept for reuse up to a limit, so
+ * that a steady stream of PDUs does not allocate. Larger PDUs are assembled
+ * from many buffers of the largest class.
+ *
+ * The pool is not thread-safe. It is used only by the RDP thread.
+ */
+class ChannelBufferPool {
+public:
+    enum {
+        MinBufferSize = 1024,
+        MaxBufferSize = 64 * 1024,
+        SizeClassCount = 7
+    };
+
+    ChannelBufferPool();
+    ~ChannelBufferPool();
+
+    /**
+     * Returns a buffer of at least @a size bytes, which must not exceed
+     * MaxBufferSize, and stores its actual size to @a capacity. Returns
+     * null if the memory cannot be allocated.
+     */
+    char *allocate(int size, int *capacity);
+
+    /**
+     * Gives @a buffer of @a capacity bytes allocated with allocate() back to
+     * the pool.
+     */
+    void release(char *buffer, int capacity);
+
+    /**
+     * Returns count of bytes kept in the pool for reuse.
+     */
+    qint64 pooledBytes() const;
+
+private:
+    Q_DISABLE_COPY(ChannelBufferPool)
+    static int sizeClass(int size);
+
+    QVector<char*> freeBuffers[SizeClassCount];
+    qint64 pooled;
+};
+
+#endif // CHANNELBUFFERPOOL_H
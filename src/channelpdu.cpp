@@ -0,0 +1,41 @@
+#include "channelpdu.h"
+
+#include <string.h>
+
+ChannelPdu::ChannelPdu() : totalSize(0) {
+}
+
+int ChannelPdu::size() const {
+    return totalSize;
+}
+
+int ChannelPdu::segmentCount() const {
+    return segments.size();
+}
+
+const char *ChannelPdu::segmentData(int index) const {
+    return segments[index].first;
+}
+
+int ChannelPdu::segmentSize(int index) const {
+    return segments[index].second;
+}
+
+void ChannelPdu::copyTo(char *out) const {
+    for (int i = 0; i < segments.size(); i++) {
+        memcpy(out, segments[i].first, segments[i].second);
+        out += segments[i].second;
+    }
+}
+
+QByteArray ChannelPdu::toByteArray() const {
+    QByteArray data;
+    data.resize(totalSize);
+    copyTo(data.data());
+    return data;
+}
+
+void ChannelPdu::addSegment(const char *data, int size) {
+    segments << qMakePair(data, size);
+    totalSize += size;
+}
@@ -0,0 +1,53 @@
+#ifndef CHANNELPDU_H
+#define CHANNELPDU_H
+
+#include <QByteArray>
+#include <QPair>
+#include <QVector>
+#include "global.h"
+
+/**
+ * The ChannelPdu class is a read-only view of a complete PDU received from
+ * a static virtual channel.
+ *
+ * The remote host splits PDUs into chunks, which the client reassembles
+ * into pooled buffers. Instead of copying the PDU once more into a
+ * contiguous buffer, the view exposes it as segments, which together hold
+ * the PDU in order. A PDU which arrived in a single chunk is a single
+ * segment of the received data itself.
+ *
+ * The view and its segments are valid only during the call of
+ * ChannelPduSink::channelPduReceived() which passes it.
+ */
+class REMOTEDISPLAYSHARED_EXPORT ChannelPdu {
+public:
+    ChannelPdu();
+
+    /**
+     * Returns count of bytes in the PDU.
+     */
+    int size() const;
+
+    int segmentCount() const;
+    const char *segmentData(int index) const;
+    int segmentSize(int index) const;
+
+    /**
+     * Copies the whole PDU to @a out, which must have room for size() bytes.
+     */
+    void copyTo(char *out) const;
+
+    /**
+     * Returns a copy of the PDU which stays valid after the sink returns.
+     */
+    QByteArray toByteArray() const;
+
+private:
+    friend class ChannelReassembler;
+    void addSegment(const char *data, int size);
+
+    QVector<QPair<const char*, int> > segments;
+    int totalSize;
+};
+
+#endif // CHANNELPDU_H
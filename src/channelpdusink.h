@@ -0,0 +1,22 @@
+#ifndef CHANNELPDUSINK_H
+#define CHANNELPDUSINK_H
+
+class QString;
+class ChannelPdu;
+
+/**
+ * The ChannelPduSink interface provides a sink where complete PDUs of a
+ * static virtual channel can be fed into.
+ */
+class ChannelPduSink {
+public:
+    /**
+     * Gives @a pdu received from static virtual channel @a channel. Called
+     * from the RDP thread, which waits meanwhile, so the sink should only
+     * parse the PDU or copy what it needs. The PDU is not valid after the
+     * call.
+     */
+    virtual void channelPduReceived(const QString &channel, const ChannelPdu &pdu) = 0;
+};
+
+#endif // CHANNELPDUSINK_H
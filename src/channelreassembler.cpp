@@ -0,0 +1,111 @@
+#include "channelreassembler.h"
+#include "channelbufferpool.h"
+#include "channelpdu.h"
+#include "channelpdusink.h"
+#include "tracer.h"
+
+#include <freerdp/svc.h>
+#include <QDebug>
+#include <string.h>
+
+// larger PDUs are dropped rather than allocated
+#define MAX_PDU_SIZE (64 * 1024 * 1024)
+
+ChannelReassembler::ChannelReassembler(const QString &channel, ChannelPduSink *sink, ChannelBufferPool *pool)
+    : channel(channel), sink(sink), pool(pool), pduSize(0), receivedSize(0) {
+}
+
+ChannelReassembler::~ChannelReassembler() {
+    discardPdu();
+}
+
+void ChannelReassembler::addChunk(const char *data, int size, int flags, int totalSize) {
+    if (flags & CHANNEL_FLAG_FIRST) {
+        // a PDU left unfinished is dropped
+        discardPdu();
+        if ((flags & CHANNEL_FLAG_LAST) && size == totalSize) {
+            ChannelPdu pdu;
+            pdu.addSegment(data, size);
+            sink->channelPduReceived(channel, pdu);
+            return;
+        }
+        if (!startPdu(totalSize)) {
+            return;
+        }
+    }
+
+    // chunks of a dropped PDU are skipped until the next PDU starts
+    if (buffers.isEmpty()) {
+        return;
+    }
+    if (size > pduSize - receivedSize) {
+        qWarning() << "Virtual channel" << channel << "sent more data than its PDU size";
+        discardPdu();
+        return;
+    }
+
+    // all the buffers are of the same size, except a single one
+    int bufferSize = buffers.first().second;
+    while (size > 0) {
+        int index = receivedSize / bufferSize;
+        int offset = receivedSize % bufferSize;
+        int length = qMin(size, bufferSize - offset);
+        memcpy(buffers[index].first + offset, data, length);
+        data += length;
+        size -= length;
+        receivedSize += length;
+    }
+
+    if (flags & CHANNEL_FLAG_LAST) {
+        finishPdu();
+    }
+}
+
+bool ChannelReassembler::startPdu(int totalSize) {
+    if (totalSize <= 0 || totalSize > MAX_PDU_SIZE) {
+        qWarning() << "Dropping PDU of" << totalSize << "bytes of virtual channel" << channel;
+        return false;
+    }
+
+    int remaining = totalSize;
+    while (remaining > 0) {
+        int capacity;
+        auto buffer = pool->allocate(qMin<int>(remaining, ChannelBufferPool::MaxBufferSize), &capacity);
+        if (!buffer) {
+            qWarning() << "Out of memory for PDU of virtual channel" << channel;
+            discardPdu();
+            return false;
+        }
+        buffers << qMakePair(buffer, capacity);
+        remaining -= qMin(remaining, capacity);
+    }
+    pduSize = totalSize;
+    receivedSize = 0;
+    return true;
+}
+
+void ChannelReassembler::finishPdu() {
+    if (receivedSize == pduSize) {
+        TRACE_SCOPE("channelPdu");
+        ChannelPdu pdu;
+        int remaining = pduSize;
+        for (int i = 0; i < buffers.size(); i++) {
+            int length = qMin(remaining, buffers[i].second);
+            pdu.addSegment(buffers[i].first, length);
+            remaining -= length;
+        }
+        sink->channelPduReceived(channel, pdu);
+    } else {
+        qWarning() << "Virtual channel" << channel << "sent a PDU shorter than its size";
+    }
+    discardPdu();
+}
+
+void ChannelReassembler::discardPdu() {
+    for (int i = 0; i < buffers.size(); i++) {
+        pool->release(buffers[i].first, buffers[i].second);
+    }
+    buffers.clear();
+    pduSize = 0;
+    receivedSize = 0;
+}
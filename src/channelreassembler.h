@@ -0,0 +1,47 @@
+#ifndef CHANNELREASSEMBLER_H
+#define CHANNELREASSEMBLER_H
+
+#include <QString>
+#include <QVector>
+#include <QPair>
+
+class ChannelBufferPool;
+class ChannelPduSink;
+
+/**
+ * The ChannelReassembler class reassembles the chunks of a static virtual
+ * channel into complete PDUs, which it gives to a ChannelPduSink.
+ *
+ * The chunks are copied into buffers of a ChannelBufferPool as they arrive,
+ * and the complete PDU is passed as a view of those buffers, so each byte is
+ * copied once. A PDU which arrives in a single chunk is passed without
+ * copying at all.
+ */
+class ChannelReassembler {
+public:
+    ChannelReassembler(const QString &channel, ChannelPduSink *sink, ChannelBufferPool *pool);
+    ~ChannelReassembler();
+
+    /**
+     * Adds chunk of @a size bytes of @a data with @a flags of the channel
+     * PDU header, which tell whether the chunk is the first or the last of
+     * a PDU of @a totalSize bytes.
+     */
+    void addChunk(const char *data, int size, int flags, int totalSize);
+
+private:
+    Q_DISABLE_COPY(ChannelReassembler)
+    bool startPdu(int totalSize);
+    void finishPdu();
+    void discardPdu();
+
+    QString channel;
+    ChannelPduSink *sink;
+    ChannelBufferPool *pool;
+    // buffers and their capacities of the PDU being reassembled
+    QVector<QPair<char*, int> > buffers;
+    int pduSize;
+    int receivedSize;
+};
+
+#endif // CHANNELREASSEMBLER_H
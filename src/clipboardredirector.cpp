@@ -0,0 +1,581 @@
+#include "clipboardredirector.h"
+#include "freerdpclient.h"
+#include "tracer.h"
+
+#include <freerdp/client/cliprdr.h>
+#include <QApplication>
+#include <QClipboard>
+#include <QDebug>
+#include <QEventLoop>
+#include <QFuture>
+#include <QHash>
+#include <QImage>
+#include <QMimeData>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QStringList>
+#include <QTimer>
+#include <QtConcurrentRun>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a paste waits this long for the remote host to send the data
+#define FETCH_TIMEOUT_MSEC 60000
+#define DIB_HEADER_SIZE 40
+#define BMP_FILE_HEADER_SIZE 14
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+// larger bitmaps are rejected rather than allocated
+#define MAX_DIB_DIMENSION 32767
+#define TEXT_MIME_TYPE "text/plain"
+#define HTML_MIME_TYPE "text/html"
+#define IMAGE_MIME_TYPE "application/x-qt-image"
+
+namespace {
+
+quint16 readUInt16(const uchar *data) {
+    return data[0] | data[1] << 8;
+}
+
+quint32 readUInt32(const uchar *data) {
+    return data[0] | data[1] << 8 | data[2] << 16 | quint32(data[3]) << 24;
+}
+
+void writeUInt16(uchar *data, quint16 value) {
+    data[0] = value;
+    data[1] = value >> 8;
+}
+
+void writeUInt32(uchar *data, quint32 value) {
+    writeUInt16(data, value);
+    writeUInt16(data + 2, value >> 16);
+}
+
+QString decodeUnicodeText(const char *data, int size) {
+    auto text = (const ushort*)data;
+    int length = 0;
+    // the text ends at the first null
+    while (length < size / 2 && text[length]) {
+        length++;
+    }
+    return QString::fromUtf16(text, length).replace("\r\n", "\n");
+}
+
+int htmlOffset(const QByteArray &html, const char *key) {
+    int start = html.indexOf(key);
+    if (start < 0) {
+        return -1;
+    }
+    start += strlen(key);
+    return html.mid(start, html.indexOf('\r', start) - start).toInt();
+}
+
+QString decodeHtml(const char *data, int size) {
+    // CF_HTML starts with a header of byte offsets to the HTML and to the
+    // copied fragment in it
+    auto html = QByteArray::fromRawData(data, size);
+    int start = htmlOffset(html, "StartHTML:");
+    int end = htmlOffset(html, "EndHTML:");
+    if (start <= 0 || end <= start) {
+        start = htmlOffset(html, "StartFragment:");
+        end = htmlOffset(html, "EndFragment:");
+    }
+    if (start <= 0 || end <= start || end > size) {
+        return QString();
+    }
+    return QString::fromUtf8(data + start, end - start);
+}
+
+QImage decodeBmp(const char *data, int size) {
+    // Qt reads BMP files, which are DIBs after a file header
+    auto dib = (const uchar*)data;
+    // the offsets wrap rather than overflow, and Qt's reader checks them
+    quint32 colors = readUInt32(dib + 32);
+    int bitCount = readUInt16(dib + 14);
+    if (colors == 0 && bitCount <= 8) {
+        colors = 1 << bitCount;
+    }
+    quint32 masks = readUInt32(dib + 16) == BI_BITFIELDS && readUInt32(dib) == DIB_HEADER_SIZE ? 12 : 0;
+
+    QByteArray bmp(BMP_FILE_HEADER_SIZE, 0);
+    auto header = (uchar*)bmp.data();
+    header[0] = 'B';
+    header[1] = 'M';
+    writeUInt32(header + 2, BMP_FILE_HEADER_SIZE + size);
+    writeUInt32(header + 10, BMP_FILE_HEADER_SIZE + readUInt32(dib) + masks + colors * 4);
+    bmp.append(data, size);
+    return QImage::fromData(bmp, "BMP");
+}
+
+QImage decodeDib(const char *data, int size) {
+    auto dib = (const uchar*)data;
+    if (size < DIB_HEADER_SIZE) {
+        return QImage();
+    }
+    // the sizes are computed in 64 bits, so that no header overflows them
+    qint64 headerSize = readUInt32(dib);
+    qint64 width = qint32(readUInt32(dib + 4));
+    qint64 height = qint32(readUInt32(dib + 8));
+    int bitCount = readUInt16(dib + 14);
+    quint32 compression = readUInt32(dib + 16);
+    // rows are bottom-up unless the height is negative
+    bool bottomUp = height > 0;
+    height = qAbs(height);
+    if (headerSize < DIB_HEADER_SIZE || headerSize > size || width <= 0 || height == 0 ||
+            width > MAX_DIB_DIMENSION || height > MAX_DIB_DIMENSION) {
+        return QImage();
+    }
+
+    qint64 offset = headerSize;
+    if (compression == BI_BITFIELDS && headerSize == DIB_HEADER_SIZE) {
+        offset += 12;
+    }
+    qint64 stride = (width * bitCount + 31) / 32 * 4;
+    bool direct = (bitCount == 32 && (compression == BI_RGB || compression == BI_BITFIELDS)) ||
+        (bitCount == 24 && compression == BI_RGB);
+    if (!direct || offset + stride * height > size) {
+        // palettes and compressed bitmaps are left to Qt's reader
+        return decodeBmp(data, size);
+    }
+
+    // converted row by row straight from the received data
+    QImage image(width, height, QImage::Format_RGB32);
+    if (image.isNull()) {
+        return QImage();
+    }
+    for (int y = 0; y < height; y++) {
+        auto source = dib + offset + (bottomUp ? height - 1 - y : y) * stride;
+        auto line = (QRgb*)image.scanLine(y);
+        if (bitCount == 32) {
+            for (int x = 0; x < width; x++) {
+                line[x] = readUInt32(source + x * 4) | 0xff000000;
+            }
+        } else {
+            for (int x = 0; x < width; x++) {
+                line[x] = qRgb(source[x * 3 + 2], source[x * 3 + 1], source[x * 3]);
+            }
+        }
+    }
+    return image;
+}
+
+QVariant decodeRemoteData(quint32 format, const char *data, int size) {
+    switch (format) {
+    case CB_FORMAT_UNICODETEXT:
+        return decodeUnicodeText(data, size);
+    case CB_FORMAT_HTML:
+        return decodeHtml(data, size);
+    case CB_FORMAT_DIB:
+        return QVariant::fromValue(decodeDib(data, size));
+    case CB_FORMAT_PNG:
+    case CB_FORMAT_JPEG:
+    case CB_FORMAT_GIF:
+        return QVariant::fromValue(QImage::fromData((const uchar*)data, size));
+    default:
+        return QVariant();
+    }
+}
+
+// the local data is encoded into buffers allocated with malloc(), which
+// FreeRDP frees when it has sent them
+
+char *encodeUnicodeText(const QString &text, int *size) {
+    // line breaks are CRLF in Windows
+    auto source = text.utf16();
+    int length = text.size();
+    int lineFeeds = 0;
+    for (int i = 0; i < length; i++) {
+        if (source[i] == '\n' && (i == 0 || source[i - 1] != '\r')) {
+            lineFeeds++;
+        }
+    }
+
+    *size = (length + lineFeeds + 1) * sizeof(ushort);
+    auto data = (ushort*)malloc(*size);
+    if (!data) {
+        return nullptr;
+    }
+    auto out = data;
+    for (int i = 0; i < length; i++) {
+        if (source[i] == '\n' && (i == 0 || source[i - 1] != '\r')) {
+            *out++ = '\r';
+        }
+        *out++ = source[i];
+    }
+    *out = 0;
+    return (char*)data;
+}
+
+QByteArray htmlHeader(int startHtml, int endHtml, int startFragment, int endFragment) {
+    // the offsets are of fixed width, so the header's size does not depend
+    // on them
+    return QString("Version:0.9\r\nStartHTML:%1\r\nEndHTML:%2\r\n"
+        "StartFragment:%3\r\nEndFragment:%4\r\n")
+        .arg(startHtml, 10, 10, QChar('0')).arg(endHtml, 10, 10, QChar('0'))
+        .arg(startFragment, 10, 10, QChar('0')).arg(endFragment, 10, 10, QChar('0'))
+        .toLatin1();
+}
+
+char *encodeHtml(const QString &html, int *size) {
+    static const char prefix[] = "<html><body>\r\n<!--StartFragment-->";
+    static const char suffix[] = "<!--EndFragment-->\r\n</body></html>";
+    auto fragment = html.toUtf8();
+    int startHtml = htmlHeader(0, 0, 0, 0).size();
+    int startFragment = startHtml + strlen(prefix);
+    int endFragment = startFragment + fragment.size();
+    int endHtml = endFragment + strlen(suffix);
+
+    *size = endHtml + 1;
+    auto data = (char*)malloc(*size);
+    if (!data) {
+        return nullptr;
+    }
+    auto header = htmlHeader(startHtml, endHtml, startFragment, endFragment);
+    memcpy(data, header.constData(), startHtml);
+    memcpy(data + startHtml, prefix, startFragment - startHtml);
+    memcpy(data + startFragment, fragment.constData(), fragment.size());
+    memcpy(data + endFragment, suffix, endHtml - endFragment);
+    data[endHtml] = 0;
+    return data;
+}
+
+char *encodeDib(QImage image, int *size) {
+    if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32) {
+        image = image.convertToFormat(QImage::Format_ARGB32);
+    }
+    int width = image.width();
+    int height = image.height();
+    int stride = width * 4;
+    if (image.isNull() || qint64(stride) * height > INT_MAX - DIB_HEADER_SIZE) {
+        return nullptr;
+    }
+
+    *size = DIB_HEADER_SIZE + stride * height;
+    auto data = (uchar*)malloc(*size);
+    if (!data) {
+        return nullptr;
+    }
+    memset(data, 0, DIB_HEADER_SIZE);
+    writeUInt32(data, DIB_HEADER_SIZE);
+    writeUInt32(data + 4, width);
+    writeUInt32(data + 8, height);
+    writeUInt16(data + 12, 1);
+    writeUInt16(data + 14, 32);
+    writeUInt32(data + 20, stride * height);
+    // rows are bottom-up
+    for (int y = 0; y < height; y++) {
+        memcpy(data + DIB_HEADER_SIZE + (height - 1 - y) * stride, image.constScanLine(y), stride);
+    }
+    return (char*)data;
+}
+
+void sendLocalData(FreeRdpClient *client, quint32 format, QVariant value) {
+    TRACE_SCOPE("encodeClipboard");
+    int size = 0;
+    char *data = nullptr;
+    if (value.isValid()) {
+        switch (format) {
+        case CB_FORMAT_UNICODETEXT:
+            data = encodeUnicodeText(value.toString(), &size);
+            break;
+        case CB_FORMAT_HTML:
+            data = encodeHtml(value.toString(), &size);
+            break;
+        case CB_FORMAT_DIB:
+            data = encodeDib(qvariant_cast<QImage>(value), &size);
+            break;
+        }
+    }
+    // null data tells the remote host that the request failed
+    client->sendClipboardData(data, data ? size : 0);
+}
+
+/**
+ * Clipboard data of the remote host, which is fetched only when a local
+ * application asks for it.
+ */
+class RemoteMimeData : public QMimeData {
+public:
+    RemoteMimeData(ClipboardRedirector *redirector, const QHash<QString, quint32> &formats)
+        : redirector(redirector), remoteFormats(formats) {
+    }
+
+    virtual QStringList formats() const {
+        return remoteFormats.keys();
+    }
+
+    virtual bool hasFormat(const QString &mimeType) const {
+        return remoteFormats.contains(mimeType);
+    }
+
+protected:
+    virtual QVariant retrieveData(const QString &mimeType, QVariant::Type type) const {
+        Q_UNUSED(type);
+        if (!remoteFormats.contains(mimeType) || !redirector) {
+            return QVariant();
+        }
+        // a paste may ask for the same data many times
+        if (!fetched.contains(mimeType)) {
+            // events are processed while fetching, and the clipboard may
+            // delete this data meanwhile if another application takes it
+            QPointer<RemoteMimeData> self(const_cast<RemoteMimeData*>(this));
+            auto value = redirector->fetchRemoteData(remoteFormats[mimeType]);
+            if (!self || !value.isValid()) {
+                return value;
+            }
+            fetched.insert(mimeType, value);
+        }
+        return fetched[mimeType];
+    }
+
+private:
+    QPointer<ClipboardRedirector> redirector;
+    QHash<QString, quint32> remoteFormats;
+    mutable QHash<QString, QVariant> fetched;
+};
+
+QHash<QString, quint32> mimeTypesForFormats(const QList<quint32> &formats) {
+    QHash<QString, quint32> types;
+    if (formats.contains(CB_FORMAT_UNICODETEXT)) {
+        types.insert(TEXT_MIME_TYPE, CB_FORMAT_UNICODETEXT);
+    }
+    if (formats.contains(CB_FORMAT_HTML)) {
+        types.insert(HTML_MIME_TYPE, CB_FORMAT_HTML);
+    }
+    // compressed images take less time to transfer
+    static const quint32 imageFormats[] = {
+        CB_FORMAT_PNG, CB_FORMAT_JPEG, CB_FORMAT_GIF, CB_FORMAT_DIB
+    };
+    for (int i = 0; i < 4; i++) {
+        if (formats.contains(imageFormats[i])) {
+            types.insert(IMAGE_MIME_TYPE, imageFormats[i]);
+            break;
+        }
+    }
+    return types;
+}
+
+}
+
+class ClipboardRedirectorPrivate {
+public:
+    ClipboardRedirectorPrivate()
+        : receivedData(nullptr), receivedSize(0), dataReceived(false),
+          staleResponses(0), fetchLoop(nullptr), remoteFormatsPending(false) {
+    }
+
+    void discardReceivedData();
+
+    QPointer<FreeRdpClient> client;
+    QPointer<QMimeData> remoteMimeData;
+    // passed from the RDP thread
+    QMutex mutex;
+    QList<quint32> remoteFormats;
+    char *receivedData;
+    int receivedSize;
+    bool dataReceived;
+    // responses still due to requests which timed out. They are dropped,
+    // as cliprdr has no request ids to tell them from the next response.
+    int staleResponses;
+    // loop waiting for the remote data while fetching it
+    QEventLoop *fetchLoop;
+    // remote clipboard changed while fetching its earlier data
+    bool remoteFormatsPending;
+    QFuture<void> encoding;
+};
+
+void ClipboardRedirectorPrivate::discardReceivedData() {
+    QMutexLocker locker(&mutex);
+    free(receivedData);
+    receivedData = nullptr;
+    receivedSize = 0;
+    dataReceived = false;
+}
+
+ClipboardRedirector::ClipboardRedirector(FreeRdpClient *client, QObject *parent)
+    : QObject(parent), d_ptr(new ClipboardRedirectorPrivate) {
+    Q_D(ClipboardRedirector);
+    d->client = client;
+    connect(QApplication::clipboard(), SIGNAL(dataChanged()), this, SLOT(onLocalClipboardChanged()));
+}
+
+ClipboardRedirector::~ClipboardRedirector() {
+    Q_D(ClipboardRedirector);
+    // a fetch in progress returns when its loop gets back to it
+    if (d->fetchLoop) {
+        d->fetchLoop->quit();
+    }
+    d->encoding.waitForFinished();
+    // the remote data cannot be fetched any more
+    auto clipboard = QApplication::clipboard();
+    if (d->remoteMimeData && clipboard->mimeData() == d->remoteMimeData) {
+        clipboard->clear();
+    }
+    d->discardReceivedData();
+    delete d_ptr;
+}
+
+QVariant ClipboardRedirector::fetchRemoteData(quint32 format) {
+    Q_D(ClipboardRedirector);
+    // the paste being fetched is waited for first
+    if (!d->client || d->fetchLoop) {
+        return QVariant();
+    }
+    d->discardReceivedData();
+    d->client->requestClipboardData(format);
+
+    // the application stays responsive meanwhile, so this redirector may
+    // be destroyed before the loop returns
+    QPointer<ClipboardRedirector> self(this);
+    QEventLoop loop;
+    d->fetchLoop = &loop;
+    QTimer::singleShot(FETCH_TIMEOUT_MSEC, &loop, SLOT(quit()));
+    loop.exec();
+    if (!self) {
+        return QVariant();
+    }
+    d->fetchLoop = nullptr;
+
+    char *data;
+    int size;
+    bool received;
+    {
+        QMutexLocker locker(&d->mutex);
+        data = d->receivedData;
+        size = d->receivedSize;
+        received = d->dataReceived;
+        d->receivedData = nullptr;
+        d->dataReceived = false;
+        if (!received) {
+            d->staleResponses++;
+        }
+    }
+
+    QVariant value;
+    if (!received) {
+        qWarning() << "Timed out fetching remote clipboard";
+    } else if (data) {
+        TRACE_SCOPE("decodeClipboard");
+        value = decodeRemoteData(format, data, size);
+        free(data);
+    }
+
+    if (d->remoteFormatsPending) {
+        d->remoteFormatsPending = false;
+        QMetaObject::invokeMethod(this, "onRemoteFormatsChanged", Qt::QueuedConnection);
+    }
+    return value;
+}
+
+void ClipboardRedirector::clipboardReady() {
+    // the remote host expects the local formats first
+    QMetaObject::invokeMethod(this, "onLocalClipboardChanged", Qt::QueuedConnection);
+}
+
+void ClipboardRedirector::remoteFormatsChanged(const QList<quint32> &formats) {
+    Q_D(ClipboardRedirector);
+    {
+        QMutexLocker locker(&d->mutex);
+        d->remoteFormats = formats;
+    }
+    QMetaObject::invokeMethod(this, "onRemoteFormatsChanged", Qt::QueuedConnection);
+}
+
+void ClipboardRedirector::localDataRequested(quint32 format) {
+    QMetaObject::invokeMethod(this, "onLocalDataRequested", Qt::QueuedConnection,
+        Q_ARG(uint, format));
+}
+
+void ClipboardRedirector::remoteDataReceived(char *data, int size) {
+    Q_D(ClipboardRedirector);
+    {
+        QMutexLocker locker(&d->mutex);
+        if (d->staleResponses > 0) {
+            d->staleResponses--;
+            free(data);
+            return;
+        }
+        free(d->receivedData);
+        d->receivedData = data;
+        d->receivedSize = size;
+        d->dataReceived = true;
+    }
+    QMetaObject::invokeMethod(this, "onRemoteDataReceived", Qt::QueuedConnection);
+}
+
+void ClipboardRedirector::onLocalClipboardChanged() {
+    Q_D(ClipboardRedirector);
+    auto mimeData = QApplication::clipboard()->mimeData();
+    // the remote host's own data is not announced back to it
+    if (!d->client || (mimeData && mimeData == d->remoteMimeData)) {
+        return;
+    }
+
+    // only the formats are announced, the data is read when requested
+    QList<quint32> formats;
+    if (mimeData && mimeData->hasText()) {
+        formats << CB_FORMAT_UNICODETEXT;
+    }
+    if (mimeData && mimeData->hasHtml()) {
+        formats << CB_FORMAT_HTML;
+    }
+    if (mimeData && mimeData->hasImage()) {
+        formats << CB_FORMAT_DIB;
+    }
+    d->client->sendClipboardFormats(formats);
+}
+
+void ClipboardRedirector::onRemoteFormatsChanged() {
+    Q_D(ClipboardRedirector);
+    // replacing the clipboard would delete the data being fetched
+    if (d->fetchLoop) {
+        d->remoteFormatsPending = true;
+        return;
+    }
+
+    QList<quint32> formats;
+    {
+        QMutexLocker locker(&d->mutex);
+        formats = d->remoteFormats;
+    }
+    auto types = mimeTypesForFormats(formats);
+    if (types.isEmpty()) {
+        return;
+    }
+    d->remoteMimeData = new RemoteMimeData(this, types);
+    QApplication::clipboard()->setMimeData(d->remoteMimeData);
+}
+
+void ClipboardRedirector::onLocalDataRequested(uint format) {
+    Q_D(ClipboardRedirector);
+    auto mimeData = QApplication::clipboard()->mimeData();
+    QVariant value;
+    // the clipboard is read in the GUI thread, but encoded in the background
+    if (mimeData && mimeData != d->remoteMimeData) {
+        if (format == CB_FORMAT_UNICODETEXT && mimeData->hasText()) {
+            value = mimeData->text();
+        } else if (format == CB_FORMAT_HTML && mimeData->hasHtml()) {
+            value = mimeData->html();
+        } else if (format == CB_FORMAT_DIB && mimeData->hasImage()) {
+            value = mimeData->imageData();
+        }
+    }
+
+    // the responses are sent in the order of the requests
+    d->encoding.waitForFinished();
+    if (d->client) {
+        d->encoding = QtConcurrent::run(sendLocalData, d->client.data(), quint32(format), value);
+    }
+}
+
+void ClipboardRedirector::onRemoteDataReceived() {
+    Q_D(ClipboardRedirector);
+    if (d->fetchLoop) {
+        d->fetchLoop->quit();
+    } else {
+        // arrived after the fetch timed out
+        d->discardReceivedData();
+    }
+}
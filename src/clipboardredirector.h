@@ -0,0 +1,76 @@
+#ifndef CLIPBOARDREDIRECTOR_H
+#define CLIPBOARDREDIRECTOR_H
+
+#include <QObject>
+#include <QVariant>
+#include "clipboardsink.h"
+
+class FreeRdpClient;
+class ClipboardRedirectorPrivate;
+
+/**
+ * The ClipboardRedirector class shares the local clipboard with the remote
+ * host through the cliprdr channel.
+ *
+ * Both ways the clipboard is rendered only when it is pasted. When either
+ * clipboard changes, only the list of its formats is sent to the other side,
+ * and the data is transferred when an application on the other side asks
+ * for it.
+ *
+ * Remote data asked for by a local application is fetched while the GUI
+ * thread keeps processing events, so the application stays responsive
+ * during a long transfer. The received data is converted
+ * straight from FreeRDP's buffer without copying it first. Local data asked
+ * for by the remote host is encoded in a background thread straight into
+ * the buffer which is sent, so neither the RDP thread nor the GUI thread
+ * waits for a large encoding.
+ */
+class ClipboardRedirector : public QObject, public ClipboardSink {
+    Q_OBJECT
+public:
+    ClipboardRedirector(FreeRdpClient *client, QObject *parent = 0);
+    ~ClipboardRedirector();
+
+    /**
+     * Fetches the remote clipboard's data in @a format and converts it to a
+     * QString for text and HTML, or to a QImage for images. Returns an
+     * invalid variant if the transfer fails or times out, if another fetch
+     * is in progress, or if the redirector is destroyed while fetching.
+     *
+     * Events are processed while waiting for the data, so the caller must
+     * be prepared for being destroyed meanwhile as well.
+     */
+    QVariant fetchRemoteData(quint32 format);
+
+    /**
+     * Implemented from ClipboardSink.
+     */
+    virtual void clipboardReady();
+
+    /**
+     * Implemented from ClipboardSink.
+     */
+    virtual void remoteFormatsChanged(const QList<quint32> &formats);
+
+    /**
+     * Implemented from ClipboardSink.
+     */
+    virtual void localDataRequested(quint32 format);
+
+    /**
+     * Implemented from ClipboardSink.
+     */
+    virtual void remoteDataReceived(char *data, int size);
+
+private slots:
+    void onLocalClipboardChanged();
+    void onRemoteFormatsChanged();
+    void onLocalDataRequested(uint format);
+    void onRemoteDataReceived();
+
+private:
+    Q_DECLARE_PRIVATE(ClipboardRedirector)
+    ClipboardRedirectorPrivate* const d_ptr;
+};
+
+#endif // CLIPBOARDREDIRECTOR_H
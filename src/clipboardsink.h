@@ -0,0 +1,39 @@
+#ifndef CLIPBOARDSINK_H
+#define CLIPBOARDSINK_H
+
+#include <QList>
+
+/**
+ * The ClipboardSink interface provides a sink where the events of the
+ * clipboard redirection channel can be fed into. Formats are the clipboard
+ * format ids of FreeRDP's cliprdr channel. The methods are called from the
+ * RDP thread.
+ */
+class ClipboardSink {
+public:
+    /**
+     * Tells that the channel is ready, after which the formats of the local
+     * clipboard should be announced to the remote host.
+     */
+    virtual void clipboardReady() = 0;
+
+    /**
+     * Tells that the clipboard of the remote host has changed and holds data
+     * in @a formats. The data itself is sent only when requested.
+     */
+    virtual void remoteFormatsChanged(const QList<quint32> &formats) = 0;
+
+    /**
+     * Asks for the data of the local clipboard in @a format.
+     */
+    virtual void localDataRequested(quint32 format) = 0;
+
+    /**
+     * Gives @a size bytes of @a data of the remote clipboard requested
+     * earlier, or null data if the request failed. Takes ownership of the
+     * data, which is allocated with malloc().
+     */
+    virtual void remoteDataReceived(char *data, int size) = 0;
+};
+
+#endif // CLIPBOARDSINK_H
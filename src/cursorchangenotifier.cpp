@@ -1,22 +1,146 @@
 #include "cursorchangenotifier.h"
 #include "freerdphelpers.h"
 #include <freerdp/freerdp.h>
-#include <freerdp/codec/color.h>
+#include <QCache>
 #include <QCursor>
 #include <QImage>
 #include <QPixmap>
 #include <QBitmap>
 #include <QMetaType>
-#include <QMap>
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
 #include <QMutex>
+#include <QPoint>
+#include <string.h>
+
+// count of cursors kept for reuse after the server has freed them
+#define MAX_UNUSED_CURSORS 32
+// count of QCursor objects kept in the GUI thread
+#define MAX_CACHED_CURSORS 64
+// ids of the system cursors
+#define NULL_CURSOR_ID -2
+#define DEFAULT_CURSOR_ID -3
 
 namespace {
 
+/**
+ * Hashes @a length bytes of @a data a 64-bit word at a time.
+ */
+quint64 hashBytes(const void *data, int length, quint64 hash) {
+    auto bytes = static_cast<const uchar*>(data);
+    for (; length >= 8; bytes += 8, length -= 8) {
+        quint64 word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = (hash ^ word) * Q_UINT64_C(0x100000001b3);
+        hash ^= hash >> 29;
+    }
+    for (; length > 0; bytes++, length--) {
+        hash = (hash ^ *bytes) * Q_UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+quint64 hashPointer(const rdpPointer *pointer) {
+    quint32 properties[] = {
+        pointer->width, pointer->height, pointer->xPos, pointer->yPos, pointer->xorBpp
+    };
+    auto hash = hashBytes(properties, sizeof(properties), Q_UINT64_C(0xcbf29ce484222325));
+    hash = hashBytes(pointer->xorMaskData, pointer->lengthXorMask, hash);
+    return hashBytes(pointer->andMaskData, pointer->lengthAndMask, hash);
+}
+
+/**
+ * Returns true if the pointer is 32 bpp and has alpha channel. Some servers
+ * send 32 bpp pointers with the AND mask and zero alpha.
+ */
+bool hasAlpha(const rdpPointer *pointer) {
+    if (pointer->xorBpp != 32 || !pointer->xorMaskData) {
+        return false;
+    }
+    auto pixels = pointer->xorMaskData;
+    for (quint32 i = 3; i < pointer->lengthXorMask; i += 4) {
+        if (pixels[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Builds cursor image from pointer's bottom-up XOR mask. Pointers with alpha
+ * channel become ARGB32 images, which need no mask.
+ */
+QImage buildImage(const rdpPointer *pointer, bool alpha) {
+    int w = pointer->width;
+    int h = pointer->height;
+    QImage image;
+    int rowBytes;
+    if (pointer->xorBpp == 1) {
+        image = QImage(w, h, QImage::Format_Mono);
+        image.setColor(0, qRgb(0, 0, 0));
+        image.setColor(1, qRgb(255, 255, 255));
+        rowBytes = (w + 7) / 8;
+    } else {
+        image = QImage(w, h, alpha ? QImage::Format_ARGB32 : bppToImageFormat(pointer->xorBpp));
+        rowBytes = w * (pointer->xorBpp / 8);
+    }
+    if (image.isNull()) {
+        return image;
+    }
+
+    // XOR mask rows are padded to 2 bytes
+    int stride = h > 0 ? pointer->lengthXorMask / h : 0;
+    if (!pointer->xorMaskData || stride < rowBytes) {
+        image.fill(0);
+        return image;
+    }
+    for (int y = 0; y < h; y++) {
+        memcpy(image.scanLine(y), pointer->xorMaskData + (h - 1 - y) * stride, rowBytes);
+    }
+    return image;
+}
+
+/**
+ * Builds 1-bit mask from pointer's bottom-up AND mask. The rows are copied
+ * whole, as both have the most significant bit first.
+ */
+QImage buildMask(const rdpPointer *pointer) {
+    int w = pointer->width;
+    int h = pointer->height;
+    QImage mask(w, h, QImage::Format_Mono);
+    int rowBytes = (w + 7) / 8;
+    // AND mask rows are padded to 2 bytes
+    int stride = h > 0 ? pointer->lengthAndMask / h : 0;
+    if (!pointer->andMaskData || stride < rowBytes) {
+        mask.fill(1);
+        return mask;
+    }
+    for (int y = 0; y < h; y++) {
+        memcpy(mask.scanLine(y), pointer->andMaskData + (h - 1 - y) * stride, rowBytes);
+    }
+    return mask;
+}
+
 struct CursorData {
-    CursorData(const QImage &image, const QImage &mask, int hotX, int hotY)
-        : image(image), mask(mask), hotX(hotX), hotY(hotY) {
+    bool matches(const rdpPointer *pointer) const {
+        return (int)pointer->width == image.width() && (int)pointer->height == image.height() &&
+            (int)pointer->xPos == hotX && (int)pointer->yPos == hotY &&
+            (int)pointer->xorBpp == xorBpp &&
+            (int)pointer->lengthXorMask == xorMask.size() &&
+            (int)pointer->lengthAndMask == andMask.size() &&
+            memcmp(pointer->xorMaskData, xorMask.constData(), xorMask.size()) == 0 &&
+            memcmp(pointer->andMaskData, andMask.constData(), andMask.size()) == 0;
     }
 
+    int id;
+    quint64 hash;
+    // count of the server's pointers having this cursor
+    int references;
+    // the pointer's data for telling apart cursors with the same hash
+    int xorBpp;
+    QByteArray xorMask;
+    QByteArray andMask;
     QImage image;
     QImage mask;
     int hotX;
@@ -36,14 +160,61 @@ MyPointer* getMyPointer(rdpPointer* pointer) {
 
 class CursorChangeNotifierPrivate {
 public:
-    CursorChangeNotifierPrivate() : cursorDataIndex(0) {
+    CursorChangeNotifierPrivate()
+        : nextCursorId(0), pendingCursorId(-1), pendingPosition(0),
+          shownCursorId(-1), cursors(MAX_CACHED_CURSORS) {
+    }
+
+    ~CursorChangeNotifierPrivate() {
+        qDeleteAll(cursorDataMap);
     }
 
-    QMap<int,CursorData*> cursorDataMap;
-    int cursorDataIndex;
+    CursorData *findCursor(const rdpPointer *pointer, quint64 hash) const;
+    void releaseCursor(CursorData *data);
+
+    // identical cursors sent by the server share the same data, so each of
+    // them is decoded and turned into QCursor only once
+    QHash<int,CursorData*> cursorDataMap;
+    QMultiHash<quint64,CursorData*> cursorsByHash;
+    // ids of the cursors which no pointer has, least recently used first
+    QList<int> unusedCursors;
+    int nextCursorId;
     QMutex mutex;
+
+    // latest changes not yet handled by the GUI thread
+    QAtomicInt pendingCursorId;
+    QAtomicInt cursorChangePosted;
+    // position packed as x in the high and y in the low 16 bits
+    QAtomicInt pendingPosition;
+    QAtomicInt cursorMovePosted;
+
+    // accessed only in the GUI thread
+    int shownCursorId;
+    QCache<int,QCursor> cursors;
 };
 
+CursorData *CursorChangeNotifierPrivate::findCursor(const rdpPointer *pointer, quint64 hash) const {
+    auto it = cursorsByHash.constFind(hash);
+    for (; it != cursorsByHash.constEnd() && it.key() == hash; ++it) {
+        if (it.value()->matches(pointer)) {
+            return it.value();
+        }
+    }
+    return nullptr;
+}
+
+void CursorChangeNotifierPrivate::releaseCursor(CursorData *data) {
+    if (--data->references > 0) {
+        return;
+    }
+    unusedCursors << data->id;
+    if (unusedCursors.size() > MAX_UNUSED_CURSORS) {
+        auto evicted = cursorDataMap.take(unusedCursors.takeFirst());
+        cursorsByHash.remove(evicted->hash, evicted);
+        delete evicted;
+    }
+}
+
 CursorChangeNotifier::CursorChangeNotifier(QObject *parent)
     : QObject(parent), d_ptr(new CursorChangeNotifierPrivate) {
 }
@@ -54,57 +225,130 @@ CursorChangeNotifier::~CursorChangeNotifier() {
 
 void CursorChangeNotifier::addPointer(rdpPointer* pointer) {
     Q_D(CursorChangeNotifier);
-    int w = pointer->width;
-    int h = pointer->height;
-
-    // build cursor image
-    QImage image(w, h, bppToImageFormat(pointer->xorBpp));
-    freerdp_image_flip(pointer->xorMaskData, image.bits(), w, h, image.depth());
+    auto hash = hashPointer(pointer);
 
-    // build cursor's mask image
-    auto data = new BYTE[pointer->lengthAndMask];
-    freerdp_bitmap_flip(pointer->andMaskData, data, (w + 7) / 8, h);
-    QImage mask(w, h, QImage::Format_Mono);
-    for(int y = 0; y < h; y++) {
-        for(int x = 0; x < w; x++) {
-            mask.setPixel(x, y, freerdp_get_pixel(data, x, y, w, h, 1));
+    QMutexLocker locker(&d->mutex);
+    auto data = d->findCursor(pointer, hash);
+    if (data) {
+        // servers resend the same cursors often, e.g. when moving between
+        // links and text fields
+        if (data->references++ == 0) {
+            d->unusedCursors.removeOne(data->id);
         }
+        getMyPointer(pointer)->index = data->id;
+        return;
     }
-    delete data;
+    locker.unlock();
+
+    data = new CursorData;
+    data->hash = hash;
+    data->references = 1;
+    data->xorBpp = pointer->xorBpp;
+    data->xorMask = QByteArray((const char*)pointer->xorMaskData, pointer->lengthXorMask);
+    data->andMask = QByteArray((const char*)pointer->andMaskData, pointer->lengthAndMask);
+    data->hotX = pointer->xPos;
+    data->hotY = pointer->yPos;
 
-    QMutexLocker(&d->mutex);
-    d->cursorDataMap[d->cursorDataIndex] = new CursorData(image, mask, pointer->xPos, pointer->yPos);
-    getMyPointer(pointer)->index = d->cursorDataIndex;
-    d->cursorDataIndex++;
+    bool alpha = hasAlpha(pointer);
+    data->image = buildImage(pointer, alpha);
+    if (!alpha) {
+        data->mask = buildMask(pointer);
+    }
+
+    locker.relock();
+    data->id = d->nextCursorId++;
+    d->cursorDataMap[data->id] = data;
+    d->cursorsByHash.insert(hash, data);
+    getMyPointer(pointer)->index = data->id;
 }
 
 void CursorChangeNotifier::removePointer(rdpPointer* pointer) {
     Q_D(CursorChangeNotifier);
-    QMutexLocker(&d->mutex);
-    delete d->cursorDataMap.take(getMyPointer(pointer)->index);
+    QMutexLocker locker(&d->mutex);
+    auto data = d->cursorDataMap.value(getMyPointer(pointer)->index);
+    if (data) {
+        d->releaseCursor(data);
+    }
 }
 
 void CursorChangeNotifier::changePointer(rdpPointer* pointer) {
     Q_D(CursorChangeNotifier);
     // pass the changed pointer index from RDP thread to GUI thread because
     // instances of QCursor should not created outside of GUI thread
-    int index = getMyPointer(pointer)->index;
-    QMetaObject::invokeMethod(this, "onPointerChanged", Q_ARG(int, index));
+    d->pendingCursorId.fetchAndStoreOrdered(getMyPointer(pointer)->index);
+    if (d->cursorChangePosted.testAndSetOrdered(0, 1)) {
+        QMetaObject::invokeMethod(this, "onPointerChanged", Qt::QueuedConnection);
+    }
 }
 
-void CursorChangeNotifier::onPointerChanged(int index) {
+void CursorChangeNotifier::changeToNullPointer() {
     Q_D(CursorChangeNotifier);
-    QMutexLocker(&d->mutex);
-    if (d->cursorDataMap.contains(index)) {
-        auto data = d->cursorDataMap[index];
-        auto imgPixmap = QPixmap::fromImage(data->image);
-        auto maskBitmap = QBitmap::fromImage(data->mask);
-        imgPixmap.setMask(maskBitmap);
+    d->pendingCursorId.fetchAndStoreOrdered(NULL_CURSOR_ID);
+    if (d->cursorChangePosted.testAndSetOrdered(0, 1)) {
+        QMetaObject::invokeMethod(this, "onPointerChanged", Qt::QueuedConnection);
+    }
+}
 
-        emit cursorChanged(QCursor(imgPixmap, data->hotX, data->hotY));
+void CursorChangeNotifier::changeToDefaultPointer() {
+    Q_D(CursorChangeNotifier);
+    d->pendingCursorId.fetchAndStoreOrdered(DEFAULT_CURSOR_ID);
+    if (d->cursorChangePosted.testAndSetOrdered(0, 1)) {
+        QMetaObject::invokeMethod(this, "onPointerChanged", Qt::QueuedConnection);
     }
 }
 
+void CursorChangeNotifier::movePointer(int x, int y) {
+    Q_D(CursorChangeNotifier);
+    d->pendingPosition.fetchAndStoreOrdered((x << 16) | (y & 0xffff));
+    if (d->cursorMovePosted.testAndSetOrdered(0, 1)) {
+        QMetaObject::invokeMethod(this, "onPointerMoved", Qt::QueuedConnection);
+    }
+}
+
+void CursorChangeNotifier::onPointerChanged() {
+    Q_D(CursorChangeNotifier);
+    // cleared first, so that a change arriving after reading the id posts
+    // a new call
+    d->cursorChangePosted.fetchAndStoreOrdered(0);
+    int index = d->pendingCursorId.fetchAndAddOrdered(0);
+    if (index == d->shownCursorId) {
+        return;
+    }
+
+    if (index == NULL_CURSOR_ID || index == DEFAULT_CURSOR_ID) {
+        d->shownCursorId = index;
+        emit cursorChanged(QCursor(index == NULL_CURSOR_ID ? Qt::BlankCursor : Qt::ArrowCursor));
+        return;
+    }
+
+    auto cursor = d->cursors.object(index);
+    if (!cursor) {
+        QMutexLocker locker(&d->mutex);
+        auto data = d->cursorDataMap.value(index);
+        if (!data) {
+            return;
+        }
+        auto imgPixmap = QPixmap::fromImage(data->image);
+        if (!data->mask.isNull()) {
+            auto maskBitmap = QBitmap::fromImage(data->mask);
+            imgPixmap.setMask(maskBitmap);
+        }
+        cursor = new QCursor(imgPixmap, data->hotX, data->hotY);
+        locker.unlock();
+        d->cursors.insert(index, cursor);
+    }
+
+    d->shownCursorId = index;
+    emit cursorChanged(*cursor);
+}
+
+void CursorChangeNotifier::onPointerMoved() {
+    Q_D(CursorChangeNotifier);
+    d->cursorMovePosted.fetchAndStoreOrdered(0);
+    quint32 position = d->pendingPosition.fetchAndAddOrdered(0);
+    emit cursorMoved(QPoint(position >> 16, position & 0xffff));
+}
+
 int CursorChangeNotifier::getPointerStructSize() const {
     return sizeof(MyPointer);
 }
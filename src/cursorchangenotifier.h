@@ -14,6 +14,14 @@ class CursorChangeNotifierPrivate;
  * RDP server passes the currently shown mouse cursor's style over network when
  * ever the style changes. This class receives those updates and emits the
  * changed cursor style so that it can be applied in the widget.
+ *
+ * Cursors are identified by a hash of their content, so that identical
+ * cursors resent by the server are decoded only once and share the same
+ * QCursor. Cursors freed by the server are kept for reuse, up to a limit.
+ *
+ * Switching between cursors known to the notifier and moving the cursor do
+ * not allocate memory in the RDP thread. Only the latest change is passed to
+ * the GUI thread, if several arrive before the GUI thread gets to them.
  */
 class CursorChangeNotifier : public QObject, public PointerChangeSink {
     Q_OBJECT
@@ -41,14 +49,36 @@ public:
      */
     virtual void changePointer(rdpPointer* pointer);
 
+    /**
+     * Implemented from PointerChangeSink.
+     */
+    virtual void changeToNullPointer();
+
+    /**
+     * Implemented from PointerChangeSink.
+     */
+    virtual void changeToDefaultPointer();
+
+    /**
+     * Implemented from PointerChangeSink.
+     */
+    virtual void movePointer(int x, int y);
+
 signals:
     /**
      * This signal is emitted when current mouse cursor style changes.
      */
     void cursorChanged(const QCursor &cursor);
 
+    /**
+     * This signal is emitted when the remote host moves the mouse cursor to
+     * @a pos of the remote desktop.
+     */
+    void cursorMoved(const QPoint &pos);
+
 private slots:
-    void onPointerChanged(int index);
+    void onPointerChanged();
+    void onPointerMoved();
 
 private:
     Q_DECLARE_PRIVATE(CursorChangeNotifier)
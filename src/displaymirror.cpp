@@ -0,0 +1,191 @@
+#include "displaymirror.h"
+#include "performancecounters.h"
+#include "tracer.h"
+
+#include <QImage>
+#include <QPainter>
+#include <QRegion>
+#include <QVector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIRROR_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+void convertRgb16Generic(const quint16 *source, int count, quint32 *out) {
+    for (int i = 0; i < count; i++) {
+        quint32 p = source[i];
+        quint32 r = p >> 11;
+        quint32 g = (p >> 5) & 0x3f;
+        quint32 b = p & 0x1f;
+        out[i] = 0xff000000 | (((r << 3) | (r >> 2)) << 16) |
+            (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+    }
+}
+
+#ifdef MIRROR_SSE2
+
+void convertRgb16(const quint16 *source, int count, quint32 *out) {
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    const __m128i alpha = _mm_set1_epi16((short)0xff00);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(source + i));
+        __m128i r = _mm_srli_epi16(p, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+        __m128i b = _mm_and_si128(p, mask5);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+        // 16-bit lanes of B | G << 8 and R | A << 8 interleave to BGRA
+        __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+        __m128i ra = _mm_or_si128(r, alpha);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i*)(out + i + 4), _mm_unpackhi_epi16(bg, ra));
+    }
+    convertRgb16Generic(source + i, count - i, out + i);
+}
+
+#else
+
+void convertRgb16(const quint16 *source, int count, quint32 *out) {
+    convertRgb16Generic(source, count, out);
+}
+
+#endif // MIRROR_SSE2
+
+}
+
+class DisplayMirrorPrivate {
+public:
+    void synchronize() const;
+    void convert(const QRegion &region) const;
+    void update(const QImage &sourceImage, const QRect &rect) const;
+
+    ScreenBuffer *sourceBuffer;
+    PerformanceCounters *performanceCounters;
+    mutable QImage mirrorImage;
+    // area of the mirror not yet converted from the source buffer
+    mutable QRegion staleRegion;
+    // damage of the mirror not yet taken with takeDamage()
+    mutable QRegion damage;
+};
+
+void DisplayMirrorPrivate::synchronize() const {
+    auto sourceDamage = sourceBuffer->takeDamage();
+    auto sourceSize = sourceBuffer->size();
+    if (mirrorImage.size() != sourceSize) {
+        if (sourceSize.isEmpty()) {
+            mirrorImage = QImage();
+            staleRegion = QRegion();
+            return;
+        }
+        mirrorImage = QImage(sourceSize, QImage::Format_ARGB32_Premultiplied);
+        sourceDamage = mirrorImage.rect();
+    }
+    staleRegion += sourceDamage;
+    damage += sourceDamage;
+}
+
+void DisplayMirrorPrivate::convert(const QRegion &region) const {
+    auto converted = staleRegion & region;
+    if (converted.isEmpty()) {
+        return;
+    }
+
+    TRACE_SCOPE("updateMirror");
+    LatencyTimer timer(performanceCounters, PerformanceCounters::MirrorLatency);
+    converted &= mirrorImage.rect();
+    auto sourceImage = sourceBuffer->createImage(converted);
+    auto rects = converted.rects();
+    for (int i = 0; i < rects.size(); i++) {
+        update(sourceImage, rects[i]);
+    }
+    staleRegion -= converted;
+}
+
+void DisplayMirrorPrivate::update(const QImage &sourceImage, const QRect &rect) const {
+    if (sourceImage.format() != QImage::Format_RGB16) {
+        QPainter painter(&mirrorImage);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(rect, sourceImage, rect);
+        return;
+    }
+
+    int stride = mirrorImage.bytesPerLine();
+    auto bits = mirrorImage.bits();
+    for (int y = rect.top(); y <= rect.bottom(); y++) {
+        auto sourceLine = (const quint16*)sourceImage.constScanLine(y);
+        auto mirrorLine = (quint32*)(bits + y * stride);
+        convertRgb16(sourceLine + rect.left(), rect.width(), mirrorLine + rect.left());
+    }
+}
+
+DisplayMirror::DisplayMirror(ScreenBuffer *source, QObject *parent)
+    : QObject(parent), d_ptr(new DisplayMirrorPrivate) {
+    Q_D(DisplayMirror);
+    d->sourceBuffer = source;
+    d->performanceCounters = nullptr;
+    Q_ASSERT(d->sourceBuffer);
+}
+
+DisplayMirror::~DisplayMirror() {
+    delete d_ptr;
+}
+
+QImage DisplayMirror::createImage() const {
+    Q_D(const DisplayMirror);
+    d->synchronize();
+    d->convert(d->staleRegion);
+    return d->mirrorImage;
+}
+
+QImage DisplayMirror::createImage(const QRegion &region) const {
+    Q_D(const DisplayMirror);
+    d->synchronize();
+    d->convert(region);
+    return d->mirrorImage;
+}
+
+QSize DisplayMirror::size() const {
+    Q_D(const DisplayMirror);
+    return d->sourceBuffer->size();
+}
+
+void DisplayMirror::render(QPainter *painter, const QRect &rect) const {
+    Q_D(const DisplayMirror);
+    d->synchronize();
+    d->convert(rect);
+    painter->drawImage(rect.topLeft(), d->mirrorImage, rect);
+}
+
+QRegion DisplayMirror::takeDamage() {
+    Q_D(DisplayMirror);
+    d->synchronize();
+    QRegion damage = d->damage;
+    d->damage = QRegion();
+    return damage;
+}
+
+void DisplayMirror::setPerformanceCounters(PerformanceCounters *counters) {
+    Q_D(DisplayMirror);
+    d->performanceCounters = counters;
+}
+
+void DisplayMirror::releaseMemory() {
+    Q_D(DisplayMirror);
+    // the size no longer matches, so the next synchronize() allocates the
+    // image again and marks it stale as a whole
+    d->mirrorImage = QImage();
+    d->staleRegion = QRegion();
+}
+
+qint64 DisplayMirror::memoryUsage() const {
+    Q_D(const DisplayMirror);
+    return d->mirrorImage.byteCount();
+}
@@ -0,0 +1,56 @@
+#ifndef DISPLAYMIRROR_H
+#define DISPLAYMIRROR_H
+
+#include <QObject>
+#include "screenbuffer.h"
+
+class DisplayMirrorPrivate;
+class PerformanceCounters;
+
+/**
+ * The DisplayMirror class is a screen buffer which mirrors given source
+ * screen buffer in QImage::Format_ARGB32_Premultiplied format.
+ *
+ * The remote screen buffer is kept in the session's format, usually RGB16,
+ * which Qt converts to the screen's native 32-bit format whenever it is
+ * painted. The mirror converts only the areas changed since they were last
+ * converted, so that painting does not need to convert the whole desktop on
+ * every frame. Changed areas are converted lazily when they are drawn with
+ * render() or when createImage() is called, so areas which are not shown
+ * are not converted at all.
+ */
+class DisplayMirror : public QObject, public ScreenBuffer {
+    Q_OBJECT
+public:
+    DisplayMirror(ScreenBuffer *source, QObject *parent = 0);
+    ~DisplayMirror();
+
+    virtual QImage createImage() const;
+    virtual QImage createImage(const QRegion &region) const;
+    virtual QSize size() const;
+    virtual void render(QPainter *painter, const QRect &rect) const;
+    virtual QRegion takeDamage();
+
+    /**
+     * Sets @a counters where time spent in updating the mirror is recorded
+     * to.
+     */
+    void setPerformanceCounters(PerformanceCounters *counters);
+
+    /**
+     * Frees the mirror image, which is built again from the source buffer when
+     * the buffer is drawn next time.
+     */
+    void releaseMemory();
+
+    /**
+     * Returns count of bytes allocated for the mirror image.
+     */
+    qint64 memoryUsage() const;
+
+private:
+    Q_DECLARE_PRIVATE(DisplayMirror)
+    DisplayMirrorPrivate* const d_ptr;
+};
+
+#endif // DISPLAYMIRROR_H
@@ -0,0 +1,227 @@
+#include "framebuffermemory.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <string.h>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// size of huge pages on x86-64 and ARM64, smaller blocks use normal pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define CACHE_LINE_SIZE 64
+
+namespace {
+
+QMutex budgetMutex;
+qint64 memoryBudget = 0;
+qint64 allocatedBytes = 0;
+
+bool reserveBudget(qint64 bytes) {
+    QMutexLocker locker(&budgetMutex);
+    if (memoryBudget > 0 && allocatedBytes + bytes > memoryBudget) {
+        return false;
+    }
+    allocatedBytes += bytes;
+    return true;
+}
+
+void releaseBudget(qint64 bytes) {
+    QMutexLocker locker(&budgetMutex);
+    allocatedBytes -= bytes;
+}
+
+qint64 roundUp(qint64 size, qint64 alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+#if defined(Q_OS_UNIX)
+
+qint64 allocationSize(qint64 size, bool hugePages) {
+    if (hugePages && size >= HUGE_PAGE_SIZE) {
+        return roundUp(size, HUGE_PAGE_SIZE);
+    }
+    return roundUp(size, sysconf(_SC_PAGESIZE));
+}
+
+uchar *allocate(qint64 size, bool hugePages, FramebufferMemory::PageType *type) {
+    const int protection = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (!hugePages || size < HUGE_PAGE_SIZE) {
+        auto memory = mmap(nullptr, size, protection, flags, -1, 0);
+        if (memory == MAP_FAILED) {
+            return nullptr;
+        }
+#ifdef MADV_NOHUGEPAGE
+        // transparent huge pages may be enabled for all mappings
+        if (!hugePages) {
+            madvise(memory, size, MADV_NOHUGEPAGE);
+        }
+#endif
+        *type = FramebufferMemory::NormalPages;
+        return (uchar*)memory;
+    }
+
+#ifdef MAP_HUGETLB
+    // succeeds only if the administrator has reserved huge pages
+    auto memory = mmap(nullptr, size, protection, flags | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED) {
+        *type = FramebufferMemory::ExplicitHugePages;
+        return (uchar*)memory;
+    }
+#endif
+
+    // mapped with an extra huge page so that the block can be aligned to a
+    // huge page boundary, which transparent huge pages require
+    auto mapped = mmap(nullptr, size + HUGE_PAGE_SIZE, protection, flags, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+    auto start = (uchar*)mapped;
+    auto aligned = (uchar*)roundUp((quintptr)start, HUGE_PAGE_SIZE);
+    if (aligned > start) {
+        munmap(start, aligned - start);
+    }
+    auto end = start + size + HUGE_PAGE_SIZE;
+    if (end > aligned + size) {
+        munmap(aligned + size, end - (aligned + size));
+    }
+    *type = FramebufferMemory::NormalPages;
+#ifdef MADV_HUGEPAGE
+    if (madvise(aligned, size, MADV_HUGEPAGE) == 0) {
+        *type = FramebufferMemory::TransparentHugePages;
+    }
+#endif
+    return aligned;
+}
+
+void deallocate(uchar *memory, qint64 size) {
+    munmap(memory, size);
+}
+
+#elif defined(Q_OS_WIN)
+
+qint64 allocationSize(qint64 size, bool hugePages) {
+    Q_UNUSED(hugePages);
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return roundUp(size, info.dwPageSize);
+}
+
+uchar *allocate(qint64 size, bool hugePages, FramebufferMemory::PageType *type) {
+    Q_UNUSED(hugePages);
+    // large pages would need SeLockMemoryPrivilege, which users do not have
+    *type = FramebufferMemory::NormalPages;
+    return (uchar*)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+void deallocate(uchar *memory, qint64 size) {
+    Q_UNUSED(size);
+    VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+#else
+
+qint64 allocationSize(qint64 size, bool hugePages) {
+    Q_UNUSED(hugePages);
+    return roundUp(size, CACHE_LINE_SIZE);
+}
+
+uchar *allocate(qint64 size, bool hugePages, FramebufferMemory::PageType *type) {
+    Q_UNUSED(hugePages);
+    *type = FramebufferMemory::NormalPages;
+    auto memory = (uchar*)qMallocAligned(size, CACHE_LINE_SIZE);
+    if (memory) {
+        memset(memory, 0, size);
+    }
+    return memory;
+}
+
+void deallocate(uchar *memory, qint64 size) {
+    Q_UNUSED(size);
+    qFreeAligned(memory);
+}
+
+#endif
+
+}
+
+FramebufferMemory::FramebufferMemory(bool hugePages)
+    : memory(nullptr), length(0), allocated(0), type(NoPages), hugePages(hugePages) {
+}
+
+FramebufferMemory::~FramebufferMemory() {
+    clear();
+}
+
+bool FramebufferMemory::resize(qint64 size) {
+    if (size == length) {
+        return true;
+    }
+    if (size == 0) {
+        clear();
+        return true;
+    }
+
+    qint64 newAllocated = allocationSize(size, hugePages);
+    if (newAllocated == allocated) {
+        // fits into the same pages, the bytes beyond the size are kept zeroed
+        if (size < length) {
+            memset(memory + size, 0, length - size);
+        }
+        length = size;
+        return true;
+    }
+
+    // the old block is counted to the budget until it is freed, so that the
+    // budget holds also while the contents are copied
+    if (!reserveBudget(newAllocated)) {
+        return false;
+    }
+    PageType newType;
+    auto newMemory = allocate(newAllocated, hugePages, &newType);
+    if (!newMemory) {
+        releaseBudget(newAllocated);
+        return false;
+    }
+
+    if (memory) {
+        memcpy(newMemory, memory, qMin(size, length));
+    }
+    clear();
+    memory = newMemory;
+    length = size;
+    allocated = newAllocated;
+    type = newType;
+    return true;
+}
+
+void FramebufferMemory::clear() {
+    if (memory) {
+        deallocate(memory, allocated);
+        releaseBudget(allocated);
+    }
+    memory = nullptr;
+    length = 0;
+    allocated = 0;
+    type = NoPages;
+}
+
+void FramebufferMemory::setBudget(qint64 bytes) {
+    QMutexLocker locker(&budgetMutex);
+    memoryBudget = bytes;
+}
+
+qint64 FramebufferMemory::budget() {
+    QMutexLocker locker(&budgetMutex);
+    return memoryBudget;
+}
+
+qint64 FramebufferMemory::totalAllocated() {
+    QMutexLocker locker(&budgetMutex);
+    return allocatedBytes;
+}
@@ -0,0 +1,90 @@
+#ifndef FRAMEBUFFERMEMORY_H
+#define FRAMEBUFFERMEMORY_H
+
+#include <QtGlobal>
+
+/**
+ * The FramebufferMemory class is a block of memory for a framebuffer.
+ *
+ * On Unix the memory is mapped with mmap(). Blocks of at least a huge page
+ * are backed by explicit huge pages if the system has reserved them, and
+ * otherwise aligned to a huge page boundary and advised to be backed by
+ * transparent huge pages. Huge pages cut the TLB misses of scanning large
+ * framebuffers in decoding, scaling and painting. Elsewhere the memory is
+ * allocated at a page or cache line boundary.
+ *
+ * All framebuffers of the process share a memory budget, set with
+ * setBudget(). An allocation which would exceed the budget fails instead.
+ * New memory is always zeroed.
+ */
+class FramebufferMemory {
+public:
+    enum PageType {
+        NoPages,
+        NormalPages,
+        TransparentHugePages,
+        ExplicitHugePages
+    };
+
+    /**
+     * Creates an empty block. If @a hugePages is false, the block is always
+     * backed by normal pages, e.g. for comparing the layouts.
+     */
+    explicit FramebufferMemory(bool hugePages = true);
+    ~FramebufferMemory();
+
+    /**
+     * Resizes the block to @a size bytes, keeping its contents up to the
+     * smaller of the old and new sizes. Returns false and keeps the block
+     * as it was if the memory budget would be exceeded or the memory cannot
+     * be allocated.
+     */
+    bool resize(qint64 size);
+
+    /**
+     * Frees the block.
+     */
+    void clear();
+
+    uchar *data() const {
+        return memory;
+    }
+
+    qint64 size() const {
+        return length;
+    }
+
+    bool isEmpty() const {
+        return length == 0;
+    }
+
+    PageType pageType() const {
+        return type;
+    }
+
+    /**
+     * Sets budget in bytes for the framebuffers of all sessions of the
+     * process. Budget of 0 (default) is unlimited. Memory already allocated
+     * is not freed if it exceeds the new budget.
+     */
+    static void setBudget(qint64 bytes);
+    static qint64 budget();
+
+    /**
+     * Returns count of bytes allocated for the framebuffers of all sessions
+     * of the process, including the rounding up to whole pages.
+     */
+    static qint64 totalAllocated();
+
+private:
+    Q_DISABLE_COPY(FramebufferMemory)
+
+    uchar *memory;
+    qint64 length;
+    // size of the mapping, rounded up to whole pages
+    qint64 allocated;
+    PageType type;
+    bool hugePages;
+};
+
+#endif // FRAMEBUFFERMEMORY_H
@@ -0,0 +1,247 @@
+#include "frameexporter.h"
+#include "remotescreenbuffer.h"
+#include "sharedframering.h"
+#include "tracer.h"
+
+#include <QDebug>
+#include <QFuture>
+#include <QImage>
+#include <QRegion>
+#include <QTimer>
+#include <QVector>
+#include <QtConcurrentRun>
+
+#if defined(Q_OS_LINUX)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(SYS_memfd_create)
+#define FRAME_EXPORT_MEMFD
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#endif
+#endif
+
+#define EXPORT_INTERVAL_MSEC 25
+#define MAX_SLOT_COUNT 16
+// largest desktop supported by RDP in 32 bits per pixel. Slots are sparse,
+// so only the pages which frames are written to take memory.
+#define MAX_FRAME_BYTES (8192LL * 8192 * 4)
+#define SLOT_HEADER_SIZE 4096
+
+class FrameExporterPrivate {
+public:
+    FrameExporterPrivate()
+        : source(nullptr), consumer(0), fd(-1), memory(nullptr), memorySize(0),
+          frameNumber(0), warnedTooLarge(false) {
+    }
+
+    SharedFrameRingHeader *header() const {
+        return (SharedFrameRingHeader*)memory;
+    }
+
+    SharedFrameSlot *slot(int index) const {
+        return (SharedFrameSlot*)(memory + header()->slotsOffset + index * header()->slotSize);
+    }
+
+    void publishFrame();
+    void unmap();
+
+    RemoteScreenBuffer *source;
+    int consumer;
+    int fd;
+    uchar *memory;
+    qint64 memorySize;
+    // area of each slot changed since the slot was written
+    QVector<QRegion> staleRegions;
+    quint64 frameNumber;
+    bool warnedTooLarge;
+    QFuture<void> publishing;
+    QTimer timer;
+};
+
+namespace {
+
+int bytesPerPixel(QImage::Format format) {
+    switch (format) {
+    case QImage::Format_RGB16:
+    case QImage::Format_RGB555:
+        return 2;
+    case QImage::Format_RGB888:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+}
+
+void FrameExporterPrivate::publishFrame() {
+#ifdef FRAME_EXPORT_MEMFD
+    auto damage = source->takeDamage(consumer);
+    if (damage.isEmpty()) {
+        return;
+    }
+
+    TRACE_SCOPE("exportFrame");
+    auto size = source->size();
+    auto format = source->format();
+    int pixelBytes = bytesPerPixel(format);
+    // rows aligned to cache lines like in the remote screen buffer
+    int stride = ((size.width() * pixelBytes + 63) / 64) * 64;
+    if ((qint64)stride * size.height() > MAX_FRAME_BYTES) {
+        if (!warnedTooLarge) {
+            qWarning() << "Desktop too large for exporting frames:" << size;
+            warnedTooLarge = true;
+        }
+        return;
+    }
+
+    for (int i = 0; i < staleRegions.size(); i++) {
+        staleRegions[i] += damage;
+    }
+    int index = frameNumber % staleRegions.size();
+    auto frame = slot(index);
+    if (frame->width != (quint32)size.width() || frame->height != (quint32)size.height() ||
+            frame->stride != (quint32)stride || frame->format != (quint32)format) {
+        staleRegions[index] = QRect(QPoint(0, 0), size);
+    }
+
+    frame->sequence++;
+    __sync_synchronize();
+
+    frame->frameNumber = frameNumber;
+    frame->width = size.width();
+    frame->height = size.height();
+    frame->stride = stride;
+    frame->format = format;
+    auto rects = damage.rects();
+    if (rects.size() > SharedFrameSlot::MaxDamageRects) {
+        rects = QVector<QRect>() << damage.boundingRect();
+    }
+    frame->damageRectCount = rects.size();
+    for (int i = 0; i < rects.size(); i++) {
+        auto &rect = frame->damageRects[i];
+        rect.x = rects[i].x();
+        rect.y = rects[i].y();
+        rect.width = rects[i].width();
+        rect.height = rects[i].height();
+    }
+
+    auto pixels = (uchar*)frame + frame->pixelsOffset;
+    rects = staleRegions[index].rects();
+    for (int i = 0; i < rects.size(); i++) {
+        auto &rect = rects[i];
+        source->readPixels(rect, pixels + rect.y() * stride + rect.x() * pixelBytes, stride);
+    }
+    staleRegions[index] = QRegion();
+
+    __sync_synchronize();
+    frame->sequence++;
+    frameNumber++;
+    header()->publishedFrames = frameNumber;
+#endif // FRAME_EXPORT_MEMFD
+}
+
+void FrameExporterPrivate::unmap() {
+#ifdef FRAME_EXPORT_MEMFD
+    if (memory) {
+        munmap(memory, memorySize);
+        close(fd);
+    }
+#endif
+    memory = nullptr;
+    memorySize = 0;
+    fd = -1;
+}
+
+FrameExporter::FrameExporter(QObject *parent)
+    : QObject(parent), d_ptr(new FrameExporterPrivate) {
+    Q_D(FrameExporter);
+    d->timer.setInterval(EXPORT_INTERVAL_MSEC);
+    connect(&d->timer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+}
+
+FrameExporter::~FrameExporter() {
+    stop();
+    delete d_ptr;
+}
+
+int FrameExporter::start(int slotCount) {
+    Q_D(FrameExporter);
+    stop();
+
+#ifdef FRAME_EXPORT_MEMFD
+    slotCount = qBound(1, slotCount, MAX_SLOT_COUNT);
+    qint64 slotSize = SLOT_HEADER_SIZE + MAX_FRAME_BYTES;
+    qint64 size = SLOT_HEADER_SIZE + slotCount * slotSize;
+
+    int fd = syscall(SYS_memfd_create, "RemoteDisplay frames", MFD_CLOEXEC);
+    if (fd < 0) {
+        qWarning() << "Cannot create shared memory for exporting frames";
+        return -1;
+    }
+    // the memory stays sparse until frames are written to it
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (memory == MAP_FAILED) {
+        qWarning() << "Cannot map shared memory for exporting frames";
+        close(fd);
+        return -1;
+    }
+
+    d->fd = fd;
+    d->memory = (uchar*)memory;
+    d->memorySize = size;
+    auto header = d->header();
+    header->magic = SharedFrameRingHeader::Magic;
+    header->version = SharedFrameRingHeader::Version;
+    header->slotCount = slotCount;
+    header->slotsOffset = SLOT_HEADER_SIZE;
+    header->slotSize = slotSize;
+    header->publishedFrames = 0;
+    for (int i = 0; i < slotCount; i++) {
+        d->slot(i)->pixelsOffset = SLOT_HEADER_SIZE;
+    }
+
+    d->staleRegions.fill(QRegion(), slotCount);
+    d->frameNumber = 0;
+    d->timer.start();
+    return fd;
+#else
+    Q_UNUSED(slotCount);
+    qWarning() << "Exporting frames is not supported on this platform";
+    return -1;
+#endif
+}
+
+void FrameExporter::stop() {
+    Q_D(FrameExporter);
+    d->timer.stop();
+    d->publishing.waitForFinished();
+    d->unmap();
+}
+
+void FrameExporter::setSource(RemoteScreenBuffer *source) {
+    Q_D(FrameExporter);
+    d->publishing.waitForFinished();
+    if (d->source) {
+        d->source->removeDamageConsumer(d->consumer);
+    }
+    d->source = source;
+    if (d->source) {
+        // the whole buffer is damaged for a new consumer
+        d->consumer = d->source->addDamageConsumer();
+    }
+}
+
+void FrameExporter::onTimeout() {
+    Q_D(FrameExporter);
+    // a frame still being copied delays the next one
+    if (d->source && d->memory && !d->publishing.isRunning()) {
+        d->publishing = QtConcurrent::run(d, &FrameExporterPrivate::publishFrame);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef FRAMEEXPORTER_H
+#define FRAMEEXPORTER_H
+
+#include <QObject>
+
+class FrameExporterPrivate;
+class RemoteScreenBuffer;
+
+/**
+ * The FrameExporter class publishes frames of a remote screen buffer with
+ * their damage into a ring of frames in shared memory, from where other
+ * local processes can read them without copying. The layout of the shared
+ * memory is described in sharedframering.h.
+ *
+ * Frames are published at most 40 times per second and only when the
+ * buffer has changed. Each slot of the ring keeps the area changed since the
+ * slot was last written, so publishing a frame copies only that area. The
+ * copying is done in a background thread.
+ *
+ * The shared memory is created with memfd_create(), so exporting is
+ * supported only on Linux.
+ */
+class FrameExporter : public QObject {
+    Q_OBJECT
+public:
+    FrameExporter(QObject *parent = 0);
+    ~FrameExporter();
+
+    /**
+     * Creates the shared memory with @a slotCount slots and starts
+     * publishing frames. Returns file descriptor of the shared memory, or -1
+     * if it cannot be created.
+     */
+    int start(int slotCount);
+    void stop();
+
+    /**
+     * Sets the screen buffer whose frames are published. The buffer must
+     * outlive the exporter or be replaced before it is destroyed.
+     */
+    void setSource(RemoteScreenBuffer *source);
+
+private slots:
+    void onTimeout();
+
+private:
+    Q_DECLARE_PRIVATE(FrameExporter)
+    FrameExporterPrivate* const d_ptr;
+};
+
+#endif // FRAMEEXPORTER_H
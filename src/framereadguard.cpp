@@ -0,0 +1,60 @@
+#include "framereadguard.h"
+#include "remotedisplaywidget.h"
+#include "remotedisplaywidget_p.h"
+#include "remotescreenbuffer.h"
+
+#include <QRegion>
+
+FrameReadGuard::FrameReadGuard(const RemoteDisplayWidget *widget) : buffer(nullptr) {
+    lock(widget, nullptr);
+}
+
+FrameReadGuard::FrameReadGuard(const RemoteDisplayWidget *widget, const QRegion &area) : buffer(nullptr) {
+    lock(widget, &area);
+}
+
+void FrameReadGuard::lock(const RemoteDisplayWidget *widget, const QRegion *area) {
+    auto d = widget->d_func();
+    RemoteScreenBuffer *remoteBuffer = d->remoteScreenBuffer;
+    if (!remoteBuffer) {
+        return;
+    }
+    QRegion whole(QRect(QPoint(0, 0), remoteBuffer->size()));
+    if (remoteBuffer->lockPixels(area ? *area : whole)) {
+        buffer = remoteBuffer;
+    }
+}
+
+FrameReadGuard::~FrameReadGuard() {
+    if (buffer) {
+        buffer->unlockPixels();
+    }
+}
+
+bool FrameReadGuard::isValid() const {
+    return buffer != nullptr;
+}
+
+QSize FrameReadGuard::size() const {
+    return buffer ? buffer->size() : QSize();
+}
+
+QImage::Format FrameReadGuard::format() const {
+    return buffer ? buffer->format() : QImage::Format_Invalid;
+}
+
+int FrameReadGuard::bytesPerLine() const {
+    return buffer ? buffer->bytesPerLine() : 0;
+}
+
+const uchar *FrameReadGuard::constBits() const {
+    return buffer ? buffer->constBits() : nullptr;
+}
+
+QImage FrameReadGuard::image() const {
+    if (!buffer) {
+        return QImage();
+    }
+    return QImage(buffer->constBits(), buffer->size().width(), buffer->size().height(),
+        buffer->bytesPerLine(), buffer->format());
+}
@@ -0,0 +1,67 @@
+#ifndef FRAMEREADGUARD_H
+#define FRAMEREADGUARD_H
+
+#include <QImage>
+#include "global.h"
+
+class QRegion;
+class RemoteDisplayWidget;
+class RemoteScreenBuffer;
+
+/**
+ * The FrameReadGuard class gives direct access to the pixels of a remote
+ * display session's framebuffer, without copying them.
+ *
+ * While the guard exists, the framebuffer is locked for reading so that it
+ * is not resized or compressed. The guard should be held only for reading
+ * the pixels of the latest damage, e.g. in a slot connected to
+ * RemoteDisplayWidget::frameUpdated(). The widget must not be painted while
+ * the guard exists.
+ *
+ * Updates are still drawn to the framebuffer meanwhile, so it may contain
+ * updates newer than the latest frameUpdated() signal, and the pixels of an
+ * update being drawn may be torn. Their damage is reported with the next
+ * signal.
+ */
+class REMOTEDISPLAYSHARED_EXPORT FrameReadGuard {
+public:
+    explicit FrameReadGuard(const RemoteDisplayWidget *widget);
+
+    /**
+     * Locks only @a area of the framebuffer, e.g. the damage reported with
+     * RemoteDisplayWidget::frameUpdated(). Only the pixels under @a area are
+     * guaranteed to be up to date, so parts of the framebuffer compressed to
+     * save memory need not be decompressed.
+     */
+    FrameReadGuard(const RemoteDisplayWidget *widget, const QRegion &area);
+    ~FrameReadGuard();
+
+    /**
+     * Returns false if the session has no framebuffer, i.e. it is not
+     * connected or the framebuffer does not fit into the memory budget.
+     */
+    bool isValid() const;
+
+    QSize size() const;
+    QImage::Format format() const;
+    int bytesPerLine() const;
+
+    /**
+     * Returns pointer to the first pixel of the framebuffer.
+     */
+    const uchar *constBits() const;
+
+    /**
+     * Returns an image which shares the pixels of the framebuffer. The image
+     * must not be used after the guard has been destroyed.
+     */
+    QImage image() const;
+
+private:
+    Q_DISABLE_COPY(FrameReadGuard)
+    void lock(const RemoteDisplayWidget *widget, const QRegion *area);
+
+    RemoteScreenBuffer *buffer;
+};
+
+#endif // FRAMEREADGUARD_H
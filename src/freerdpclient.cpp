@@ -4,15 +4,25 @@
 #include "freerdphelpers.h"
 #include "bitmaprectanglesink.h"
 #include "pointerchangesink.h"
+#include "clipboardsink.h"
+#include "channelbufferpool.h"
+#include "channelreassembler.h"
 #include "rdpqtsoundplugin.h"
+#include "performancecounters.h"
+#include "inputlatencytracker.h"
+#include "tracer.h"
 
 #include <freerdp/freerdp.h>
 #include <freerdp/input.h>
+#include <freerdp/svc.h>
 #include <freerdp/utils/tcp.h>
 #include <freerdp/cache/pointer.h>
 #include <freerdp/client/channels.h>
 #include <freerdp/client/cmdline.h>
 #include <freerdp/codec/bitmap.h>
+#include <freerdp/client/disp.h>
+#include <freerdp/client/cliprdr.h>
+#include <freerdp/utils/event.h>
 #ifdef Q_OS_UNIX
 #include <freerdp/locale/keyboard.h>
 #endif
@@ -21,6 +31,15 @@
 #include <QPainter>
 #include <QKeyEvent>
 #include <QByteArray>
+#include <QTimer>
+#include <QMutexLocker>
+
+// limits for monitor size in the Display Control channel's monitor layout
+#define DISPLAY_CONTROL_MIN_SIZE 200
+#define DISPLAY_CONTROL_MAX_SIZE 8192
+#define DEFAULT_AUDIO_LATENCY_MSEC 50
+// deferred bitmaps are decoded early if they take more memory than this
+#define MAX_DEFERRED_BITMAP_BYTES (16 * 1024 * 1024)
 
 int FreeRdpClient::instanceCount = 0;
 
@@ -48,7 +67,53 @@ void* channelAddinLoadHook(LPCSTR pszName, LPSTR pszSubsystem, LPSTR pszType, DW
 }
 
 BOOL FreeRdpClient::PreConnectCallback(freerdp* instance) {
-    freerdp_channels_pre_connect(instance->context->channels, instance);
+    auto context = instance->context;
+    auto settings = context->settings;
+
+    if (settings->SupportDisplayControl &&
+        !freerdp_dynamic_channel_collection_find(settings, "disp")) {
+        // Display Control is a dynamic virtual channel, so drdynvc is
+        // loaded as well by freerdp_client_load_addins()
+        char *args[] = { _strdup("disp") };
+        freerdp_client_add_dynamic_channel(settings, 1, args);
+        free(args[0]);
+    }
+
+    // add sound support
+    auto self = getMyContext(instance)->self;
+    if (!freerdp_static_channel_collection_find(settings, "rdpsnd")) {
+        QStringList args;
+        args << "rdpsnd";
+#ifdef WITH_QTSOUND
+        // use Qt Multimedia based audio output
+        args << "sys:qt";
+#endif
+        // passed by rdpsnd to the audio backend when opening it
+        args << QString("latency:%1").arg(self->audioLatency);
+#ifdef WITH_QTSOUND
+        // rdpsnd stops parsing its arguments at the first one it does not
+        // know, so the plugin's own argument is the last
+        if (self->performanceCounters) {
+            args << QString("counters:%1").arg((quintptr)self->performanceCounters);
+        }
+#endif
+        self->addStaticChannel(args);
+    }
+    bool clipboard;
+    {
+        QMutexLocker locker(&self->clipboardMutex);
+        clipboard = self->clipboardSink != nullptr;
+    }
+    if (clipboard && !freerdp_static_channel_collection_find(settings, "cliprdr")) {
+        self->addStaticChannel(QStringList() << "cliprdr");
+    }
+    freerdp_client_load_addins(context->channels, settings);
+    self->addSinkChannels();
+
+    PubSub_SubscribeChannelConnected(context->pubSub,
+        (pChannelConnectedEventHandler)ChannelConnectedCallback);
+
+    freerdp_channels_pre_connect(context->channels, instance);
     emit getMyContext(instance)->self->aboutToConnect();
     return TRUE;
 }
@@ -65,15 +130,26 @@ BOOL FreeRdpClient::PostConnectCallback(freerdp* instance) {
     pointer.New = PointerNewCallback;
     pointer.Free = PointerFreeCallback;
     pointer.Set = PointerSetCallback;
-    pointer.SetNull = NULL;
-    pointer.SetDefault = NULL;
+    pointer.SetNull = PointerSetNullCallback;
+    pointer.SetDefault = PointerSetDefaultCallback;
     graphics_register_pointer(context->freeRdpContext.graphics, &pointer);
+    // the pointer cache handles new, cached and system pointers, but ignores
+    // position updates
+    instance->update->pointer->PointerPosition = PointerPositionCallback;
 
 #ifdef Q_OS_UNIX
     // needed for freerdp_keyboard_get_rdp_scancode_from_x11_keycode() to work
     freerdp_keyboard_init(settings->KeyboardLayout);
 #endif
 
+    self->createChannelReassemblers();
+    if (self->performanceCounters) {
+        for (quint32 i = 0; i < settings->ChannelCount; i++) {
+            auto channel = &settings->ChannelDefArray[i];
+            self->performanceCounters->setChannel(i, channel->ChannelId, channel->Name);
+        }
+    }
+
     freerdp_channels_post_connect(instance->context->channels, instance);
 
     emit self->connected();
@@ -81,12 +157,48 @@ BOOL FreeRdpClient::PostConnectCallback(freerdp* instance) {
     return TRUE;
 }
 
+void FreeRdpClient::ChannelConnectedCallback(rdpContext *context, ChannelConnectedEventArgs *e) {
+    if (strcmp(e->name, DISP_DVC_CHANNEL_NAME) == 0) {
+        auto self = getMyContext(context)->self;
+        self->displayControl = (DispClientContext*)e->pInterface;
+        // the channel connects in its own thread, send any size requested
+        // before it from the RDP thread
+        QMetaObject::invokeMethod(self, "sendDesktopSizeRequest", Qt::QueuedConnection);
+    }
+}
+
+void FreeRdpClient::DesktopResizeCallback(rdpContext *context) {
+    auto settings = context->settings;
+    auto self = getMyContext(context)->self;
+    // bitmaps of the old desktop, the host sends the whole resized one
+    self->deferredBitmaps.clear();
+    self->deferredBytes = 0;
+    emit self->desktopResized(settings->DesktopWidth, settings->DesktopHeight);
+    if (self->outputResumed) {
+        self->sendOutputAllowed();
+    }
+}
+
 void FreeRdpClient::PostDisconnectCallback(freerdp* instance) {
     emit getMyContext(instance)->self->disconnected();
 }
 
 int FreeRdpClient::ReceiveChannelDataCallback(freerdp *instance, int channelId,
     BYTE *data, int size, int flags, int total_size) {
+    auto self = getMyContext(instance)->self;
+    auto counters = self->performanceCounters;
+    if (counters) {
+        counters->addChannelBytes(channelId, size);
+        // a PDU larger than a chunk arrives in many, the last one flagged
+        if (flags & CHANNEL_FLAG_LAST) {
+            counters->addChannelPdu(channelId);
+        }
+    }
+    auto reassembler = self->channelReassemblers.value(channelId);
+    if (reassembler) {
+        reassembler->addChunk((const char*)data, size, flags, total_size);
+        return 0;
+    }
     return freerdp_channels_data(instance, channelId, data, size, flags, total_size);
 }
 
@@ -102,35 +214,129 @@ void FreeRdpClient::PointerSetCallback(rdpContext *context, rdpPointer *pointer)
     getMyContext(context)->self->pointerChangeSink->changePointer(pointer);
 }
 
+void FreeRdpClient::PointerSetNullCallback(rdpContext *context) {
+    getMyContext(context)->self->pointerChangeSink->changeToNullPointer();
+}
+
+void FreeRdpClient::PointerSetDefaultCallback(rdpContext *context) {
+    getMyContext(context)->self->pointerChangeSink->changeToDefaultPointer();
+}
+
+void FreeRdpClient::PointerPositionCallback(rdpContext *context, POINTER_POSITION_UPDATE *position) {
+    getMyContext(context)->self->pointerChangeSink->movePointer(position->xPos, position->yPos);
+}
+
 void FreeRdpClient::BitmapUpdateCallback(rdpContext *context, BITMAP_UPDATE *updates) {
+    TRACE_SCOPE("BitmapUpdate");
     auto self = getMyContext(context)->self;
-    auto sink = self->bitmapRectangleSink;
+    auto counters = self->performanceCounters;
+
+    if (self->bitmapRectangleSink) {
+        if (counters) {
+            counters->add(PerformanceCounters::UpdatesReceived);
+            counters->add(PerformanceCounters::RectanglesReceived, updates->number);
+        }
 
-    if (sink) {
         for (quint32 i = 0; i < updates->number; i++) {
             auto u = &updates->rectangles[i];
-            QRect rect(u->destLeft, u->destTop, u->width, u->height);
-            QByteArray data;
-            Q_ASSERT(u->bitsPerPixel == 16);
-
-            if (u->compressed) {
-                data.resize(u->width * u->height * (u->bitsPerPixel / 8));
-                if (!bitmap_decompress(u->bitmapDataStream, (BYTE*)data.data(), u->width, u->height, u->bitmapLength, u->bitsPerPixel, u->bitsPerPixel)) {
-                    qWarning() << "Bitmap update decompression failed";
-                }
+            if (counters) {
+                counters->add(PerformanceCounters::BitmapBytesReceived, u->bitmapLength);
+            }
+            if (self->updateInterval > 0) {
+                self->deferBitmap(u);
             } else {
-                data = QByteArray((char*)u->bitmapDataStream, u->bitmapLength);
+                self->addBitmap(QRect(u->destLeft, u->destTop, u->width, u->height),
+                    u->compressed, u->bitsPerPixel, u->bitmapDataStream, u->bitmapLength);
             }
+        }
+        if (self->updateInterval == 0) {
+            emit self->desktopUpdated();
+        }
+    }
+}
 
-            sink->addRectangle(rect, data);
+void FreeRdpClient::addBitmap(const QRect &rect, bool compressed, int bitsPerPixel,
+    const BYTE *bitmap, quint32 length) {
+    QByteArray data;
+    Q_ASSERT(bitsPerPixel == 16);
+
+    {
+        TRACE_SCOPE("decodeRectangle");
+        LatencyTimer timer(performanceCounters, PerformanceCounters::DecodeLatency);
+        int width = rect.width();
+        int height = rect.height();
+        if (compressed) {
+            data.resize(width * height * (bitsPerPixel / 8));
+            if (!bitmap_decompress((BYTE*)bitmap, (BYTE*)data.data(), width, height, length, bitsPerPixel, bitsPerPixel)) {
+                qWarning() << "Bitmap update decompression failed";
+                return;
+            }
+        } else {
+            // uncompressed bitmaps are stored bottom-up
+            int stride = (width * (bitsPerPixel / 8) + 3) & ~3;
+            if (length < (quint32)stride * height) {
+                qWarning() << "Bitmap update is shorter than its size";
+                return;
+            }
+            data.resize(stride * height);
+            for (int y = 0; y < height; y++) {
+                memcpy(data.data() + y * stride, bitmap + (height - 1 - y) * stride, stride);
+            }
         }
-        emit self->desktopUpdated();
     }
+
+    {
+        LatencyTimer timer(performanceCounters, PerformanceCounters::BlitLatency);
+        bitmapRectangleSink->addRectangle(rect, data);
+    }
+
+    if (inputLatencyTracker) {
+        inputLatencyTracker->damageReceived(rect);
+    }
+}
+
+void FreeRdpClient::deferBitmap(BITMAP_DATA *bitmap) {
+    QRect rect(bitmap->destLeft, bitmap->destTop, bitmap->width, bitmap->height);
+    // bitmaps covered by the new one need not be decoded at all
+    for (int i = deferredBitmaps.size() - 1; i >= 0; i--) {
+        if (rect.contains(deferredBitmaps[i].rect)) {
+            deferredBytes -= deferredBitmaps[i].data.size();
+            deferredBitmaps.removeAt(i);
+        }
+    }
+
+    DeferredBitmap deferred;
+    deferred.rect = rect;
+    deferred.compressed = bitmap->compressed;
+    deferred.bitsPerPixel = bitmap->bitsPerPixel;
+    deferred.data = QByteArray((const char*)bitmap->bitmapDataStream, bitmap->bitmapLength);
+    deferredBitmaps << deferred;
+    deferredBytes += deferred.data.size();
+    if (deferredBytes > MAX_DEFERRED_BITMAP_BYTES) {
+        decodeDeferredBitmaps();
+    }
+}
+
+void FreeRdpClient::decodeDeferredBitmaps() {
+    if (deferredBitmaps.isEmpty()) {
+        return;
+    }
+    for (int i = 0; i < deferredBitmaps.size(); i++) {
+        auto &deferred = deferredBitmaps[i];
+        addBitmap(deferred.rect, deferred.compressed, deferred.bitsPerPixel,
+            (const BYTE*)deferred.data.constData(), deferred.data.size());
+    }
+    deferredBitmaps.clear();
+    deferredBytes = 0;
+    emit desktopUpdated();
 }
 
 FreeRdpClient::FreeRdpClient(PointerChangeSink *pointerSink)
     : freeRdpInstance(nullptr), bitmapRectangleSink(nullptr),
-      pointerChangeSink(pointerSink) {
+      pointerChangeSink(pointerSink), performanceCounters(nullptr),
+      inputLatencyTracker(nullptr), clipboardSink(nullptr), displayControl(nullptr),
+      audioLatency(DEFAULT_AUDIO_LATENCY_MSEC), outputResumed(false),
+      updateInterval(0), deferredBytes(0), channelBufferPool(new ChannelBufferPool) {
 
     if (instanceCount == 0) {
         freerdp_channels_global_init();
@@ -140,9 +346,15 @@ FreeRdpClient::FreeRdpClient(PointerChangeSink *pointerSink)
     instanceCount++;
 
     loop = new FreeRdpEventLoop(this);
+    deferTimer = new QTimer(this);
+    connect(deferTimer, SIGNAL(timeout()), this, SLOT(decodeDeferredBitmaps()));
+    connect(loop, SIGNAL(channelEventReceived(wMessage*)),
+        this, SLOT(onChannelEvent(wMessage*)), Qt::DirectConnection);
 }
 
 FreeRdpClient::~FreeRdpClient() {
+    qDeleteAll(channelReassemblers);
+    delete channelBufferPool;
     if (freeRdpInstance) {
         freerdp_channels_free(freeRdpInstance->context->channels);
         freerdp_context_free(freeRdpInstance);
@@ -196,6 +408,12 @@ void FreeRdpClient::sendKeyEvent(QKeyEvent *event) {
 
     if (input) {
         freerdp_input_send_keyboard_event_ex(input, down, code);
+        if (performanceCounters) {
+            performanceCounters->add(PerformanceCounters::InputEventsSent);
+        }
+        if (inputLatencyTracker) {
+            inputLatencyTracker->inputSent(QRect());
+        }
     }
 }
 
@@ -203,6 +421,93 @@ void FreeRdpClient::setBitmapRectangleSink(BitmapRectangleSink *sink) {
     bitmapRectangleSink = sink;
 }
 
+void FreeRdpClient::setPerformanceCounters(PerformanceCounters *counters) {
+    performanceCounters = counters;
+}
+
+void FreeRdpClient::setInputLatencyTracker(InputLatencyTracker *tracker) {
+    inputLatencyTracker = tracker;
+}
+
+void FreeRdpClient::setClipboardSink(ClipboardSink *sink) {
+    QMutexLocker locker(&clipboardMutex);
+    clipboardSink = sink;
+}
+
+void FreeRdpClient::sendClipboardFormats(const QList<quint32> &formats) {
+    auto event = (RDP_CB_FORMAT_LIST_EVENT*)freerdp_event_new(CliprdrChannel_Class,
+        CliprdrChannel_FormatList, nullptr, nullptr);
+    event->num_formats = formats.size();
+    if (!formats.isEmpty()) {
+        // freed with the event
+        event->formats = (UINT32*)malloc(formats.size() * sizeof(UINT32));
+        for (int i = 0; i < formats.size(); i++) {
+            event->formats[i] = formats[i];
+        }
+    }
+    sendChannelEvent((wMessage*)event);
+}
+
+void FreeRdpClient::requestClipboardData(quint32 format) {
+    auto event = (RDP_CB_DATA_REQUEST_EVENT*)freerdp_event_new(CliprdrChannel_Class,
+        CliprdrChannel_DataRequest, nullptr, nullptr);
+    event->format = format;
+    sendChannelEvent((wMessage*)event);
+}
+
+void FreeRdpClient::sendClipboardData(char *data, int size) {
+    auto event = (RDP_CB_DATA_RESPONSE_EVENT*)freerdp_event_new(CliprdrChannel_Class,
+        CliprdrChannel_DataResponse, nullptr, nullptr);
+    // sent without copying, the channel frees the data with the event
+    event->data = (BYTE*)data;
+    event->size = data ? size : 0;
+    sendChannelEvent((wMessage*)event);
+}
+
+void FreeRdpClient::sendChannelEvent(wMessage *event) {
+    if (!freeRdpInstance || !freeRdpInstance->context) {
+        freerdp_event_free(event);
+        return;
+    }
+    // the channel queues the event to its own thread, or frees it if the
+    // channel is not loaded
+    freerdp_channels_send_event(freeRdpInstance->context->channels, event);
+}
+
+void FreeRdpClient::onChannelEvent(wMessage *event) {
+    // held while the sink is called, so that it is not destroyed meanwhile
+    QMutexLocker locker(&clipboardMutex);
+    if (!clipboardSink || GetMessageClass(event->id) != CliprdrChannel_Class) {
+        return;
+    }
+
+    switch (GetMessageType(event->id)) {
+    case CliprdrChannel_MonitorReady:
+        clipboardSink->clipboardReady();
+        break;
+    case CliprdrChannel_FormatList: {
+        auto formatList = (RDP_CB_FORMAT_LIST_EVENT*)event;
+        QList<quint32> formats;
+        for (int i = 0; i < formatList->num_formats; i++) {
+            formats << formatList->formats[i];
+        }
+        clipboardSink->remoteFormatsChanged(formats);
+        break;
+    }
+    case CliprdrChannel_DataRequest:
+        clipboardSink->localDataRequested(((RDP_CB_DATA_REQUEST_EVENT*)event)->format);
+        break;
+    case CliprdrChannel_DataResponse: {
+        // the sink takes the data, so it is not freed with the event
+        auto response = (RDP_CB_DATA_RESPONSE_EVENT*)event;
+        clipboardSink->remoteDataReceived((char*)response->data, response->size);
+        response->data = nullptr;
+        response->size = 0;
+        break;
+    }
+    }
+}
+
 quint8 FreeRdpClient::getDesktopBpp() const {
     if (freeRdpInstance && freeRdpInstance->settings) {
         return freeRdpInstance->settings->ColorDepth;
@@ -210,6 +515,14 @@ quint8 FreeRdpClient::getDesktopBpp() const {
     return 0;
 }
 
+QSize FreeRdpClient::getDesktopSize() const {
+    if (freeRdpInstance && freeRdpInstance->settings) {
+        auto settings = freeRdpInstance->settings;
+        return QSize(settings->DesktopWidth, settings->DesktopHeight);
+    }
+    return QSize();
+}
+
 void FreeRdpClient::run() {
 
     initFreeRDP();
@@ -256,20 +569,12 @@ void FreeRdpClient::initFreeRDP() {
 
     auto update = freeRdpInstance->update;
     update->BitmapUpdate = BitmapUpdateCallback;
+    update->DesktopResize = DesktopResizeCallback;
 
     auto settings = freeRdpInstance->context->settings;
     settings->EmbeddedWindow = TRUE;
 
-    // add sound support
     freeRdpInstance->context->channels = freerdp_channels_new();
-#ifdef WITH_QTSOUND
-    // use Qt Multimedia based audio output
-    addStaticChannel(QStringList() << "rdpsnd" << "sys:qt");
-#else
-    // use what FreeRDP provides
-    addStaticChannel(QStringList() << "rdpsnd");
-#endif
-    freerdp_client_load_addins(freeRdpInstance->context->channels, settings);
 }
 
 void FreeRdpClient::sendMouseEvent(UINT16 flags, const QPoint &pos) {
@@ -278,7 +583,64 @@ void FreeRdpClient::sendMouseEvent(UINT16 flags, const QPoint &pos) {
     if (freeRdpInstance) {
         auto input = freeRdpInstance->input;
         if (input && input->MouseEvent) {
+            // many local mouse moves map to the same remote position when
+            // the desktop is scaled down, send only the first of them
+            if (flags == PTR_FLAGS_MOVE && pos == lastMousePosition) {
+                if (performanceCounters) {
+                    performanceCounters->add(PerformanceCounters::InputEventsCoalesced);
+                }
+                return;
+            }
+            lastMousePosition = pos;
+
             input->MouseEvent(input, flags, pos.x(), pos.y());
+            if (performanceCounters) {
+                performanceCounters->add(PerformanceCounters::InputEventsSent);
+            }
+            // hovering answers itself with unrelated damage near the
+            // pointer, so only button events are measured
+            if (inputLatencyTracker && flags != PTR_FLAGS_MOVE) {
+                inputLatencyTracker->mouseInputSent(pos);
+            }
+        }
+    }
+}
+
+void FreeRdpClient::addChannelPduSink(const QString &name, ChannelPduSink *sink) {
+    channelPduSinks.insert(name, sink);
+}
+
+void FreeRdpClient::addSinkChannels() {
+    auto settings = freeRdpInstance->settings;
+    for (auto i = channelPduSinks.begin(); i != channelPduSinks.end(); ++i) {
+        auto name = i.key().toLatin1();
+        bool found = false;
+        for (quint32 j = 0; j < settings->ChannelCount && !found; j++) {
+            found = name == settings->ChannelDefArray[j].Name;
+        }
+        if (found || name.size() > CHANNEL_NAME_LEN || settings->ChannelCount >= settings->ChannelDefArraySize) {
+            qWarning() << "Cannot join virtual channel" << i.key();
+            continue;
+        }
+        // declared to the remote host like the addins declare theirs
+        auto channel = &settings->ChannelDefArray[settings->ChannelCount++];
+        memset(channel, 0, sizeof(*channel));
+        strncpy(channel->Name, name.constData(), CHANNEL_NAME_LEN);
+        channel->options = CHANNEL_OPTION_INITIALIZED;
+    }
+}
+
+void FreeRdpClient::createChannelReassemblers() {
+    qDeleteAll(channelReassemblers);
+    channelReassemblers.clear();
+    // the remote host has assigned the channel ids by now
+    auto settings = freeRdpInstance->settings;
+    for (quint32 i = 0; i < settings->ChannelCount; i++) {
+        auto channel = &settings->ChannelDefArray[i];
+        auto sink = channelPduSinks.value(QString::fromLatin1(channel->Name));
+        if (sink) {
+            channelReassemblers.insert(channel->ChannelId,
+                new ChannelReassembler(channel->Name, sink, channelBufferPool));
         }
     }
 }
@@ -318,3 +680,103 @@ void FreeRdpClient::setSettingDesktopSize(quint16 width, quint16 height) {
     settings->DesktopWidth = width;
     settings->DesktopHeight = height;
 }
+
+void FreeRdpClient::setSettingDynamicResolution(bool enabled) {
+    initFreeRDP();
+    auto settings = freeRdpInstance->settings;
+    settings->SupportDisplayControl = enabled;
+}
+
+void FreeRdpClient::setSettingAudioLatency(int msecs) {
+    audioLatency = msecs > 0 ? msecs : DEFAULT_AUDIO_LATENCY_MSEC;
+}
+
+void FreeRdpClient::requestDesktopSize(quint16 width, quint16 height) {
+    requestedDesktopSize = QSize(width, height);
+    sendDesktopSizeRequest();
+}
+
+void FreeRdpClient::suppressOutput() {
+    if (freeRdpInstance && freeRdpInstance->update->SuppressOutput) {
+        auto update = freeRdpInstance->update;
+        update->SuppressOutput(update->context, FALSE, NULL);
+        outputResumed = false;
+    }
+}
+
+void FreeRdpClient::resumeOutput(const QRect &area) {
+    if (!freeRdpInstance) {
+        return;
+    }
+    // the whole desktop is allowed, so that areas panned into view later
+    // are updated too
+    outputResumed = true;
+    sendOutputAllowed();
+    refreshArea(area);
+}
+
+void FreeRdpClient::refreshArea(const QRect &area) {
+    auto update = freeRdpInstance ? freeRdpInstance->update : nullptr;
+    if (!update || !update->RefreshRect || area.isEmpty()) {
+        return;
+    }
+
+    RECTANGLE_16 rect;
+    rect.left = area.left();
+    rect.top = area.top();
+    rect.right = area.right();
+    rect.bottom = area.bottom();
+    update->RefreshRect(update->context, 1, &rect);
+}
+
+void FreeRdpClient::sendOutputAllowed() {
+    auto settings = freeRdpInstance->settings;
+    auto update = freeRdpInstance->update;
+    if (!update->SuppressOutput) {
+        return;
+    }
+
+    RECTANGLE_16 rect;
+    rect.left = 0;
+    rect.top = 0;
+    rect.right = settings->DesktopWidth - 1;
+    rect.bottom = settings->DesktopHeight - 1;
+    update->SuppressOutput(update->context, TRUE, &rect);
+}
+
+void FreeRdpClient::setUpdateInterval(int msecs) {
+    updateInterval = msecs;
+    if (msecs > 0) {
+        deferTimer->start(msecs);
+    } else {
+        deferTimer->stop();
+        decodeDeferredBitmaps();
+    }
+}
+
+void FreeRdpClient::sendDesktopSizeRequest() {
+    if (!displayControl || !requestedDesktopSize.isValid()) {
+        return;
+    }
+
+    // the width must be even and both dimensions within the limits
+    auto width = qBound(DISPLAY_CONTROL_MIN_SIZE, requestedDesktopSize.width(),
+        DISPLAY_CONTROL_MAX_SIZE) & ~1;
+    auto height = qBound(DISPLAY_CONTROL_MIN_SIZE, requestedDesktopSize.height(),
+        DISPLAY_CONTROL_MAX_SIZE);
+    requestedDesktopSize = QSize();
+
+    auto settings = freeRdpInstance->settings;
+    if (width == (int)settings->DesktopWidth && height == (int)settings->DesktopHeight) {
+        return;
+    }
+
+    DISPLAY_CONTROL_MONITOR_LAYOUT layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.Flags = DISPLAY_CONTROL_MONITOR_PRIMARY;
+    layout.Width = width;
+    layout.Height = height;
+    layout.DesktopScaleFactor = 100;
+    layout.DeviceScaleFactor = 100;
+    displayControl->SendMonitorLayout(displayControl, 1, &layout);
+}
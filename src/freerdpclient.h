@@ -3,13 +3,25 @@
 
 #include <QWidget>
 #include <QPointer>
+#include <QMutex>
+#include <QMap>
+#include <QHash>
 #include <freerdp/freerdp.h>
+#include <freerdp/event.h>
+#include <freerdp/client/disp.h>
 
 class FreeRdpEventLoop;
 class Cursor;
 class BitmapRectangleSink;
+class ClipboardSink;
+class ChannelPduSink;
+class ChannelBufferPool;
+class ChannelReassembler;
 class PointerChangeSink;
 class ScreenBuffer;
+class PerformanceCounters;
+class InputLatencyTracker;
+class QTimer;
 
 class FreeRdpClient : public QObject {
     Q_OBJECT
@@ -18,8 +30,46 @@ public:
     ~FreeRdpClient();
 
     void setBitmapRectangleSink(BitmapRectangleSink *sink);
+    void setPerformanceCounters(PerformanceCounters *counters);
+    void setInputLatencyTracker(InputLatencyTracker *tracker);
+
+    /**
+     * Sets @a sink where the events of the clipboard redirection channel are
+     * fed into. The channel is loaded only if a sink is set before
+     * connecting. Can be called from any thread, and once it returns, the
+     * previous sink is no longer called, so it can be destroyed.
+     */
+    void setClipboardSink(ClipboardSink *sink);
+
+    /**
+     * Announces @a formats of the local clipboard to the remote host. Can be
+     * called from any thread.
+     */
+    void sendClipboardFormats(const QList<quint32> &formats);
+
+    /**
+     * Asks the remote host for the data of its clipboard in @a format, which
+     * is given to the clipboard sink when received. Can be called from any
+     * thread.
+     */
+    void requestClipboardData(quint32 format);
+
+    /**
+     * Sends @a size bytes of local clipboard @a data requested by the remote
+     * host, or null data if the request failed. Takes ownership of the data,
+     * which must be allocated with malloc(). Can be called from any thread.
+     */
+    void sendClipboardData(char *data, int size);
+
+    /**
+     * Joins static virtual channel @a name, for which FreeRDP has no addin,
+     * and feeds its complete PDUs into @a sink. Must be called before
+     * connecting.
+     */
+    void addChannelPduSink(const QString &name, ChannelPduSink *sink);
 
     quint8 getDesktopBpp() const;
+    QSize getDesktopSize() const;
 
     void sendMouseMoveEvent(const QPoint &pos);
     void sendMousePressEvent(Qt::MouseButton button, const QPoint &pos);
@@ -30,6 +80,48 @@ public slots:
     void setSettingServerHostName(const QString &host);
     void setSettingServerPort(quint16 port);
     void setSettingDesktopSize(quint16 width, quint16 height);
+    void setSettingDynamicResolution(bool enabled);
+
+    /**
+     * Sets latency in milliseconds which audio playback aims for, or 0 for
+     * the default.
+     */
+    void setSettingAudioLatency(int msecs);
+
+    /**
+     * Asks the remote host to change its desktop size to @a width x
+     * @a height through the Display Control channel. The change takes effect
+     * when the host resizes the desktop, which is notified with
+     * desktopResized() signal.
+     */
+    void requestDesktopSize(quint16 width, quint16 height);
+
+    /**
+     * Asks the remote host to stop sending graphics updates with a Suppress
+     * Output PDU.
+     */
+    void suppressOutput();
+
+    /**
+     * Asks the remote host to resume sending graphics updates of the whole
+     * desktop, suppressed with suppressOutput(), and to send again the
+     * @a area of the desktop which may have changed meanwhile.
+     */
+    void resumeOutput(const QRect &area);
+
+    /**
+     * Asks the remote host to send again the @a area of the desktop with a
+     * Refresh Rect PDU.
+     */
+    void refreshArea(const QRect &area);
+
+    /**
+     * Limits decoding of received bitmap updates to once in @a msecs
+     * milliseconds, or removes the limit if @a msecs is 0. Meanwhile the
+     * updates are kept compressed, and those covered by later updates are
+     * never decoded. Other received data is processed without delay.
+     */
+    void setUpdateInterval(int msecs);
 
     void run();
     void requestStop();
@@ -40,12 +132,35 @@ signals:
     void disconnected();
     void desktopUpdated();
 
+    /**
+     * This signal is emitted from the RDP thread when the remote host has
+     * changed the desktop size. The bitmap updates following this signal are
+     * of the new size, so the signal should be connected with
+     * Qt::BlockingQueuedConnection to have the screen buffer resized before
+     * them.
+     */
+    void desktopResized(quint16 width, quint16 height);
+
+private slots:
+    void sendDesktopSizeRequest();
+    void onChannelEvent(wMessage *event);
+    void decodeDeferredBitmaps();
+
 private:
     void initFreeRDP();
+    void sendChannelEvent(wMessage *event);
     void sendMouseEvent(UINT16 flags, const QPoint &pos);
+    void sendOutputAllowed();
+    void addBitmap(const QRect &rect, bool compressed, int bitsPerPixel,
+        const BYTE *bitmap, quint32 length);
+    void deferBitmap(BITMAP_DATA *bitmap);
     void addStaticChannel(const QStringList& args);
+    void addSinkChannels();
+    void createChannelReassemblers();
 
     static void BitmapUpdateCallback(rdpContext *context, BITMAP_UPDATE *updates);
+    static void DesktopResizeCallback(rdpContext *context);
+    static void ChannelConnectedCallback(rdpContext *context, ChannelConnectedEventArgs *e);
     static BOOL PreConnectCallback(freerdp* instance);
     static BOOL PostConnectCallback(freerdp* instance);
     static void PostDisconnectCallback(freerdp* instance);
@@ -55,10 +170,40 @@ private:
     static void PointerNewCallback(rdpContext* context, rdpPointer* pointer);
     static void PointerFreeCallback(rdpContext* context, rdpPointer* pointer);
     static void PointerSetCallback(rdpContext* context, rdpPointer* pointer);
+    static void PointerSetNullCallback(rdpContext* context);
+    static void PointerSetDefaultCallback(rdpContext* context);
+    static void PointerPositionCallback(rdpContext* context, POINTER_POSITION_UPDATE* position);
 
     freerdp* freeRdpInstance;
     BitmapRectangleSink *bitmapRectangleSink;
     PointerChangeSink *pointerChangeSink;
+    PerformanceCounters *performanceCounters;
+    InputLatencyTracker *inputLatencyTracker;
+    // the sink can be changed from the GUI thread during the session
+    QMutex clipboardMutex;
+    ClipboardSink *clipboardSink;
+    QPoint lastMousePosition;
+    DispClientContext *displayControl;
+    QSize requestedDesktopSize;
+    int audioLatency;
+    // updates were resumed with a desktop rectangle, which must follow the
+    // desktop size
+    bool outputResumed;
+    int updateInterval;
+    // compressed bitmap updates waiting to be decoded
+    struct DeferredBitmap {
+        QRect rect;
+        bool compressed;
+        int bitsPerPixel;
+        QByteArray data;
+    };
+    QList<DeferredBitmap> deferredBitmaps;
+    qint64 deferredBytes;
+    QTimer *deferTimer;
+    // channels whose PDUs are reassembled here instead of by an addin
+    QMap<QString, ChannelPduSink*> channelPduSinks;
+    QHash<int, ChannelReassembler*> channelReassemblers;
+    ChannelBufferPool *channelBufferPool;
     QPointer<FreeRdpEventLoop> loop;
     static int instanceCount;
 };
@@ -1,5 +1,7 @@
 #include "freerdpeventloop.h"
+#include "tracer.h"
 #include <freerdp/channels/channels.h>
+#include <freerdp/utils/event.h>
 #include <QCoreApplication>
 
 FreeRdpEventLoop::FreeRdpEventLoop(QObject *parent) :
@@ -23,6 +25,7 @@ void FreeRdpEventLoop::quit() {
 }
 
 bool FreeRdpEventLoop::handleFds() {
+    TRACE_SCOPE("handleFds");
     int rcount = 0;
     int wcount = 0;
     void* rfds[32];
@@ -57,6 +60,12 @@ bool FreeRdpEventLoop::handleFds() {
         return false;
     }
 
+    wMessage *event;
+    while ((event = freerdp_channels_pop_event(channels))) {
+        emit channelEventReceived(event);
+        freerdp_event_free(event);
+    }
+
     if (freerdp_shall_disconnect(freeRdpInstance)) {
         return false;
     }
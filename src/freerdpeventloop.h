@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <freerdp/freerdp.h>
+#include <winpr/collections.h>
 
 class FreeRdpEventLoop : public QObject {
     Q_OBJECT
@@ -12,6 +13,14 @@ public:
     void exec(freerdp* instance);
     void quit();
 
+signals:
+    /**
+     * This signal is emitted from the RDP thread for each @a event which a
+     * channel has sent to the client. The event is freed after the signal,
+     * so it must be connected with Qt::DirectConnection.
+     */
+    void channelEventReceived(wMessage *event);
+
 private:
     bool handleFds();
     bool waitFds(void **rfds, int rcount, void **wfds, int wcount);
@@ -0,0 +1,540 @@
+#include "imagescaler.h"
+
+#include <QThread>
+#include <QtConcurrentMap>
+#include <qmath.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCALER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(SCALER_SSE2) && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SCALER_AVX2
+#include <immintrin.h>
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+// destination images smaller than this (in pixels) are not split to bands
+#define PARALLEL_THRESHOLD (256 * 1024)
+// channels past the end of a row, as the AVX2 filter reads two taps at a
+// time, one pixel past the last source pixel if the tap count is odd
+#define ROW_PADDING 4
+
+namespace {
+
+/*
+ * The scaler works on intermediate rows of four 16-bit channels (B, G, R, X)
+ * per pixel, with each channel in 8.8 fixed point. Multiplying a channel with
+ * a 0.16 fixed point weight and keeping the high 16 bits of the product keeps
+ * the result in 8.8 fixed point, which maps directly to SSE2's and AVX2's
+ * mulhi_epu16 instructions.
+ */
+
+void expandRow16Generic(const uchar *source, int count, quint16 *out) {
+    auto pixels = reinterpret_cast<const quint16*>(source);
+    for (int i = 0; i < count; i++) {
+        int p = pixels[i];
+        int r = p >> 11;
+        int g = (p >> 5) & 0x3f;
+        int b = p & 0x1f;
+        out[0] = ((b << 3) | (b >> 2)) << 8;
+        out[1] = ((g << 2) | (g >> 4)) << 8;
+        out[2] = ((r << 3) | (r >> 2)) << 8;
+        out[3] = 0;
+        out += 4;
+    }
+}
+
+void expandRow32Generic(const uchar *source, int count, quint16 *out) {
+    auto pixels = reinterpret_cast<const quint32*>(source);
+    for (int i = 0; i < count; i++) {
+        quint32 p = pixels[i];
+        out[0] = (p & 0xff) << 8;
+        out[1] = ((p >> 8) & 0xff) << 8;
+        out[2] = ((p >> 16) & 0xff) << 8;
+        out[3] = 0;
+        out += 4;
+    }
+}
+
+void accumulateGeneric(const quint16 *row, quint16 weight, int count, quint16 *acc) {
+    for (int i = 0; i < count; i++) {
+        acc[i] += (row[i] * (quint32)weight) >> 16;
+    }
+}
+
+void filterRowGeneric(const quint16 *row, const int *offsets, const quint16 *weights,
+        int taps, int first, int last, quint32 *out) {
+    for (int x = first; x < last; x++) {
+        auto p = row + offsets[x] * 4;
+        auto w = weights + x * taps;
+        quint32 acc[3] = { 0, 0, 0 };
+        for (int t = 0; t < taps; t++) {
+            for (int c = 0; c < 3; c++) {
+                acc[c] += (p[t * 4 + c] * (quint32)w[t]) >> 16;
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            acc[c] = qMin<quint32>((acc[c] + 128) >> 8, 255);
+        }
+        out[x] = 0xff000000 | (acc[2] << 16) | (acc[1] << 8) | acc[0];
+    }
+}
+
+#ifdef SCALER_SSE2
+
+void expandRow16Sse2(const uchar *source, int count, quint16 *out) {
+    auto pixels = reinterpret_cast<const quint16*>(source);
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(pixels + i));
+        __m128i r = _mm_srli_epi16(p, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+        __m128i b = _mm_and_si128(p, mask5);
+        r = _mm_slli_epi16(_mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2)), 8);
+        g = _mm_slli_epi16(_mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4)), 8);
+        b = _mm_slli_epi16(_mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2)), 8);
+
+        __m128i bgLow = _mm_unpacklo_epi16(b, g);
+        __m128i bgHigh = _mm_unpackhi_epi16(b, g);
+        __m128i rxLow = _mm_unpacklo_epi16(r, zero);
+        __m128i rxHigh = _mm_unpackhi_epi16(r, zero);
+
+        __m128i *dst = (__m128i*)(out + i * 4);
+        _mm_storeu_si128(dst, _mm_unpacklo_epi32(bgLow, rxLow));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi32(bgLow, rxLow));
+        _mm_storeu_si128(dst + 2, _mm_unpacklo_epi32(bgHigh, rxHigh));
+        _mm_storeu_si128(dst + 3, _mm_unpackhi_epi32(bgHigh, rxHigh));
+    }
+    expandRow16Generic(source + i * 2, count - i, out + i * 4);
+}
+
+void expandRow32Sse2(const uchar *source, int count, quint16 *out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i colorMask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(source + i * 4));
+        __m128i *dst = (__m128i*)(out + i * 4);
+        // interleaving with zero bytes shifts each channel to 8.8
+        _mm_storeu_si128(dst, _mm_and_si128(_mm_unpacklo_epi8(zero, p), colorMask));
+        _mm_storeu_si128(dst + 1, _mm_and_si128(_mm_unpackhi_epi8(zero, p), colorMask));
+    }
+    expandRow32Generic(source + i * 4, count - i, out + i * 4);
+}
+
+void accumulateSse2(const quint16 *row, quint16 weight, int count, quint16 *acc) {
+    const __m128i w = _mm_set1_epi16((short)weight);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i r = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i a = _mm_loadu_si128((const __m128i*)(acc + i));
+        a = _mm_adds_epu16(a, _mm_mulhi_epu16(r, w));
+        _mm_storeu_si128((__m128i*)(acc + i), a);
+    }
+    accumulateGeneric(row + i, weight, count - i, acc + i);
+}
+
+void filterRowSse2(const quint16 *row, const int *offsets, const quint16 *weights,
+        int taps, int first, int last, quint32 *out) {
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+
+    for (int x = first; x < last; x++) {
+        auto p = row + offsets[x] * 4;
+        auto w = weights + x * taps;
+        __m128i acc = _mm_setzero_si128();
+        for (int t = 0; t < taps; t++) {
+            __m128i pixel = _mm_loadl_epi64((const __m128i*)(p + t * 4));
+            acc = _mm_adds_epu16(acc, _mm_mulhi_epu16(pixel, _mm_set1_epi16((short)w[t])));
+        }
+        acc = _mm_srli_epi16(_mm_adds_epu16(acc, round), 8);
+        acc = _mm_or_si128(_mm_packus_epi16(acc, acc), alpha);
+        out[x] = _mm_cvtsi128_si32(acc);
+    }
+}
+
+#endif // SCALER_SSE2
+
+#ifdef SCALER_AVX2
+
+AVX2_FUNCTION void expandRow16Avx2(const uchar *source, int count, quint16 *out) {
+    auto pixels = reinterpret_cast<const quint16*>(source);
+    const __m256i mask5 = _mm256_set1_epi16(0x1f);
+    const __m256i mask6 = _mm256_set1_epi16(0x3f);
+    const __m256i zero = _mm256_setzero_si256();
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(pixels + i));
+        __m256i r = _mm256_srli_epi16(p, 11);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(p, 5), mask6);
+        __m256i b = _mm256_and_si256(p, mask5);
+        r = _mm256_slli_epi16(_mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2)), 8);
+        g = _mm256_slli_epi16(_mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4)), 8);
+        b = _mm256_slli_epi16(_mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2)), 8);
+
+        // unpacking works within 128-bit lanes, so the low lanes hold pixels
+        // 0-7 and the high lanes pixels 8-15
+        __m256i bgLow = _mm256_unpacklo_epi16(b, g);
+        __m256i bgHigh = _mm256_unpackhi_epi16(b, g);
+        __m256i rxLow = _mm256_unpacklo_epi16(r, zero);
+        __m256i rxHigh = _mm256_unpackhi_epi16(r, zero);
+        __m256i pixels01 = _mm256_unpacklo_epi32(bgLow, rxLow);
+        __m256i pixels23 = _mm256_unpackhi_epi32(bgLow, rxLow);
+        __m256i pixels45 = _mm256_unpacklo_epi32(bgHigh, rxHigh);
+        __m256i pixels67 = _mm256_unpackhi_epi32(bgHigh, rxHigh);
+
+        __m256i *dst = (__m256i*)(out + i * 4);
+        _mm256_storeu_si256(dst, _mm256_permute2x128_si256(pixels01, pixels23, 0x20));
+        _mm256_storeu_si256(dst + 1, _mm256_permute2x128_si256(pixels45, pixels67, 0x20));
+        _mm256_storeu_si256(dst + 2, _mm256_permute2x128_si256(pixels01, pixels23, 0x31));
+        _mm256_storeu_si256(dst + 3, _mm256_permute2x128_si256(pixels45, pixels67, 0x31));
+    }
+    expandRow16Sse2(source + i * 2, count - i, out + i * 4);
+}
+
+AVX2_FUNCTION void expandRow32Avx2(const uchar *source, int count, quint16 *out) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i colorMask = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1,
+        0, -1, -1, -1, 0, -1, -1, -1);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(source + i * 4));
+        // unpack works within 128-bit lanes, so order the pixels first such
+        // that unpacking yields pixels 0-3 and 4-7
+        p = _mm256_permute4x64_epi64(p, 0xd8);
+        __m256i *dst = (__m256i*)(out + i * 4);
+        _mm256_storeu_si256(dst, _mm256_and_si256(_mm256_unpacklo_epi8(zero, p), colorMask));
+        _mm256_storeu_si256(dst + 1, _mm256_and_si256(_mm256_unpackhi_epi8(zero, p), colorMask));
+    }
+    expandRow32Sse2(source + i * 4, count - i, out + i * 4);
+}
+
+AVX2_FUNCTION void accumulateAvx2(const quint16 *row, quint16 weight, int count, quint16 *acc) {
+    const __m256i w = _mm256_set1_epi16((short)weight);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i r = _mm256_loadu_si256((const __m256i*)(row + i));
+        __m256i a = _mm256_loadu_si256((const __m256i*)(acc + i));
+        a = _mm256_adds_epu16(a, _mm256_mulhi_epu16(r, w));
+        _mm256_storeu_si256((__m256i*)(acc + i), a);
+    }
+    accumulateSse2(row + i, weight, count - i, acc + i);
+}
+
+AVX2_FUNCTION void filterRowAvx2(const quint16 *row, const int *offsets, const quint16 *weights,
+        int taps, int first, int last, quint32 *out) {
+    const __m256i round = _mm256_set1_epi16(128);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    // spreads two weights over the four channels of two pixels
+    const __m256i spread = _mm256_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 2, 3, 2, 3, 2, 3, 2, 3,
+        0, 1, 0, 1, 0, 1, 0, 1, 2, 3, 2, 3, 2, 3, 2, 3);
+
+    // each lane computes one destination pixel, two taps at a time
+    int x = first;
+    for (; x + 2 <= last; x += 2) {
+        auto p0 = row + offsets[x] * 4;
+        auto p1 = row + offsets[x + 1] * 4;
+        auto w0 = weights + x * taps;
+        auto w1 = w0 + taps;
+        __m256i acc = _mm256_setzero_si256();
+        for (int t = 0; t < taps; t += 2) {
+            __m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i*)(p0 + t * 4))),
+                _mm_loadu_si128((const __m128i*)(p1 + t * 4)), 1);
+            int weight0 = w0[t];
+            int weight1 = w1[t];
+            if (t + 1 < taps) {
+                weight0 |= w0[t + 1] << 16;
+                weight1 |= w1[t + 1] << 16;
+            }
+            __m256i weight = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                _mm_cvtsi32_si128(weight0)), _mm_cvtsi32_si128(weight1), 1);
+            weight = _mm256_shuffle_epi8(weight, spread);
+            acc = _mm256_adds_epu16(acc, _mm256_mulhi_epu16(pixels, weight));
+        }
+        acc = _mm256_adds_epu16(acc, _mm256_srli_si256(acc, 8));
+        acc = _mm256_srli_epi16(_mm256_adds_epu16(acc, round), 8);
+        acc = _mm256_or_si256(_mm256_packus_epi16(acc, acc), alpha);
+        out[x] = _mm256_cvtsi256_si32(acc);
+        out[x + 1] = _mm256_extract_epi32(acc, 4);
+    }
+    filterRowSse2(row, offsets, weights, taps, x, last, out);
+}
+
+#endif // SCALER_AVX2
+
+struct ScaleKernels {
+    void (*expandRow16)(const uchar *source, int count, quint16 *out);
+    void (*expandRow32)(const uchar *source, int count, quint16 *out);
+    void (*accumulate)(const quint16 *row, quint16 weight, int count, quint16 *acc);
+    void (*filterRow)(const quint16 *row, const int *offsets, const quint16 *weights,
+        int taps, int first, int last, quint32 *out);
+    const char *name;
+};
+
+ScaleKernels selectKernels() {
+    ScaleKernels kernels = {
+        expandRow16Generic, expandRow32Generic, accumulateGeneric, filterRowGeneric, "generic"
+    };
+#ifdef SCALER_SSE2
+    kernels.expandRow16 = expandRow16Sse2;
+    kernels.expandRow32 = expandRow32Sse2;
+    kernels.accumulate = accumulateSse2;
+    kernels.filterRow = filterRowSse2;
+    kernels.name = "SSE2";
+#endif
+#ifdef SCALER_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.expandRow16 = expandRow16Avx2;
+        kernels.expandRow32 = expandRow32Avx2;
+        kernels.accumulate = accumulateAvx2;
+        kernels.filterRow = filterRowAvx2;
+        kernels.name = "AVX2";
+    }
+#endif
+    return kernels;
+}
+
+const ScaleKernels &kernels() {
+    static ScaleKernels selected = selectKernels();
+    return selected;
+}
+
+/**
+ * A horizontal band of destination rows, scaled by one thread.
+ */
+struct ScaleBand {
+    void run();
+
+    const uchar *sourceBits;
+    int sourceStride;
+    int sourceDepth;
+    uchar *destinationBits;
+    int destinationStride;
+    const ScaleFilter *horizontal;
+    const ScaleFilter *vertical;
+    QRect rect;
+    quint16 *expanded;
+    quint16 *accumulated;
+};
+
+void ScaleBand::run() {
+    auto &k = kernels();
+    int taps = vertical->taps();
+
+    // source columns needed by the destination columns of the band
+    int firstColumn = horizontal->offsets()[rect.left()];
+    int columns = horizontal->offsets()[rect.right()] + horizontal->taps() - firstColumn;
+    auto expandedRow = expanded + firstColumn * 4;
+    auto accumulatedRow = accumulated + firstColumn * 4;
+
+    for (int y = rect.top(); y <= rect.bottom(); y++) {
+        memset(accumulatedRow, 0, columns * 4 * sizeof(quint16));
+
+        int offset = vertical->offsets()[y];
+        auto weights = vertical->weights() + y * taps;
+        for (int t = 0; t < taps; t++) {
+            if (weights[t] == 0) {
+                continue;
+            }
+            auto line = sourceBits + (offset + t) * sourceStride;
+            if (sourceDepth == 16) {
+                k.expandRow16(line + firstColumn * 2, columns, expandedRow);
+            } else {
+                k.expandRow32(line + firstColumn * 4, columns, expandedRow);
+            }
+            k.accumulate(expandedRow, weights[t], columns * 4, accumulatedRow);
+        }
+
+        k.filterRow(accumulated, horizontal->offsets(), horizontal->weights(),
+            horizontal->taps(), rect.left(), rect.right() + 1,
+            (quint32*)(destinationBits + y * destinationStride));
+    }
+}
+
+}
+
+ScaleFilter::ScaleFilter()
+    : sourceLength(0), destinationLength(0), filterType(Box), tapCount(0) {
+}
+
+void ScaleFilter::build(int sourceSize, int destinationSize, Type type) {
+    sourceLength = sourceSize;
+    destinationLength = destinationSize;
+    filterType = type;
+
+    qreal scale = (qreal)sourceSize / destinationSize;
+    int maxTaps = type == Bilinear ? 2 : qCeil(scale) + 1;
+    if (type == Box) {
+        // box spans cover one pixel less than the bound when the scale is an
+        // integer, e.g. two pixels when halving the size
+        int widest = 1;
+        for (int i = 0; i < destinationSize; i++) {
+            int first = qBound(0, qFloor(i * scale), sourceSize - 1);
+            widest = qMax(widest, qCeil((i + 1) * scale) - first);
+        }
+        maxTaps = qMin(maxTaps, widest);
+    }
+    tapCount = qMin(maxTaps, sourceSize);
+
+    offsetList.fill(0, destinationSize);
+    weightList.fill(0, destinationSize * tapCount);
+    QVector<qreal> coverage(maxTaps);
+
+    for (int i = 0; i < destinationSize; i++) {
+        int first;
+        int count;
+        coverage.fill(0);
+
+        if (type == Box) {
+            qreal low = i * scale;
+            qreal high = (i + 1) * scale;
+            first = qBound(0, qFloor(low), sourceSize - 1);
+            count = qBound(1, qCeil(high) - first, sourceSize - first);
+            for (int j = 0; j < count; j++) {
+                qreal pixelLow = first + j;
+                coverage[j] = qMax<qreal>(0, qMin(high, pixelLow + 1) - qMax(low, pixelLow));
+            }
+        } else {
+            qreal center = (i + 0.5) * scale - 0.5;
+            first = qFloor(center);
+            qreal fraction = center - first;
+            if (first < 0) {
+                first = 0;
+                fraction = 0;
+            }
+            if (first >= sourceSize - 1) {
+                first = sourceSize - 1;
+                fraction = 0;
+            }
+            count = fraction > 0 ? 2 : 1;
+            coverage[0] = 1 - fraction;
+            coverage[1] = fraction;
+        }
+
+        // quantize the weights so that they sum up exactly to 1.0
+        qreal total = 0;
+        for (int j = 0; j < count; j++) {
+            total += coverage[j];
+        }
+        if (total <= 0) {
+            coverage[0] = total = 1;
+        }
+
+        int offset = qBound(0, first, sourceSize - tapCount);
+        auto weights = weightList.data() + i * tapCount + (first - offset);
+        int sum = 0;
+        int largest = 0;
+        QVector<int> quantized(count);
+        for (int j = 0; j < count; j++) {
+            quantized[j] = qFloor(coverage[j] / total * 65536);
+            sum += quantized[j];
+            if (quantized[j] > quantized[largest]) {
+                largest = j;
+            }
+        }
+        quantized[largest] += 65536 - sum;
+        for (int j = 0; j < count; j++) {
+            weights[j] = qMin(quantized[j], 65535);
+        }
+        offsetList[i] = offset;
+    }
+}
+
+ImageScaler::ImageScaler(Quality quality) : scaleQuality(quality) {
+}
+
+ImageScaler::Quality ImageScaler::quality() const {
+    return scaleQuality;
+}
+
+void ImageScaler::setQuality(Quality quality) {
+    scaleQuality = quality;
+}
+
+void ImageScaler::scale(const QImage &source, QImage *destination, const QRect &rect) {
+    Q_ASSERT(isFormatSupported(source.format()));
+    Q_ASSERT(destination->format() == QImage::Format_RGB32);
+
+    QRect area = rect.isNull() ? destination->rect() : rect & destination->rect();
+    if (source.isNull() || area.isEmpty()) {
+        return;
+    }
+
+    auto type = scaleQuality == Bilinear ? ScaleFilter::Bilinear : ScaleFilter::Box;
+    if (!horizontalFilter.matches(source.width(), destination->width(), type)) {
+        horizontalFilter.build(source.width(), destination->width(), type);
+    }
+    if (!verticalFilter.matches(source.height(), destination->height(), type)) {
+        verticalFilter.build(source.height(), destination->height(), type);
+    }
+
+    int bandCount = 1;
+    if (area.width() * area.height() >= PARALLEL_THRESHOLD) {
+        bandCount = qBound(1, QThread::idealThreadCount(), area.height());
+    }
+    if (bandBuffers.size() < bandCount) {
+        bandBuffers.resize(bandCount);
+    }
+
+    // a single band is kept on stack, so that scaling small areas does not
+    // allocate
+    ScaleBand singleBand;
+    QVector<ScaleBand> bandList;
+    auto bands = &singleBand;
+    if (bandCount > 1) {
+        bandList.resize(bandCount);
+        bands = bandList.data();
+    }
+
+    // bits() detaches the destination here, rather than in the band threads
+    auto destinationBits = destination->bits();
+    for (int i = 0; i < bandCount; i++) {
+        auto &buffer = bandBuffers[i];
+        if (buffer.size() < source.width() * 8 + ROW_PADDING) {
+            buffer.resize(source.width() * 8 + ROW_PADDING);
+        }
+
+        auto &band = bands[i];
+        band.sourceBits = source.constBits();
+        band.sourceStride = source.bytesPerLine();
+        band.sourceDepth = source.depth();
+        band.destinationBits = destinationBits;
+        band.destinationStride = destination->bytesPerLine();
+        band.horizontal = &horizontalFilter;
+        band.vertical = &verticalFilter;
+        band.expanded = buffer.data();
+        band.accumulated = buffer.data() + source.width() * 4;
+
+        int top = area.top() + area.height() * i / bandCount;
+        int bottom = area.top() + area.height() * (i + 1) / bandCount;
+        band.rect = QRect(area.left(), top, area.width(), bottom - top);
+    }
+
+    if (bandCount == 1) {
+        singleBand.run();
+    } else {
+        QtConcurrent::blockingMap(bandList, &ScaleBand::run);
+    }
+}
+
+bool ImageScaler::isFormatSupported(QImage::Format format) {
+    return format == QImage::Format_RGB16 || format == QImage::Format_RGB32 ||
+        format == QImage::Format_ARGB32 || format == QImage::Format_ARGB32_Premultiplied;
+}
+
+const char *ImageScaler::instructionSet() {
+    return kernels().name;
+}
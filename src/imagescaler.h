@@ -0,0 +1,105 @@
+#ifndef IMAGESCALER_H
+#define IMAGESCALER_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+/**
+ * The ScaleFilter class contains precomputed fixed point filter kernel for
+ * scaling one dimension of an image.
+ *
+ * Each destination pixel is computed from taps() consecutive source pixels
+ * starting at offsets()[i]. Weights are 0.16 fixed point numbers and the
+ * weights of each destination pixel sum up to 1.0.
+ */
+class ScaleFilter {
+public:
+    enum Type {
+        Bilinear,
+        Box
+    };
+
+    ScaleFilter();
+
+    void build(int sourceSize, int destinationSize, Type type);
+
+    bool matches(int sourceSize, int destinationSize, Type type) const {
+        return sourceSize == sourceLength && destinationSize == destinationLength && type == filterType;
+    }
+
+    int taps() const {
+        return tapCount;
+    }
+
+    const int *offsets() const {
+        return offsetList.constData();
+    }
+
+    const quint16 *weights() const {
+        return weightList.constData();
+    }
+
+private:
+    int sourceLength;
+    int destinationLength;
+    Type filterType;
+    int tapCount;
+    QVector<int> offsetList;
+    QVector<quint16> weightList;
+};
+
+/**
+ * The ImageScaler class scales RGB16 and RGB32 images into RGB32 images.
+ *
+ * The scaler is a separable fixed point filter. Each destination row is
+ * computed by first accumulating the weighted source rows into an
+ * intermediate row, which is then filtered horizontally. The inner loops
+ * use AVX2 or SSE2 when available. Large destination images are split into
+ * horizontal bands which are scaled in parallel with QtConcurrent.
+ *
+ * Filter kernels and intermediate buffers are kept between calls, so
+ * scaling repeatedly between the same sizes does not allocate memory.
+ */
+class ImageScaler {
+public:
+    enum Quality {
+        /**
+         * Interpolates between the two nearest source pixels in each
+         * dimension. Fast, but aliases when downscaling more than 2x.
+         */
+        Bilinear,
+        /**
+         * Averages the area of source pixels covered by each destination
+         * pixel.
+         */
+        Box
+    };
+
+    ImageScaler(Quality quality = Box);
+
+    Quality quality() const;
+    void setQuality(Quality quality);
+
+    /**
+     * Scales @a source to the size of @a destination. The @a destination
+     * must be of format RGB32. If @a rect is given, only that part of the
+     * destination is written.
+     */
+    void scale(const QImage &source, QImage *destination, const QRect &rect = QRect());
+
+    static bool isFormatSupported(QImage::Format format);
+
+    /**
+     * Returns name of the instruction set used by the scaler's inner loops.
+     */
+    static const char *instructionSet();
+
+private:
+    Quality scaleQuality;
+    ScaleFilter horizontalFilter;
+    ScaleFilter verticalFilter;
+    QVector<QVector<quint16> > bandBuffers;
+};
+
+#endif // IMAGESCALER_H
@@ -0,0 +1,79 @@
+#include "inputlatencytracker.h"
+#include "performancecounters.h"
+
+#include <QMutexLocker>
+
+// size of the area around mouse pointer where damage is considered to be a
+// response to a mouse event
+#define MOUSE_AREA_SIZE 64
+#define MAX_PENDING_INPUTS 64
+#define INPUT_EXPIRY_NSEC 3000000000LL
+
+InputLatencyTracker::InputLatencyTracker(PerformanceCounters *counters)
+    : performanceCounters(counters) {
+    clock.start();
+}
+
+void InputLatencyTracker::inputSent(const QRect &area) {
+    PendingInput input;
+    input.area = area;
+    input.sentAt = clock.nsecsElapsed();
+    input.state = Unanswered;
+
+    QMutexLocker locker(&mutex);
+    if (pendingInputs.size() >= MAX_PENDING_INPUTS) {
+        if (pendingInputs.first().state == Unanswered) {
+            unansweredCount.fetchAndAddRelaxed(-1);
+        }
+        pendingInputs.removeFirst();
+    }
+    pendingInputs << input;
+    unansweredCount.fetchAndAddRelaxed(1);
+}
+
+void InputLatencyTracker::mouseInputSent(const QPoint &pos) {
+    QRect area(0, 0, MOUSE_AREA_SIZE, MOUSE_AREA_SIZE);
+    area.moveCenter(pos);
+    inputSent(area);
+}
+
+void InputLatencyTracker::damageReceived(const QRect &rect) {
+    // fast path for the common case of damage without any input
+    if (unansweredCount == 0) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i < pendingInputs.size(); i++) {
+        auto &input = pendingInputs[i];
+        if (input.state == Unanswered && (input.area.isNull() || input.area.intersects(rect))) {
+            input.state = Answered;
+            unansweredCount.fetchAndAddRelaxed(-1);
+        }
+    }
+}
+
+void InputLatencyTracker::damageTaken() {
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i < pendingInputs.size(); i++) {
+        if (pendingInputs[i].state == Answered) {
+            pendingInputs[i].state = Taken;
+        }
+    }
+}
+
+void InputLatencyTracker::framePresented() {
+    auto now = clock.nsecsElapsed();
+
+    QMutexLocker locker(&mutex);
+    for (int i = pendingInputs.size() - 1; i >= 0; i--) {
+        auto &input = pendingInputs[i];
+        if (input.state == Taken) {
+            performanceCounters->record(PerformanceCounters::InputLatency, now - input.sentAt);
+            pendingInputs.removeAt(i);
+        } else if (input.state == Unanswered && now - input.sentAt > INPUT_EXPIRY_NSEC) {
+            unansweredCount.fetchAndAddRelaxed(-1);
+            pendingInputs.removeAt(i);
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef INPUTLATENCYTRACKER_H
+#define INPUTLATENCYTRACKER_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QRect>
+
+class PerformanceCounters;
+
+/**
+ * The InputLatencyTracker class measures input-to-photon latency, i.e. the
+ * time from sending an input event to the remote host until the first
+ * response to it is shown on screen.
+ *
+ * Each sent input event is stamped with inputSent(). The first damage
+ * intersecting the event's area (or for keyboard events, any damage) that is
+ * received after it marks the event as answered. The answer is taken into
+ * the next frame with damageTaken(), called before the frame pulls the
+ * damage from the screen buffers, and when that frame has been painted,
+ * framePresented() records the latency to PerformanceCounters::InputLatency
+ * histogram. Paints of other frames, e.g. on expose events, do not present
+ * the answer. Events without any response within a few seconds are
+ * discarded.
+ *
+ * inputSent(), damageTaken() and framePresented() are called from the GUI
+ * thread and damageReceived() from the RDP thread.
+ */
+class InputLatencyTracker {
+public:
+    InputLatencyTracker(PerformanceCounters *counters);
+
+    /**
+     * Stamps an input event affecting @a area of the remote desktop. A null
+     * @a area is answered by any damage.
+     */
+    void inputSent(const QRect &area);
+
+    /**
+     * Stamps a mouse event at @a pos of the remote desktop.
+     */
+    void mouseInputSent(const QPoint &pos);
+
+    void damageReceived(const QRect &rect);
+    void damageTaken();
+    void framePresented();
+
+private:
+    enum State {
+        Unanswered,
+        Answered,
+        // the answer is in the frame being painted
+        Taken
+    };
+
+    struct PendingInput {
+        QRect area;
+        qint64 sentAt;
+        State state;
+    };
+
+    PerformanceCounters *performanceCounters;
+    QElapsedTimer clock;
+    QMutex mutex;
+    QList<PendingInput> pendingInputs;
+    QAtomicInt unansweredCount;
+};
+
+#endif // INPUTLATENCYTRACKER_H
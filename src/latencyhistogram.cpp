@@ -0,0 +1,52 @@
+#include "latencyhistogram.h"
+
+namespace {
+
+int highestBit(quint64 value) {
+    int bit = 0;
+    for (int step = 32; step > 0; step /= 2) {
+        if (value >> step) {
+            value >>= step;
+            bit += step;
+        }
+    }
+    return bit;
+}
+
+}
+
+LatencyHistogram::LatencyHistogram() {
+}
+
+void LatencyHistogram::record(qint64 nsecs) {
+    counts[bucketIndex(nsecs)].fetchAndAddRelaxed(1);
+}
+
+LatencyStatistics LatencyHistogram::statistics() const {
+    QVector<LatencyStatistics::Bucket> buckets;
+    for (int i = 0; i < BucketCount; i++) {
+        int count = counts[i];
+        if (count > 0) {
+            buckets << qMakePair(bucketUpperBound(i), (qint64)count);
+        }
+    }
+    return LatencyStatistics(buckets);
+}
+
+int LatencyHistogram::bucketIndex(qint64 nsecs) {
+    if (nsecs < 2 * SubBucketCount) {
+        return qMax<int>(nsecs, 0);
+    }
+    int shift = highestBit(nsecs) - 4;
+    int index = shift * SubBucketCount + (int)(nsecs >> shift);
+    return qMin<int>(index, BucketCount - 1);
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int index) {
+    if (index < 2 * SubBucketCount) {
+        return index + 1;
+    }
+    int shift = index / SubBucketCount - 1;
+    qint64 subBucket = index - shift * SubBucketCount;
+    return (subBucket + 1) << shift;
+}
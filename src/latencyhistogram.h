@@ -0,0 +1,41 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QAtomicInt>
+#include "performancereport.h"
+
+/**
+ * The LatencyHistogram class collects latency measurements into log-linear
+ * buckets in the manner of HDR histograms.
+ *
+ * Values below 32 ns have buckets of their own, above that each power of two
+ * is split into 16 buckets. Recording a value is a single relaxed atomic
+ * increment, so it is cheap enough to be done on every update.
+ */
+class LatencyHistogram {
+public:
+    enum {
+        SubBucketCount = 16,
+        BucketCount = 38 * SubBucketCount
+    };
+
+    LatencyHistogram();
+
+    /**
+     * Adds given latency in nanoseconds to the histogram.
+     */
+    void record(qint64 nsecs);
+
+    /**
+     * Returns snapshot of the histogram's current contents.
+     */
+    LatencyStatistics statistics() const;
+
+    static int bucketIndex(qint64 nsecs);
+    static qint64 bucketUpperBound(int index);
+
+private:
+    QAtomicInt counts[BucketCount];
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -1,20 +1,28 @@
 #include "letterboxedscreenbuffer.h"
+#include "performancecounters.h"
 
 #include <QImage>
 #include <QPainter>
+#include <QRegion>
 
 class LetterboxedScreenBufferPrivate {
 public:
     ScreenBuffer *sourceBuffer;
+    PerformanceCounters *performanceCounters;
     QSize size;
     QRect sourceRect;
+    // top, bottom, left and right border
+    QRect borderRects[4];
     QTransform coordinateTransform;
+    // damage of the buffer not yet taken with takeDamage()
+    QRegion damage;
 };
 
 LetterboxedScreenBuffer::LetterboxedScreenBuffer(ScreenBuffer *source, QObject *parent)
     : QObject(parent), d_ptr(new LetterboxedScreenBufferPrivate) {
     Q_D(LetterboxedScreenBuffer);
     d->sourceBuffer = source;
+    d->performanceCounters = nullptr;
     Q_ASSERT(d->sourceBuffer);
 }
 
@@ -24,17 +32,66 @@ LetterboxedScreenBuffer::~LetterboxedScreenBuffer() {
 
 QImage LetterboxedScreenBuffer::createImage() const {
     Q_D(const LetterboxedScreenBuffer);
-    auto sourceImage = d->sourceBuffer->createImage();
-    if (!sourceImage.isNull()) {
-        QImage image(d->size, sourceImage.format());
+    if (d->sourceBuffer->size() == d->size) {
+        // no borders needed
+        return d->sourceBuffer->createImage();
+    }
+    if (!d->size.isEmpty()) {
+        QImage image(d->size, QImage::Format_ARGB32_Premultiplied);
         QPainter painter(&image);
-        painter.fillRect(image.rect(), Qt::black);
-        painter.drawImage(d->sourceRect, sourceImage);
+        render(&painter, image.rect());
         return image;
     }
     return QImage();
 }
 
+QImage LetterboxedScreenBuffer::createImage(const QRegion &region) const {
+    Q_D(const LetterboxedScreenBuffer);
+    if (d->sourceBuffer->size() == d->size) {
+        return d->sourceBuffer->createImage(region);
+    }
+    return createImage();
+}
+
+QSize LetterboxedScreenBuffer::size() const {
+    Q_D(const LetterboxedScreenBuffer);
+    return d->size;
+}
+
+void LetterboxedScreenBuffer::render(QPainter *painter, const QRect &rect) const {
+    Q_D(const LetterboxedScreenBuffer);
+    {
+        LatencyTimer timer(d->performanceCounters, PerformanceCounters::LetterboxLatency);
+        for (int i = 0; i < 4; i++) {
+            auto border = d->borderRects[i] & rect;
+            if (!border.isEmpty()) {
+                painter->fillRect(border, Qt::black);
+            }
+        }
+    }
+
+    auto sourcePart = d->sourceRect & rect;
+    if (!sourcePart.isEmpty()) {
+        auto offset = d->sourceRect.topLeft();
+        painter->translate(offset);
+        d->sourceBuffer->render(painter, sourcePart.translated(-offset));
+        painter->translate(-offset);
+    }
+}
+
+QRegion LetterboxedScreenBuffer::takeDamage() {
+    Q_D(LetterboxedScreenBuffer);
+    QRegion damage = d->damage;
+    damage += d->sourceBuffer->takeDamage().translated(d->sourceRect.topLeft());
+    d->damage = QRegion();
+    return damage;
+}
+
+QPoint LetterboxedScreenBuffer::mapFromSource(const QPoint &point) const {
+    Q_D(const LetterboxedScreenBuffer);
+    return d->coordinateTransform.inverted().map(point);
+}
+
 QPoint LetterboxedScreenBuffer::mapToSource(const QPoint &point) const {
     Q_D(const LetterboxedScreenBuffer);
     QPoint p = d->coordinateTransform.map(point);
@@ -46,12 +103,24 @@ QPoint LetterboxedScreenBuffer::mapToSource(const QPoint &point) const {
 void LetterboxedScreenBuffer::resize(const QSize &size) {
     Q_D(LetterboxedScreenBuffer);
     d->size = size;
-    auto sourceImage = d->sourceBuffer->createImage();
-    if (!sourceImage.isNull()) {
-        d->sourceRect.setSize(sourceImage.size());
+    d->damage = QRect(QPoint(0, 0), size);
+    auto sourceSize = d->sourceBuffer->size();
+    if (!sourceSize.isEmpty()) {
+        d->sourceRect.setSize(sourceSize);
         d->sourceRect.moveCenter(QPoint(size.width() / 2, size.height() / 2));
 
+        auto &s = d->sourceRect;
+        d->borderRects[0] = QRect(0, 0, size.width(), s.top());
+        d->borderRects[1] = QRect(0, s.bottom() + 1, size.width(), size.height() - s.bottom() - 1);
+        d->borderRects[2] = QRect(0, s.top(), s.left(), s.height());
+        d->borderRects[3] = QRect(s.right() + 1, s.top(), size.width() - s.right() - 1, s.height());
+
         d->coordinateTransform.reset();
         d->coordinateTransform.translate(-d->sourceRect.left(), -d->sourceRect.top());
     }
 }
+
+void LetterboxedScreenBuffer::setPerformanceCounters(PerformanceCounters *counters) {
+    Q_D(LetterboxedScreenBuffer);
+    d->performanceCounters = counters;
+}
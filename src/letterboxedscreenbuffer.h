@@ -5,6 +5,7 @@
 #include "screenbuffer.h"
 
 class LetterboxedScreenBufferPrivate;
+class PerformanceCounters;
 class QPoint;
 class QSize;
 
@@ -22,6 +23,10 @@ public:
     ~LetterboxedScreenBuffer();
 
     virtual QImage createImage() const;
+    virtual QImage createImage(const QRegion &region) const;
+    virtual QSize size() const;
+    virtual void render(QPainter *painter, const QRect &rect) const;
+    virtual QRegion takeDamage();
 
     /**
      * Maps given @a point in image returned by createImage() to a point in
@@ -29,12 +34,24 @@ public:
      */
     QPoint mapToSource(const QPoint &point) const;
 
+    /**
+     * Maps given @a point in the source screen buffer's image to a point in
+     * this buffer.
+     */
+    QPoint mapFromSource(const QPoint &point) const;
+
     /**
      * Resizes the screen buffer's dimensions to fit the given @a size.
-     * Call createImage() to get the image with the new @a size.
+     * The whole buffer is damaged.
      */
     void resize(const QSize &size);
 
+    /**
+     * Sets @a counters where time spent in drawing the borders is recorded
+     * to.
+     */
+    void setPerformanceCounters(PerformanceCounters *counters);
+
 private:
     Q_DECLARE_PRIVATE(LetterboxedScreenBuffer)
     LetterboxedScreenBufferPrivate* const d_ptr;
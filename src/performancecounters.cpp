@@ -0,0 +1,92 @@
+#include "performancecounters.h"
+
+#include <QMutexLocker>
+#include <string.h>
+
+namespace {
+
+const char *counterNames[PerformanceCounters::CounterCount] = {
+    "updates",
+    "rectangles",
+    "bitmapBytes",
+    "framesPresented",
+    "framesSkipped",
+    "inputEventsSent",
+    "inputEventsCoalesced",
+    "audioUnderruns",
+    "audioOverruns",
+    "audioFramesDropped",
+    "audioFramesInserted",
+    "audioClockDriftPpm"
+};
+
+const char *latencyNames[PerformanceCounters::LatencyCount] = {
+    "decode",
+    "blit",
+    "mirror",
+    "scale",
+    "letterbox",
+    "paint",
+    "inputToPhoton",
+    "audioBufferDepth",
+    "audioLatency"
+};
+
+}
+
+PerformanceCounters::PerformanceCounters() {
+    memset(channelIds, 0, sizeof(channelIds));
+    lifetime.start();
+}
+
+int PerformanceCounters::channelIndex(int channelId) const {
+    for (int i = 0; i < MaxChannelCount; i++) {
+        if (channelIds[i] == channelId) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void PerformanceCounters::addChannelBytes(int channelId, qint64 bytes) {
+    int index = channelIndex(channelId);
+    if (index >= 0) {
+        channelBytes[index].add(bytes);
+    }
+}
+
+void PerformanceCounters::addChannelPdu(int channelId) {
+    int index = channelIndex(channelId);
+    if (index >= 0) {
+        channelPdus[index].add(1);
+    }
+}
+
+void PerformanceCounters::setChannel(int index, int channelId, const QString &name) {
+    if (index >= 0 && index < MaxChannelCount) {
+        QMutexLocker locker(&channelNamesMutex);
+        channelIds[index] = channelId;
+        channelNames[index] = name;
+    }
+}
+
+PerformanceReport PerformanceCounters::report() const {
+    PerformanceReport report;
+    report.setTimestamp(lifetime.elapsed());
+
+    for (int i = 0; i < CounterCount; i++) {
+        report.setCounter(counterNames[i], counters[i].load());
+    }
+    for (int i = 0; i < LatencyCount; i++) {
+        report.setLatency(latencyNames[i], histograms[i].statistics());
+    }
+
+    QMutexLocker locker(&channelNamesMutex);
+    for (int i = 0; i < MaxChannelCount; i++) {
+        if (!channelNames[i].isEmpty()) {
+            report.setCounter(QString("channelBytes.%1").arg(channelNames[i]), channelBytes[i].load());
+            report.setCounter(QString("channelPdus.%1").arg(channelNames[i]), channelPdus[i].load());
+        }
+    }
+    return report;
+}
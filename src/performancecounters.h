@@ -0,0 +1,171 @@
+#ifndef PERFORMANCECOUNTERS_H
+#define PERFORMANCECOUNTERS_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include "latencyhistogram.h"
+#include "performancereport.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#endif
+
+/**
+ * The AtomicCounter class is a 64-bit counter which can be incremented from
+ * one thread and read from any other thread.
+ */
+class AtomicCounter {
+public:
+    AtomicCounter() : value(0) {
+    }
+
+    void add(qint64 amount) {
+#if defined(Q_OS_WIN)
+        InterlockedExchangeAdd64(&value, amount);
+#else
+        __sync_fetch_and_add(&value, amount);
+#endif
+    }
+
+    qint64 load() const {
+#if defined(Q_OS_WIN)
+        return InterlockedCompareExchange64(const_cast<volatile LONGLONG*>(&value), 0, 0);
+#else
+        return __sync_fetch_and_add(const_cast<volatile qint64*>(&value), 0);
+#endif
+    }
+
+private:
+#if defined(Q_OS_WIN)
+    volatile LONGLONG value;
+#else
+    volatile qint64 value;
+#endif
+};
+
+/**
+ * The PerformanceCounters class collects performance counters and latency
+ * histograms of a single session.
+ *
+ * Each counter and histogram is updated only from the thread owning the
+ * corresponding pipeline stage (e.g. decoding from the RDP thread and painting
+ * from the GUI thread), so the atomic updates are never contended. Reading
+ * with report() is allowed from any thread.
+ */
+class PerformanceCounters {
+public:
+    enum Counter {
+        UpdatesReceived,
+        RectanglesReceived,
+        BitmapBytesReceived,
+        FramesPresented,
+        FramesSkipped,
+        InputEventsSent,
+        InputEventsCoalesced,
+        AudioUnderruns,
+        AudioOverruns,
+        AudioFramesDropped,
+        AudioFramesInserted,
+        AudioClockDrift,
+        CounterCount
+    };
+
+    enum Latency {
+        DecodeLatency,
+        BlitLatency,
+        MirrorLatency,
+        ScaleLatency,
+        LetterboxLatency,
+        PaintLatency,
+        InputLatency,
+        AudioBufferDepth,
+        AudioLatency,
+        LatencyCount
+    };
+
+    enum {
+        MaxChannelCount = 32
+    };
+
+    PerformanceCounters();
+
+    void add(Counter counter, qint64 amount = 1) {
+        counters[counter].add(amount);
+    }
+
+    /**
+     * Sets @a counter which tells a current value instead of a count.
+     */
+    void set(Counter counter, qint64 value) {
+        counters[counter].add(value - counters[counter].load());
+    }
+
+    void record(Latency latency, qint64 nsecs) {
+        histograms[latency].record(nsecs);
+    }
+
+    /**
+     * Adds @a bytes to the count of bytes received from virtual channel with
+     * MCS channel id @a channelId.
+     */
+    void addChannelBytes(int channelId, qint64 bytes);
+
+    /**
+     * Adds one to the count of complete PDUs received from virtual channel
+     * with MCS channel id @a channelId.
+     */
+    void addChannelPdu(int channelId);
+
+    /**
+     * Sets @a name and MCS channel id @a channelId of the static virtual
+     * channel at @a index of the settings' channel definition array. Data of
+     * the channel is counted only after this. Must be called from the thread
+     * which adds the channel data.
+     */
+    void setChannel(int index, int channelId, const QString &name);
+
+    PerformanceReport report() const;
+
+private:
+    int channelIndex(int channelId) const;
+
+    AtomicCounter counters[CounterCount];
+    LatencyHistogram histograms[LatencyCount];
+    AtomicCounter channelBytes[MaxChannelCount];
+    AtomicCounter channelPdus[MaxChannelCount];
+    // MCS channel ids assigned by the server, written and read in the RDP
+    // thread
+    int channelIds[MaxChannelCount];
+    QString channelNames[MaxChannelCount];
+    mutable QMutex channelNamesMutex;
+    QElapsedTimer lifetime;
+};
+
+/**
+ * The LatencyTimer class measures time from its creation to its destruction
+ * and records it to given latency histogram. Does nothing if given counters
+ * is null.
+ */
+class LatencyTimer {
+public:
+    LatencyTimer(PerformanceCounters *counters, PerformanceCounters::Latency latency)
+        : counters(counters), latency(latency) {
+        if (counters) {
+            timer.start();
+        }
+    }
+
+    ~LatencyTimer() {
+        if (counters) {
+            counters->record(latency, timer.nsecsElapsed());
+        }
+    }
+
+private:
+    PerformanceCounters *counters;
+    PerformanceCounters::Latency latency;
+    QElapsedTimer timer;
+};
+
+#endif // PERFORMANCECOUNTERS_H
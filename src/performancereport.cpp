@@ -0,0 +1,93 @@
+#include "performancereport.h"
+
+LatencyStatistics::LatencyStatistics() : totalCount(0) {
+}
+
+LatencyStatistics::LatencyStatistics(const QVector<Bucket> &buckets)
+    : bucketList(buckets), totalCount(0) {
+    foreach (auto bucket, bucketList) {
+        totalCount += bucket.second;
+    }
+}
+
+qint64 LatencyStatistics::count() const {
+    return totalCount;
+}
+
+qint64 LatencyStatistics::minimum() const {
+    return bucketList.isEmpty() ? 0 : bucketList.first().first;
+}
+
+qint64 LatencyStatistics::maximum() const {
+    return bucketList.isEmpty() ? 0 : bucketList.last().first;
+}
+
+qint64 LatencyStatistics::mean() const {
+    if (totalCount == 0) {
+        return 0;
+    }
+    qreal sum = 0;
+    foreach (auto bucket, bucketList) {
+        sum += (qreal)bucket.first * bucket.second;
+    }
+    return sum / totalCount;
+}
+
+qint64 LatencyStatistics::percentile(qreal percent) const {
+    qint64 wanted = qMax<qint64>(1, totalCount * qBound<qreal>(0, percent, 100) / 100);
+    qint64 seen = 0;
+    foreach (auto bucket, bucketList) {
+        seen += bucket.second;
+        if (seen >= wanted) {
+            return bucket.first;
+        }
+    }
+    return maximum();
+}
+
+QVector<LatencyStatistics::Bucket> LatencyStatistics::buckets() const {
+    return bucketList;
+}
+
+PerformanceReport::PerformanceReport() : time(0) {
+}
+
+qint64 PerformanceReport::timestamp() const {
+    return time;
+}
+
+void PerformanceReport::setTimestamp(qint64 msecs) {
+    time = msecs;
+}
+
+QStringList PerformanceReport::counterNames() const {
+    return counters.keys();
+}
+
+qint64 PerformanceReport::counter(const QString &name) const {
+    return counters.value(name);
+}
+
+void PerformanceReport::setCounter(const QString &name, qint64 value) {
+    counters[name] = value;
+}
+
+qreal PerformanceReport::rate(const QString &name, const PerformanceReport &previous) const {
+    qint64 msecs = time - previous.time;
+    if (msecs <= 0) {
+        return 0;
+    }
+    return (counter(name) - previous.counter(name)) * 1000.0 / msecs;
+}
+
+QStringList PerformanceReport::latencyNames() const {
+    return latencies.keys();
+}
+
+LatencyStatistics PerformanceReport::latency(const QString &name) const {
+    return latencies.value(name);
+}
+
+void PerformanceReport::setLatency(const QString &name, const LatencyStatistics &statistics) {
+    latencies[name] = statistics;
+}
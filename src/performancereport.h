@@ -0,0 +1,93 @@
+#ifndef PERFORMANCEREPORT_H
+#define PERFORMANCEREPORT_H
+
+#include <QMap>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QMetaType>
+#include "global.h"
+
+/**
+ * The LatencyStatistics class contains distribution of measured latencies.
+ *
+ * The latencies are collected into buckets whose width grows with the
+ * measured value so that each value is known with about 6% precision
+ * regardless of its magnitude. All values are in nanoseconds.
+ */
+class REMOTEDISPLAYSHARED_EXPORT LatencyStatistics {
+public:
+    typedef QPair<qint64, qint64> Bucket;
+
+    LatencyStatistics();
+    LatencyStatistics(const QVector<Bucket> &buckets);
+
+    /**
+     * Returns count of measured values.
+     */
+    qint64 count() const;
+
+    qint64 minimum() const;
+    qint64 maximum() const;
+    qint64 mean() const;
+
+    /**
+     * Returns value below which given @a percent of measured values are,
+     * e.g. percentile(99) returns the 99th percentile.
+     */
+    qint64 percentile(qreal percent) const;
+
+    /**
+     * Returns non-empty buckets in ascending order. First value of each pair
+     * is the bucket's exclusive upper bound and second is count of values in
+     * the bucket.
+     */
+    QVector<Bucket> buckets() const;
+
+private:
+    QVector<Bucket> bucketList;
+    qint64 totalCount;
+};
+
+/**
+ * The PerformanceReport class is a snapshot of performance counters and
+ * latency statistics of a remote display session.
+ *
+ * Counters are cumulative since the session was created; use rate() to get
+ * per second rates between two reports.
+ */
+class REMOTEDISPLAYSHARED_EXPORT PerformanceReport {
+public:
+    PerformanceReport();
+
+    /**
+     * Returns milliseconds since the session was created at the time the
+     * report was taken.
+     */
+    qint64 timestamp() const;
+    void setTimestamp(qint64 msecs);
+
+    QStringList counterNames() const;
+    qint64 counter(const QString &name) const;
+    void setCounter(const QString &name, qint64 value);
+
+    /**
+     * Returns per second rate of counter @a name between @a previous report
+     * and this report.
+     */
+    qreal rate(const QString &name, const PerformanceReport &previous) const;
+
+    QStringList latencyNames() const;
+    LatencyStatistics latency(const QString &name) const;
+    void setLatency(const QString &name, const LatencyStatistics &statistics);
+
+private:
+    qint64 time;
+    QMap<QString, qint64> counters;
+    QMap<QString, LatencyStatistics> latencies;
+};
+
+Q_DECLARE_METATYPE(PerformanceReport)
+
+#endif // PERFORMANCEREPORT_H
@@ -0,0 +1,20 @@
+#ifndef PLAYBACKPOSITIONSINK_H
+#define PLAYBACKPOSITIONSINK_H
+
+#include <QtGlobal>
+
+/**
+ * The PlaybackPositionSink interface provides a sink where the progress of
+ * audio playback can be fed into.
+ */
+class PlaybackPositionSink {
+public:
+    /**
+     * Tells that the audio device has played the stream up to @a position,
+     * counted in frames as AudioJitterBuffer counts them. Called from the
+     * audio thread periodically, also while the device makes no progress.
+     */
+    virtual void audioPlayed(qint64 position) = 0;
+};
+
+#endif // PLAYBACKPOSITIONSINK_H
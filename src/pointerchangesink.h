@@ -29,6 +29,21 @@ public:
      * Changes current pointer style to given pointer.
      */
     virtual void changePointer(rdpPointer* pointer) = 0;
+
+    /**
+     * Hides the pointer.
+     */
+    virtual void changeToNullPointer() = 0;
+
+    /**
+     * Changes current pointer style to the system's default pointer.
+     */
+    virtual void changeToDefaultPointer() = 0;
+
+    /**
+     * Moves the pointer to position @a x, @a y of the remote desktop.
+     */
+    virtual void movePointer(int x, int y) = 0;
 };
 
 #endif // POINTERCHANGESINK_H
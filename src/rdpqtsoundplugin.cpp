@@ -1,21 +1,48 @@
 #include "rdpqtsoundplugin.h"
 #include "config.h"
+#include "tracer.h"
 #ifdef WITH_QTSOUND
-#include <QAudioOutput>
-#include <QAudioFormat>
+#include "audioplayer.h"
+#include "performancecounters.h"
+#include <QByteArray>
 #include <QDebug>
+#include <QMetaType>
+#include <QMutexLocker>
+#include <QThread>
+#include <stdlib.h>
+#include <winpr/sysinfo.h>
 
 #define SELF(ARG) ((RdpQtSoundPlugin*)ARG)
+// waves not played by then, e.g. because the device is stuck, are confirmed
+// anyway so that the remote host keeps sending
+#define MAX_WAVE_AGE_MSEC 2000
+
+namespace {
+
+PerformanceCounters *countersFromArgs(ADDIN_ARGV *args) {
+    for (int i = 0; args && i < args->argc; i++) {
+        QByteArray arg = args->argv[i];
+        if (arg.startsWith("counters:")) {
+            return reinterpret_cast<PerformanceCounters*>(arg.mid(9).toULongLong());
+        }
+    }
+    return nullptr;
+}
+
+}
 
 int RdpQtSoundPlugin::create(PFREERDP_RDPSND_DEVICE_ENTRY_POINTS pEntryPoints) {
     auto plugin = new RdpQtSoundPlugin;
+    auto counters = countersFromArgs(pEntryPoints->args);
+    plugin->player->setPerformanceCounters(counters);
+    plugin->confirmQueue.setPerformanceCounters(counters);
 
     plugin->device.Open = open;
     plugin->device.FormatSupported = isFormatSupported;
     plugin->device.SetFormat = setFormat;
     plugin->device.GetVolume = getVolume;
     plugin->device.SetVolume = setVolume;
-    plugin->device.Play = play;
+    plugin->device.WavePlay = wavePlay;
     plugin->device.Start = start;
     plugin->device.Close = close;
     plugin->device.Free = free;
@@ -30,23 +57,20 @@ void RdpQtSoundPlugin::free(rdpsndDevicePlugin *device) {
 }
 
 void RdpQtSoundPlugin::open(rdpsndDevicePlugin *device, AUDIO_FORMAT *format, int latency) {
-    auto qFormat = SELF(device)->toQtFormat(format);
-    SELF(device)->resetAudioOut(qFormat, format->nAvgBytesPerSec);
-    SELF(device)->outDevice = SELF(device)->audioOut->start();
+    SELF(device)->startPlayer(SELF(device)->toDecoderFormat(format), latency);
 }
 
 void RdpQtSoundPlugin::close(rdpsndDevicePlugin *device) {
-    SELF(device)->audioOut->stop();
+    QMetaObject::invokeMethod(SELF(device)->player, "stop", Qt::BlockingQueuedConnection);
+    SELF(device)->confirmQueue.confirmAll();
 }
 
 BOOL RdpQtSoundPlugin::isFormatSupported(rdpsndDevicePlugin *device, AUDIO_FORMAT *format) {
-    return SELF(device)->toQtFormat(format).isValid();
+    return AudioDecoder::isSupported(SELF(device)->toDecoderFormat(format));
 }
 
 void RdpQtSoundPlugin::setFormat(rdpsndDevicePlugin *device, AUDIO_FORMAT *format, int latency) {
-    auto qFormat = SELF(device)->toQtFormat(format);
-    SELF(device)->resetAudioOut(qFormat, format->nAvgBytesPerSec);
-    // TODO: What to do with 'latency'?
+    SELF(device)->startPlayer(SELF(device)->toDecoderFormat(format), latency);
 }
 
 UINT32 RdpQtSoundPlugin::getVolume(rdpsndDevicePlugin *device) {
@@ -60,48 +84,114 @@ void RdpQtSoundPlugin::setVolume(rdpsndDevicePlugin *device, UINT32 value) {
     qDebug() << "setVolume(): Not implemented";
 }
 
-void RdpQtSoundPlugin::play(rdpsndDevicePlugin *device, BYTE *data, int size) {
-    if (SELF(device)->outDevice) {
-        auto wrote = SELF(device)->outDevice->write((char*)data, size);
-        if (wrote < size) {
-            qWarning() << "Sound buffer full. Failed to write" << (size - wrote) << "bytes.";
-        }
-    }
+void RdpQtSoundPlugin::wavePlay(rdpsndDevicePlugin *device, RDPSND_WAVE *wave) {
+    TRACE_SCOPE("audioPlay");
+    // confirmed when played
+    wave->AutoConfirm = FALSE;
+    auto position = SELF(device)->player->buffer()->push((const char*)wave->data, wave->length);
+    SELF(device)->confirmQueue.add(wave, position);
 }
 
 void RdpQtSoundPlugin::start(rdpsndDevicePlugin *device) {
-    SELF(device)->audioOut->reset();
+    SELF(device)->player->buffer()->clear();
 }
 
-QAudioFormat RdpQtSoundPlugin::toQtFormat(AUDIO_FORMAT *in) const {
+AudioDecoder::Format RdpQtSoundPlugin::toDecoderFormat(AUDIO_FORMAT *in) const {
+    AudioDecoder::Format out;
     if (in == NULL) {
-        return QAudioFormat();
+        return out;
     }
 
-    QAudioFormat out;
-    out.setCodec("audio/pcm");
-    out.setSampleRate(in->nSamplesPerSec);
-    out.setChannelCount(in->nChannels);
-    out.setSampleSize(in->wBitsPerSample);
-    // TODO: what is correct value for sample type?
-    out.setSampleType(QAudioFormat::UnSignedInt);
+    out.formatTag = in->wFormatTag;
+    out.channels = in->nChannels;
+    out.sampleRate = in->nSamplesPerSec;
+    out.bitsPerSample = in->wBitsPerSample;
+    out.blockAlign = in->nBlockAlign;
     return out;
 }
 
-void RdpQtSoundPlugin::resetAudioOut(const QAudioFormat &format, int avgBytesPerSec) {
-    delete audioOut;
-    audioOut = new QAudioOutput(format);
-    // buffer size worth of 10 seconds should be enough
-    audioOut->setBufferSize(avgBytesPerSec * 10);
+void RdpQtSoundPlugin::startPlayer(const AudioDecoder::Format &format, int latency) {
+    // positions of the new stream start from zero
+    confirmQueue.confirmAll();
+    QMetaObject::invokeMethod(player, "start", Qt::BlockingQueuedConnection,
+        Q_ARG(AudioDecoder::Format, format), Q_ARG(int, latency));
 }
 
-RdpQtSoundPlugin::RdpQtSoundPlugin() {
+RdpQtSoundPlugin::RdpQtSoundPlugin() : confirmQueue(&device) {
     memset(&device, 0, sizeof(device));
-    resetAudioOut(QAudioFormat(), 0);
+    qRegisterMetaType<AudioDecoder::Format>("AudioDecoder::Format");
+
+    audioThread = new QThread;
+    player = new AudioPlayer;
+    player->setPositionSink(&confirmQueue);
+    player->moveToThread(audioThread);
+    audioThread->start();
 }
 
 RdpQtSoundPlugin::~RdpQtSoundPlugin() {
-    delete audioOut;
+    QMetaObject::invokeMethod(player, "stop", Qt::BlockingQueuedConnection);
+    audioThread->quit();
+    audioThread->wait();
+    delete player;
+    delete audioThread;
+}
+
+WaveConfirmQueue::WaveConfirmQueue(rdpsndDevicePlugin *device)
+    : device(device), performanceCounters(nullptr) {
+}
+
+WaveConfirmQueue::~WaveConfirmQueue() {
+    // the channel is going away, nothing to confirm to
+    while (!waves.isEmpty()) {
+        ::free(waves.dequeue().first);
+    }
+}
+
+void WaveConfirmQueue::setPerformanceCounters(PerformanceCounters *counters) {
+    performanceCounters = counters;
+}
+
+void WaveConfirmQueue::add(RDPSND_WAVE *wave, qint64 position) {
+    QMutexLocker locker(&mutex);
+    waves.enqueue(qMakePair(wave, position));
+    confirmExpired();
+}
+
+void WaveConfirmQueue::confirmAll() {
+    QMutexLocker locker(&mutex);
+    while (!waves.isEmpty()) {
+        confirm(waves.dequeue().first);
+    }
+}
+
+void WaveConfirmQueue::audioPlayed(qint64 position) {
+    QMutexLocker locker(&mutex);
+    while (!waves.isEmpty() && waves.head().second <= position) {
+        confirm(waves.dequeue().first);
+    }
+    // also when no more waves arrive, e.g. at the end of a stream
+    confirmExpired();
+}
+
+void WaveConfirmQueue::confirmExpired() {
+    while (!waves.isEmpty() &&
+            UINT32(GetTickCount() - waves.head().first->wLocalTimeA) > MAX_WAVE_AGE_MSEC) {
+        confirm(waves.dequeue().first);
+    }
+}
+
+void WaveConfirmQueue::confirm(RDPSND_WAVE *wave) {
+    // tells the time the wave was heard in the remote host's clock, which
+    // was at wTimeStampA when the wave was received
+    UINT32 now = GetTickCount();
+    UINT32 latency = now - wave->wLocalTimeA;
+    wave->wLocalTimeB = now;
+    wave->wTimeStampB = wave->wTimeStampA + latency;
+    if (performanceCounters) {
+        performanceCounters->record(PerformanceCounters::AudioLatency, latency * Q_INT64_C(1000000));
+    }
+    // sent by rdpsnd's thread, which frees the wave
+    device->WaveConfirm(device, wave);
 }
 #else
 int RdpQtSoundPlugin::create(PFREERDP_RDPSND_DEVICE_ENTRY_POINTS pEntryPoints) {
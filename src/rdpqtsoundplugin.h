@@ -2,17 +2,66 @@
 #define RDPQTSOUNDPLUGIN_H
 
 #include <QPointer>
+#include <QMutex>
+#include <QQueue>
+#include <QPair>
 #include <freerdp/client/rdpsnd.h>
+#include "audiodecoder.h"
+#include "playbackpositionsink.h"
 
-class QIODevice;
-class QAudioOutput;
-class QAudioFormat;
+class QThread;
+class AudioPlayer;
+class PerformanceCounters;
+
+/**
+ * The WaveConfirmQueue class holds the waves RdpQtSoundPlugin has played
+ * until the audio device has played them, and then confirms them to the
+ * remote host with the time they were heard. The remote host paces the audio
+ * and synchronizes it with video by the confirmations.
+ */
+class WaveConfirmQueue : public PlaybackPositionSink {
+public:
+    WaveConfirmQueue(rdpsndDevicePlugin *device);
+    ~WaveConfirmQueue();
+
+    /**
+     * Sets @a counters where the latency from receiving to playing the waves
+     * is recorded.
+     */
+    void setPerformanceCounters(PerformanceCounters *counters);
+
+    /**
+     * Adds @a wave which ends at @a position of the played stream.
+     */
+    void add(RDPSND_WAVE *wave, qint64 position);
+
+    /**
+     * Confirms all waves now, e.g. when the stream ends.
+     */
+    void confirmAll();
+
+    virtual void audioPlayed(qint64 position);
+
+private:
+    void confirm(RDPSND_WAVE *wave);
+    void confirmExpired();
+
+    rdpsndDevicePlugin *device;
+    PerformanceCounters *performanceCounters;
+    QMutex mutex;
+    QQueue<QPair<RDPSND_WAVE*, qint64> > waves;
+};
 
 /**
  * The RdpQtSoundPlugin class lets FreeRDP to play audio through Qt.
  *
  * The class implements rdpsnd's plugin interface which will allow plugging it
- * into FreeRDP. This class acts as wrapper around QAudioOutput.
+ * into FreeRDP. The audio is played by AudioPlayer in a thread of its own.
+ * Besides PCM, IMA and Microsoft ADPCM are accepted, which the player decodes
+ * in its thread. Each wave is confirmed when the device has played it.
+ *
+ * Besides rdpsnd's own arguments, the plugin takes argument
+ * "counters:<address>" with address of the session's PerformanceCounters.
  */
 class RdpQtSoundPlugin {
 public:
@@ -26,19 +75,20 @@ public:
     static void setFormat(rdpsndDevicePlugin* device, AUDIO_FORMAT* format, int latency);
     static UINT32 getVolume(rdpsndDevicePlugin* device);
     static void setVolume(rdpsndDevicePlugin* device, UINT32 value);
-    static void play(rdpsndDevicePlugin* device, BYTE* data, int size);
+    static void wavePlay(rdpsndDevicePlugin* device, RDPSND_WAVE* wave);
     static void start(rdpsndDevicePlugin* device);
 
 private:
-    QAudioFormat toQtFormat(AUDIO_FORMAT* in) const;
-    void resetAudioOut(const QAudioFormat &format, int avgBytesPerSec);
+    AudioDecoder::Format toDecoderFormat(AUDIO_FORMAT* in) const;
+    void startPlayer(const AudioDecoder::Format &format, int latency);
 
     RdpQtSoundPlugin();
     ~RdpQtSoundPlugin();
 
     rdpsndDevicePlugin device;
-    QPointer<QAudioOutput> audioOut;
-    QPointer<QIODevice> outDevice;
+    WaveConfirmQueue confirmQueue;
+    QThread *audioThread;
+    AudioPlayer *player;
 };
 
 #endif // RDPQTSOUNDPLUGIN_H
@@ -0,0 +1,76 @@
+#ifndef RECORDINGFORMAT_H
+#define RECORDINGFORMAT_H
+
+#include <QtGlobal>
+
+/*
+ * Layout of session recording files written by SessionRecorder and read by
+ * SessionPlayer.
+ *
+ * The file starts with a RecordingHeader and is followed by the frames. Each
+ * frame is a RecordingFrame followed by tileCount tiles, each of which is a
+ * RecordingTile followed by the tile's pixels compressed with TileCodec and
+ * padded to 8 bytes. A tile's pixels are rows of the tile in the frame's
+ * QImage::Format without padding. Keyframes contain all tiles of the frame,
+ * other frames only the tiles changed since the previous frame.
+ *
+ * When the recording is finished, an index of the frames is written after
+ * them, followed by a RecordingTrailer. A file without the trailer, e.g. of
+ * a crashed recording, can be read by scanning the frames.
+ *
+ * All structures are naturally aligned and in the byte order of the host,
+ * so the file can be read by mapping it to memory.
+ */
+
+struct RecordingHeader {
+    enum {
+        Magic = 0x43455244, // "DREC"
+        Version = 1
+    };
+
+    quint32 magic;
+    quint32 version;
+    quint32 tileSize;
+    quint32 reserved;
+    // TileCodec::algorithm() of the recorder
+    char codec[16];
+};
+
+struct RecordingFrame {
+    enum {
+        Magic = 0x4d415246, // "FRAM"
+        Keyframe = 0x1
+    };
+
+    quint32 magic;
+    quint32 flags;
+    // milliseconds since the start of the recording
+    qint64 timestamp;
+    quint32 width;
+    quint32 height;
+    quint32 format;
+    quint32 tileCount;
+};
+
+struct RecordingTile {
+    quint16 column;
+    quint16 row;
+    quint32 size;
+};
+
+struct RecordingIndexEntry {
+    qint64 timestamp;
+    quint64 offset;
+};
+
+struct RecordingTrailer {
+    enum {
+        Magic = 0x58444e49 // "INDX"
+    };
+
+    quint64 indexOffset;
+    quint32 frameCount;
+    quint32 magic;
+};
+
+#endif // RECORDINGFORMAT_H
@@ -3,33 +3,115 @@
 #include "freerdpclient.h"
 #include "cursorchangenotifier.h"
 #include "remotescreenbuffer.h"
+#include "displaymirror.h"
 #include "scaledscreenbuffer.h"
 #include "letterboxedscreenbuffer.h"
+#include "viewportscreenbuffer.h"
+#include "thumbnailscreenbuffer.h"
+#include "performancecounters.h"
+#include "inputlatencytracker.h"
+#include "framebuffermemory.h"
+#include "frameexporter.h"
+#include "sessionrecorder.h"
+#include "clipboardredirector.h"
+#include "tracer.h"
 
 #include <QDebug>
 #include <QThread>
 #include <QPointer>
 #include <QPaintEvent>
+#include <QWheelEvent>
 #include <QPainter>
+#include <QCursor>
 #include <QTimer>
+#include <QCoreApplication>
+#include <QBuffer>
+#include <QtConcurrentRun>
 
 #define FRAMERATE_LIMIT 40
+// delay after the last resize event before requesting new desktop size
+#define RESIZE_DEBOUNCE_MSEC 300
+// interval of processing updates of hidden sessions in reduced-rate mode
+#define HIDDEN_UPDATE_INTERVAL_MSEC 500
+// delays before the framebuffer of a hidden or an idle session is compressed
+// in memory saving mode
+#define HIDDEN_COMPRESS_DELAY_MSEC 2000
+#define IDLE_COMPRESS_DELAY_MSEC 60000
+
+namespace {
+
+QByteArray encodeSnapshot(QSharedPointer<FramebufferSnapshot> snapshot,
+        RemoteDisplayWidget::SnapshotFormat format) {
+    TRACE_SCOPE("encodeSnapshot");
+    auto image = snapshot->image();
+    if (format == RemoteDisplayWidget::PngSnapshot) {
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "PNG");
+        return data;
+    }
+    // rows of RGB32 images are never padded
+    image = image.convertToFormat(QImage::Format_RGB32);
+    return QByteArray((const char*)image.constBits(), image.byteCount());
+}
+
+}
 
 RemoteDisplayWidgetPrivate::RemoteDisplayWidgetPrivate(RemoteDisplayWidget *q)
-    : q_ptr(q), repaintNeeded(false) {
+    : q_ptr(q), repaintNeeded(false), dynamicResolution(false),
+      displayMirrorEnabled(true), displayMode(RemoteDisplayWidget::ScaleToFitMode),
+      hiddenSessionPolicy(RemoteDisplayWidget::SuppressOutputWhenHidden),
+      sessionVisible(false), appliedPolicy(RemoteDisplayWidget::SuppressOutputWhenHidden),
+      memorySaving(false), frameStreaming(false), streamingConsumer(0), frameSequence(0),
+      nextSnapshotId(0),
+      performanceCounters(new PerformanceCounters),
+      inputLatencyTracker(new InputLatencyTracker(performanceCounters)) {
     processorThread = new QThread(q);
     processorThread->start();
 }
 
+RemoteDisplayWidgetPrivate::~RemoteDisplayWidgetPrivate() {
+    delete inputLatencyTracker;
+    delete performanceCounters;
+}
+
 QPoint RemoteDisplayWidgetPrivate::mapToRemoteDesktop(const QPoint &local) const {
     QPoint remote;
-    if (scaledScreenBuffer && letterboxedScreenBuffer) {
+    if (displayMode == RemoteDisplayWidget::ViewportMode) {
+        if (viewportScreenBuffer) {
+            remote = viewportScreenBuffer->mapToSource(local);
+        }
+    } else if (displayMode == RemoteDisplayWidget::ThumbnailMode) {
+        if (thumbnailScreenBuffer && letterboxedThumbnailBuffer) {
+            remote = thumbnailScreenBuffer->mapToSource(
+                        letterboxedThumbnailBuffer->mapToSource(local));
+        }
+    } else if (scaledScreenBuffer && letterboxedScreenBuffer) {
         remote = scaledScreenBuffer->mapToSource(
                     letterboxedScreenBuffer->mapToSource(local));
     }
     return remote;
 }
 
+QPoint RemoteDisplayWidgetPrivate::mapFromRemoteDesktop(const QPoint &remote) const {
+    QPoint local;
+    if (displayMode == RemoteDisplayWidget::ViewportMode) {
+        if (viewportScreenBuffer) {
+            local = viewportScreenBuffer->mapFromSource(remote);
+        }
+    } else if (displayMode == RemoteDisplayWidget::ThumbnailMode) {
+        if (thumbnailScreenBuffer && letterboxedThumbnailBuffer) {
+            local = letterboxedThumbnailBuffer->mapFromSource(
+                        thumbnailScreenBuffer->mapFromSource(remote));
+        }
+    } else if (scaledScreenBuffer && letterboxedScreenBuffer) {
+        local = letterboxedScreenBuffer->mapFromSource(
+                    scaledScreenBuffer->mapFromSource(remote));
+    }
+    return local;
+}
+
 void RemoteDisplayWidgetPrivate::resizeScreenBuffers() {
     Q_Q(RemoteDisplayWidget);
     if (scaledScreenBuffer) {
@@ -38,6 +120,107 @@ void RemoteDisplayWidgetPrivate::resizeScreenBuffers() {
     if (letterboxedScreenBuffer) {
         letterboxedScreenBuffer->resize(q->size());
     }
+    if (viewportScreenBuffer) {
+        viewportScreenBuffer->resize(q->size());
+    }
+    if (thumbnailScreenBuffer) {
+        thumbnailScreenBuffer->scaleToFit(q->size());
+    }
+    if (letterboxedThumbnailBuffer) {
+        letterboxedThumbnailBuffer->resize(q->size());
+    }
+    refreshStaleArea();
+}
+
+void RemoteDisplayWidgetPrivate::refreshStaleArea() {
+    if (staleArea.isEmpty() || !sessionVisible) {
+        return;
+    }
+    auto area = staleArea & visibleDesktopArea();
+    if (!area.isEmpty()) {
+        staleArea -= area;
+        QMetaObject::invokeMethod(eventProcessor, "refreshArea",
+            Q_ARG(QRect, area.boundingRect()));
+    }
+}
+
+ScreenBuffer *RemoteDisplayWidgetPrivate::displayedBuffer() const {
+    if (displayMode == RemoteDisplayWidget::ViewportMode) {
+        return viewportScreenBuffer;
+    } else if (displayMode == RemoteDisplayWidget::ThumbnailMode) {
+        return letterboxedThumbnailBuffer;
+    }
+    return letterboxedScreenBuffer;
+}
+
+QRect RemoteDisplayWidgetPrivate::visibleDesktopArea() const {
+    Q_Q(const RemoteDisplayWidget);
+    QRect desktop(QPoint(0, 0), desktopSize);
+    if (displayMode == RemoteDisplayWidget::ViewportMode && viewportScreenBuffer) {
+        return QRect(viewportScreenBuffer->offset(), q->size()) & desktop;
+    }
+    return desktop;
+}
+
+void RemoteDisplayWidgetPrivate::setSessionVisible(bool visible) {
+    if (visible == sessionVisible) {
+        return;
+    }
+    sessionVisible = visible;
+
+    if (memorySaving) {
+        memorySavingTimer->start(visible ? IDLE_COMPRESS_DELAY_MSEC : HIDDEN_COMPRESS_DELAY_MSEC);
+    }
+
+    if (!visible) {
+        repaintTimer->stop();
+        appliedPolicy = hiddenSessionPolicy;
+        if (!remoteScreenBuffer) {
+            // not connected yet, applied in onConnected()
+            return;
+        }
+        if (appliedPolicy == RemoteDisplayWidget::SuppressOutputWhenHidden) {
+            QMetaObject::invokeMethod(eventProcessor, "suppressOutput");
+        } else {
+            QMetaObject::invokeMethod(eventProcessor, "setUpdateInterval",
+                Q_ARG(int, HIDDEN_UPDATE_INTERVAL_MSEC));
+        }
+    } else {
+        repaintTimer->start();
+        repaintNeeded = true;
+        if (!remoteScreenBuffer) {
+            return;
+        }
+        if (appliedPolicy == RemoteDisplayWidget::SuppressOutputWhenHidden) {
+            // only the visible area is sent now, the rest when it is panned
+            // into view
+            auto visibleArea = visibleDesktopArea();
+            staleArea = QRegion(QRect(QPoint(0, 0), desktopSize)) - visibleArea;
+            QMetaObject::invokeMethod(eventProcessor, "resumeOutput",
+                Q_ARG(QRect, visibleArea));
+        } else {
+            QMetaObject::invokeMethod(eventProcessor, "setUpdateInterval", Q_ARG(int, 0));
+        }
+    }
+}
+
+PerformanceReport RemoteDisplayWidgetPrivate::createReport() const {
+    auto report = performanceCounters->report();
+    if (remoteScreenBuffer) {
+        report.setCounter("memoryBytes.framebuffer", remoteScreenBuffer->residentMemory());
+        report.setCounter("memoryBytes.framebufferCompressed", remoteScreenBuffer->compressedMemory());
+    }
+    report.setCounter("memoryBytes.allFramebuffers", FramebufferMemory::totalAllocated());
+    if (displayMirror) {
+        report.setCounter("memoryBytes.mirror", displayMirror->memoryUsage());
+    }
+    if (scaledScreenBuffer) {
+        report.setCounter("memoryBytes.scaled", scaledScreenBuffer->memoryUsage());
+    }
+    if (thumbnailScreenBuffer) {
+        report.setCounter("memoryBytes.thumbnail", thumbnailScreenBuffer->memoryUsage());
+    }
+    return report;
 }
 
 void RemoteDisplayWidgetPrivate::onAboutToConnect() {
@@ -47,16 +230,53 @@ void RemoteDisplayWidgetPrivate::onAboutToConnect() {
 void RemoteDisplayWidgetPrivate::onConnected() {
     qDebug() << "ON CONNECTED";
     auto bpp = eventProcessor->getDesktopBpp();
+    // the host may not have accepted the requested size
+    desktopSize = eventProcessor->getDesktopSize();
     auto width = desktopSize.width();
     auto height = desktopSize.height();
 
-    remoteScreenBuffer = new RemoteScreenBuffer(width, height, bpp, this);
-    scaledScreenBuffer = new ScaledScreenBuffer(remoteScreenBuffer, this);
-    letterboxedScreenBuffer = new LetterboxedScreenBuffer(scaledScreenBuffer, this);
+    if (remoteScreenBuffer) {
+        remoteScreenBuffer->resize(width, height, bpp);
+    } else {
+        remoteScreenBuffer = new RemoteScreenBuffer(width, height, bpp, this);
+        ScreenBuffer *desktopSource = remoteScreenBuffer;
+        if (displayMirrorEnabled) {
+            displayMirror = new DisplayMirror(remoteScreenBuffer, this);
+            displayMirror->setPerformanceCounters(performanceCounters);
+            desktopSource = displayMirror;
+        }
+        scaledScreenBuffer = new ScaledScreenBuffer(desktopSource, this);
+        viewportScreenBuffer = new ViewportScreenBuffer(desktopSource, this);
+        thumbnailScreenBuffer = new ThumbnailScreenBuffer(desktopSource, this);
+        letterboxedThumbnailBuffer = new LetterboxedScreenBuffer(thumbnailScreenBuffer, this);
+        thumbnailScreenBuffer->setPerformanceCounters(performanceCounters);
+        letterboxedScreenBuffer = new LetterboxedScreenBuffer(scaledScreenBuffer, this);
+        scaledScreenBuffer->setPerformanceCounters(performanceCounters);
+        letterboxedScreenBuffer->setPerformanceCounters(performanceCounters);
+    }
 
     eventProcessor->setBitmapRectangleSink(remoteScreenBuffer);
+    if (frameExporter) {
+        frameExporter->setSource(remoteScreenBuffer);
+    }
+    if (recorder) {
+        recorder->setSource(remoteScreenBuffer);
+    }
+    if (frameStreaming && !streamingConsumer) {
+        streamingConsumer = remoteScreenBuffer->addDamageConsumer();
+    }
 
     resizeScreenBuffers();
+
+    if (!sessionVisible) {
+        // apply the hidden session policy now that there is a connection
+        sessionVisible = true;
+        setSessionVisible(false);
+    }
+
+    if (dynamicResolution) {
+        resizeTimer->start();
+    }
 }
 
 void RemoteDisplayWidgetPrivate::onDisconnected() {
@@ -70,16 +290,119 @@ void RemoteDisplayWidgetPrivate::onCursorChanged(const QCursor &cursor) {
     q->setCursor(cursor);
 }
 
+void RemoteDisplayWidgetPrivate::onCursorMoved(const QPoint &pos) {
+    Q_Q(RemoteDisplayWidget);
+    // the host moves the cursor e.g. when an application warps it, which is
+    // followed only while the user is working in the widget
+    if (!q->isActiveWindow() || !q->underMouse()) {
+        return;
+    }
+    auto local = q->mapFromGlobal(QCursor::pos());
+    // servers may also echo the position of our own mouse moves
+    if (mapToRemoteDesktop(local) != pos) {
+        QCursor::setPos(q->mapToGlobal(mapFromRemoteDesktop(pos)));
+    }
+}
+
 void RemoteDisplayWidgetPrivate::onDesktopUpdated() {
+    Q_Q(RemoteDisplayWidget);
+    if (repaintNeeded) {
+        // previous update was not yet presented and is merged with this one
+        performanceCounters->add(PerformanceCounters::FramesSkipped);
+    }
     repaintNeeded = true;
+
+    if (streamingConsumer) {
+        auto damage = remoteScreenBuffer->takeDamage(streamingConsumer);
+        // the damage of queued updates may have been taken already
+        if (!damage.isEmpty()) {
+            emit q->frameUpdated(++frameSequence, damage);
+        }
+    }
+
+    if (memorySaving && sessionVisible) {
+        memorySavingTimer->start(IDLE_COMPRESS_DELAY_MSEC);
+    }
+}
+
+void RemoteDisplayWidgetPrivate::onDesktopResized(quint16 width, quint16 height) {
+    // called on DesktopResize and on reactivation with a new size while the
+    // RDP thread waits, so no updates are added to the screen buffer during
+    // resizing. The buffers are resized in place and the old contents are
+    // shown until the host has sent the new ones.
+    desktopSize = QSize(width, height);
+    // the host sends the whole resized desktop
+    staleArea = QRegion();
+    if (remoteScreenBuffer) {
+        remoteScreenBuffer->resize(width, height, eventProcessor->getDesktopBpp());
+        resizeScreenBuffers();
+    }
+}
+
+void RemoteDisplayWidgetPrivate::onResizeTimeout() {
+    Q_Q(RemoteDisplayWidget);
+    QMetaObject::invokeMethod(eventProcessor, "requestDesktopSize",
+        Q_ARG(quint16, q->width()), Q_ARG(quint16, q->height()));
 }
 
 void RemoteDisplayWidgetPrivate::onRepaintTimeout() {
     Q_Q(RemoteDisplayWidget);
-    if (repaintNeeded) {
+    TRACE_SCOPE("onRepaintTimeout");
+    if (remoteScreenBuffer && remoteScreenBuffer->isOutOfMemory()) {
+        // nothing to pull from the buffers, painted black as a whole
+        if (repaintNeeded) {
+            repaintNeeded = false;
+            q->update();
+        }
+        return;
+    }
+
+    auto buffer = displayedBuffer();
+    if (repaintNeeded && buffer) {
         repaintNeeded = false;
-        q->repaint();
+        // answers received from now on may miss this frame
+        inputLatencyTracker->damageTaken();
+        auto damage = buffer->takeDamage();
+        if (!damage.isEmpty()) {
+            // painted synchronously, so the frame is on screen after this
+            q->repaint(damage);
+            inputLatencyTracker->framePresented();
+        }
+    }
+}
+
+void RemoteDisplayWidgetPrivate::onPerformanceReportTimeout() {
+    Q_Q(RemoteDisplayWidget);
+    emit q->performanceReported(createReport());
+}
+
+void RemoteDisplayWidgetPrivate::onSnapshotEncoded() {
+    Q_Q(RemoteDisplayWidget);
+    auto watcher = static_cast<QFutureWatcher<QByteArray>*>(sender());
+    auto snapshot = pendingSnapshots.take(watcher);
+    emit q->snapshotTaken(snapshot.first, snapshot.second, watcher->result());
+    watcher->deleteLater();
+}
+
+void RemoteDisplayWidgetPrivate::onMemorySavingTimeout() {
+    if (!remoteScreenBuffer) {
+        return;
+    }
+
+    if (!sessionVisible) {
+        // built again from the framebuffer when shown
+        if (displayMirror) {
+            displayMirror->releaseMemory();
+        }
+        scaledScreenBuffer->releaseMemory();
+        thumbnailScreenBuffer->releaseMemory();
+        if (appliedPolicy == RemoteDisplayWidget::ReducedRateWhenHidden) {
+            // the updates received while hidden decompress the tiles they
+            // touch, so those are compressed again periodically
+            memorySavingTimer->start(HIDDEN_COMPRESS_DELAY_MSEC);
+        }
     }
+    remoteScreenBuffer->compress();
 }
 
 typedef RemoteDisplayWidgetPrivate Pimpl;
@@ -88,6 +411,7 @@ RemoteDisplayWidget::RemoteDisplayWidget(QWidget *parent)
     : QWidget(parent), d_ptr(new RemoteDisplayWidgetPrivate(this)) {
     Q_D(RemoteDisplayWidget);
     qRegisterMetaType<Qt::MouseButton>("Qt::MouseButton");
+    qRegisterMetaType<PerformanceReport>();
 
     setAttribute(Qt::WA_OpaquePaintEvent);
     setAttribute(Qt::WA_NoSystemBackground);
@@ -95,20 +419,37 @@ RemoteDisplayWidget::RemoteDisplayWidget(QWidget *parent)
 
     auto cursorNotifier = new CursorChangeNotifier(this);
     connect(cursorNotifier, SIGNAL(cursorChanged(QCursor)), d, SLOT(onCursorChanged(QCursor)));
+    connect(cursorNotifier, SIGNAL(cursorMoved(QPoint)), d, SLOT(onCursorMoved(QPoint)));
 
     d->eventProcessor = new FreeRdpClient(cursorNotifier);
+    d->eventProcessor->setPerformanceCounters(d->performanceCounters);
+    d->eventProcessor->setInputLatencyTracker(d->inputLatencyTracker);
     d->eventProcessor->moveToThread(d->processorThread);
 
     connect(d->eventProcessor, SIGNAL(aboutToConnect()), d, SLOT(onAboutToConnect()));
     connect(d->eventProcessor, SIGNAL(connected()), d, SLOT(onConnected()));
     connect(d->eventProcessor, SIGNAL(disconnected()), d, SLOT(onDisconnected()));
     connect(d->eventProcessor, SIGNAL(desktopUpdated()), d, SLOT(onDesktopUpdated()));
-
-    auto timer = new QTimer(this);
-    timer->setSingleShot(false);
-    timer->setInterval(1000 / FRAMERATE_LIMIT);
-    connect(timer, SIGNAL(timeout()), d, SLOT(onRepaintTimeout()));
-    timer->start();
+    connect(d->eventProcessor, SIGNAL(desktopResized(quint16,quint16)),
+        d, SLOT(onDesktopResized(quint16,quint16)), Qt::BlockingQueuedConnection);
+
+    d->repaintTimer = new QTimer(this);
+    d->repaintTimer->setSingleShot(false);
+    d->repaintTimer->setInterval(1000 / FRAMERATE_LIMIT);
+    connect(d->repaintTimer, SIGNAL(timeout()), d, SLOT(onRepaintTimeout()));
+    // the timer is started when the widget is shown
+
+    d->resizeTimer = new QTimer(this);
+    d->resizeTimer->setSingleShot(true);
+    d->resizeTimer->setInterval(RESIZE_DEBOUNCE_MSEC);
+    connect(d->resizeTimer, SIGNAL(timeout()), d, SLOT(onResizeTimeout()));
+
+    d->memorySavingTimer = new QTimer(this);
+    d->memorySavingTimer->setSingleShot(true);
+    connect(d->memorySavingTimer, SIGNAL(timeout()), d, SLOT(onMemorySavingTimeout()));
+
+    d->performanceReportTimer = new QTimer(this);
+    connect(d->performanceReportTimer, SIGNAL(timeout()), d, SLOT(onPerformanceReportTimeout()));
 }
 
 RemoteDisplayWidget::~RemoteDisplayWidget() {
@@ -117,7 +458,21 @@ RemoteDisplayWidget::~RemoteDisplayWidget() {
         QMetaObject::invokeMethod(d->eventProcessor, "requestStop");
     }
     d->processorThread->quit();
-    d->processorThread->wait();
+    // the RDP thread may be blocked on desktopResized() signal, so keep
+    // delivering it until the thread has finished
+    while (!d->processorThread->wait(10)) {
+        QCoreApplication::sendPostedEvents(d, QEvent::MetaCall);
+    }
+
+    // the background work reads the screen buffer, which is destroyed with
+    // the private object
+    delete d->frameExporter;
+    delete d->recorder;
+    delete d->clipboardRedirector;
+    auto watchers = d->pendingSnapshots.keys();
+    for (int i = 0; i < watchers.size(); i++) {
+        watchers[i]->waitForFinished();
+    }
 
     delete d_ptr;
 }
@@ -129,6 +484,112 @@ void RemoteDisplayWidget::setDesktopSize(quint16 width, quint16 height) {
         Q_ARG(quint16, width), Q_ARG(quint16, height));
 }
 
+void RemoteDisplayWidget::setDynamicResolutionEnabled(bool enabled) {
+    Q_D(RemoteDisplayWidget);
+    d->dynamicResolution = enabled;
+    QMetaObject::invokeMethod(d->eventProcessor, "setSettingDynamicResolution",
+        Q_ARG(bool, enabled));
+}
+
+void RemoteDisplayWidget::setAudioLatency(int msecs) {
+    Q_D(RemoteDisplayWidget);
+    QMetaObject::invokeMethod(d->eventProcessor, "setSettingAudioLatency",
+        Q_ARG(int, msecs));
+}
+
+void RemoteDisplayWidget::setClipboardRedirectionEnabled(bool enabled) {
+    Q_D(RemoteDisplayWidget);
+    if (enabled && !d->clipboardRedirector) {
+        d->clipboardRedirector = new ClipboardRedirector(d->eventProcessor, d);
+        d->eventProcessor->setClipboardSink(d->clipboardRedirector);
+    } else if (!enabled && d->clipboardRedirector) {
+        // detached first, so that the RDP thread is no longer calling it
+        d->eventProcessor->setClipboardSink(nullptr);
+        delete d->clipboardRedirector;
+    }
+}
+
+void RemoteDisplayWidget::addVirtualChannel(const QString &name, ChannelPduSink *sink) {
+    Q_D(RemoteDisplayWidget);
+    d->eventProcessor->addChannelPduSink(name, sink);
+}
+
+void RemoteDisplayWidget::setDisplayMirrorEnabled(bool enabled) {
+    Q_D(RemoteDisplayWidget);
+    d->displayMirrorEnabled = enabled;
+}
+
+void RemoteDisplayWidget::setDisplayMode(DisplayMode mode) {
+    Q_D(RemoteDisplayWidget);
+    if (mode != d->displayMode) {
+        d->displayMode = mode;
+        // the buffer becoming visible has not followed the changes while
+        // hidden, so it is refreshed as a whole
+        d->resizeScreenBuffers();
+        update();
+    }
+}
+
+RemoteDisplayWidget::DisplayMode RemoteDisplayWidget::displayMode() const {
+    Q_D(const RemoteDisplayWidget);
+    return d->displayMode;
+}
+
+void RemoteDisplayWidget::setViewportOffset(const QPoint &offset) {
+    Q_D(RemoteDisplayWidget);
+    if (!d->viewportScreenBuffer) {
+        return;
+    }
+    auto oldOffset = d->viewportScreenBuffer->offset();
+    d->viewportScreenBuffer->setOffset(offset);
+    auto newOffset = d->viewportScreenBuffer->offset();
+    if (newOffset != oldOffset) {
+        if (d->displayMode == ViewportMode) {
+            update();
+        }
+        d->refreshStaleArea();
+        emit viewportOffsetChanged(newOffset);
+    }
+}
+
+QPoint RemoteDisplayWidget::viewportOffset() const {
+    Q_D(const RemoteDisplayWidget);
+    if (d->viewportScreenBuffer) {
+        return d->viewportScreenBuffer->offset();
+    }
+    return QPoint();
+}
+
+void RemoteDisplayWidget::setHiddenSessionPolicy(HiddenSessionPolicy policy) {
+    Q_D(RemoteDisplayWidget);
+    d->hiddenSessionPolicy = policy;
+}
+
+void RemoteDisplayWidget::setMemorySavingEnabled(bool enabled) {
+    Q_D(RemoteDisplayWidget);
+    d->memorySaving = enabled;
+    if (enabled) {
+        d->memorySavingTimer->start(d->sessionVisible ? IDLE_COMPRESS_DELAY_MSEC : HIDDEN_COMPRESS_DELAY_MSEC);
+    } else {
+        d->memorySavingTimer->stop();
+    }
+}
+
+void RemoteDisplayWidget::setFrameStreamingEnabled(bool enabled) {
+    Q_D(RemoteDisplayWidget);
+    d->frameStreaming = enabled;
+    if (!d->remoteScreenBuffer) {
+        // the consumer is added when connected
+        return;
+    }
+    if (enabled && !d->streamingConsumer) {
+        d->streamingConsumer = d->remoteScreenBuffer->addDamageConsumer();
+    } else if (!enabled && d->streamingConsumer) {
+        d->remoteScreenBuffer->removeDamageConsumer(d->streamingConsumer);
+        d->streamingConsumer = 0;
+    }
+}
+
 void RemoteDisplayWidget::connectToHost(const QString &host, quint16 port) {
     Q_D(RemoteDisplayWidget);
 
@@ -149,14 +610,102 @@ QSize RemoteDisplayWidget::sizeHint() const {
     return QWidget::sizeHint();
 }
 
+PerformanceReport RemoteDisplayWidget::performanceReport() const {
+    Q_D(const RemoteDisplayWidget);
+    return d->createReport();
+}
+
+void RemoteDisplayWidget::setPerformanceReportInterval(int msecs) {
+    Q_D(RemoteDisplayWidget);
+    if (msecs > 0) {
+        d->performanceReportTimer->start(msecs);
+    } else {
+        d->performanceReportTimer->stop();
+    }
+}
+
+void RemoteDisplayWidget::setFramebufferMemoryBudget(qint64 bytes) {
+    FramebufferMemory::setBudget(bytes);
+}
+
+qint64 RemoteDisplayWidget::framebufferMemoryBudget() {
+    return FramebufferMemory::budget();
+}
+
+int RemoteDisplayWidget::takeSnapshot(SnapshotFormat format) {
+    Q_D(RemoteDisplayWidget);
+    if (!d->remoteScreenBuffer) {
+        return -1;
+    }
+
+    int id = d->nextSnapshotId++;
+    auto watcher = new QFutureWatcher<QByteArray>(d);
+    connect(watcher, SIGNAL(finished()), d, SLOT(onSnapshotEncoded()));
+    d->pendingSnapshots[watcher] = qMakePair(id, d->remoteScreenBuffer->size());
+    watcher->setFuture(QtConcurrent::run(encodeSnapshot, d->remoteScreenBuffer->takeSnapshot(), format));
+    return id;
+}
+
+int RemoteDisplayWidget::startFrameExport(int slotCount) {
+    Q_D(RemoteDisplayWidget);
+    if (!d->frameExporter) {
+        d->frameExporter = new FrameExporter(d);
+        d->frameExporter->setSource(d->remoteScreenBuffer);
+    }
+    int fd = d->frameExporter->start(slotCount);
+    if (fd < 0) {
+        delete d->frameExporter;
+    }
+    return fd;
+}
+
+void RemoteDisplayWidget::stopFrameExport() {
+    Q_D(RemoteDisplayWidget);
+    delete d->frameExporter;
+}
+
+bool RemoteDisplayWidget::startRecording(const QString &fileName) {
+    Q_D(RemoteDisplayWidget);
+    if (!d->recorder) {
+        d->recorder = new SessionRecorder(d);
+        d->recorder->setSource(d->remoteScreenBuffer);
+    }
+    if (!d->recorder->start(fileName)) {
+        delete d->recorder;
+        return false;
+    }
+    return true;
+}
+
+void RemoteDisplayWidget::stopRecording() {
+    Q_D(RemoteDisplayWidget);
+    delete d->recorder;
+}
+
+bool RemoteDisplayWidget::startTracing(const QString &fileName) {
+    return Tracer::start(fileName);
+}
+
+void RemoteDisplayWidget::stopTracing() {
+    Tracer::stop();
+}
+
 void RemoteDisplayWidget::paintEvent(QPaintEvent *event) {
     Q_D(RemoteDisplayWidget);
-    if (d->letterboxedScreenBuffer) {
-        auto image = d->letterboxedScreenBuffer->createImage();
-        if (!image.isNull()) {
-            QPainter painter(this);
-            painter.drawImage(rect(), image);
-        }
+    TRACE_SCOPE("paintEvent");
+    if (d->remoteScreenBuffer && d->remoteScreenBuffer->isOutOfMemory()) {
+        QPainter painter(this);
+        painter.fillRect(event->rect(), Qt::black);
+        return;
+    }
+
+    auto buffer = d->displayedBuffer();
+    if (buffer && !buffer->size().isEmpty()) {
+        LatencyTimer timer(d->performanceCounters, PerformanceCounters::PaintLatency);
+        // only the damaged area is drawn, straight from the buffers
+        QPainter painter(this);
+        buffer->render(&painter, event->rect());
+        d->performanceCounters->add(PerformanceCounters::FramesPresented);
     }
 }
 
@@ -189,8 +738,40 @@ void RemoteDisplayWidget::keyReleaseEvent(QKeyEvent *event) {
     event->accept();
 }
 
+void RemoteDisplayWidget::showEvent(QShowEvent *event) {
+    Q_D(RemoteDisplayWidget);
+    d->setSessionVisible(true);
+    QWidget::showEvent(event);
+}
+
+void RemoteDisplayWidget::hideEvent(QHideEvent *event) {
+    Q_D(RemoteDisplayWidget);
+    d->setSessionVisible(false);
+    QWidget::hideEvent(event);
+}
+
+void RemoteDisplayWidget::wheelEvent(QWheelEvent *event) {
+    Q_D(RemoteDisplayWidget);
+    if (d->displayMode != ViewportMode) {
+        QWidget::wheelEvent(event);
+        return;
+    }
+
+    auto offset = viewportOffset();
+    if (event->orientation() == Qt::Horizontal) {
+        offset.rx() -= event->delta();
+    } else {
+        offset.ry() -= event->delta();
+    }
+    setViewportOffset(offset);
+    event->accept();
+}
+
 void RemoteDisplayWidget::resizeEvent(QResizeEvent *event) {
     Q_D(RemoteDisplayWidget);
     d->resizeScreenBuffers();
+    if (d->dynamicResolution && d->remoteScreenBuffer) {
+        d->resizeTimer->start();
+    }
     QWidget::resizeEvent(event);
 }
@@ -3,20 +3,253 @@
 
 #include <QWidget>
 #include "global.h"
+#include "performancereport.h"
 
 class RemoteDisplayWidgetPrivate;
+class FrameReadGuard;
+class ChannelPduSink;
 
 class REMOTEDISPLAYSHARED_EXPORT RemoteDisplayWidget : public QWidget {
     Q_OBJECT
 public:
+    enum DisplayMode {
+        /**
+         * The remote desktop is scaled to fit the widget, keeping its aspect
+         * ratio.
+         */
+        ScaleToFitMode,
+        /**
+         * The widget shows a part of the remote desktop in 1:1 scale. The
+         * shown part can be panned with setViewportOffset() or with the
+         * mouse wheel.
+         */
+        ViewportMode,
+        /**
+         * The remote desktop is scaled to fit the widget like in
+         * ScaleToFitMode, but through a mipmap pyramid which is updated only
+         * where the desktop changes. Suited for small widgets, e.g. live
+         * thumbnails of many sessions.
+         */
+        ThumbnailMode
+    };
+
+    enum HiddenSessionPolicy {
+        /**
+         * The remote host is asked to stop sending graphics updates while
+         * the widget is hidden or minimized. When shown again, the visible
+         * part of the desktop is requested again.
+         */
+        SuppressOutputWhenHidden,
+        /**
+         * Graphics updates are still received and decoded while the widget
+         * is hidden, but only a couple of times per second. For sessions
+         * whose desktop must stay up to date, e.g. to be recorded.
+         */
+        ReducedRateWhenHidden
+    };
+
+    enum SnapshotFormat {
+        /**
+         * Rows of 32-bit pixels in format 0xffRRGGBB without padding.
+         */
+        RawSnapshot,
+        PngSnapshot
+    };
+
     RemoteDisplayWidget(QWidget *parent = 0);
     ~RemoteDisplayWidget();
 
     void setDesktopSize(quint16 width, quint16 height);
+
+    /**
+     * Enables or disables dynamic resolution. When enabled, the remote
+     * desktop is resized to match the widget's size whenever the widget is
+     * resized, instead of scaling the desktop to fit the widget. Requires
+     * that the remote host supports the Display Control channel, otherwise
+     * the desktop is scaled as usual.
+     *
+     * Must be called before connectToHost().
+     */
+    void setDynamicResolutionEnabled(bool enabled);
+
+    /**
+     * Sets latency in milliseconds which audio playback aims for. The audio
+     * is buffered only as much as the variation in its arrival times
+     * requires, starting from this latency. The default is 50 ms.
+     *
+     * Must be called before connectToHost().
+     */
+    void setAudioLatency(int msecs);
+
+    /**
+     * Enables or disables sharing the clipboard with the remote host. Either
+     * clipboard's data is transferred only when it is pasted on the other
+     * side, and the session keeps painting while a large paste is
+     * transferred. Disabled by default.
+     *
+     * Must be called before connectToHost().
+     */
+    void setClipboardRedirectionEnabled(bool enabled);
+
+    /**
+     * Joins static virtual channel @a name of the remote host, e.g. one of
+     * a server-side component of the embedding application, and feeds its
+     * complete PDUs into @a sink in the RDP thread. The chunks of each PDU
+     * are reassembled into pooled buffers, which the sink reads without
+     * further copies. Channels which FreeRDP handles itself, such as rdpsnd
+     * and cliprdr, cannot be joined.
+     *
+     * Must be called before connectToHost().
+     */
+    void addVirtualChannel(const QString &name, ChannelPduSink *sink);
+
+    /**
+     * Enables or disables the display mirror. The mirror is a copy of the
+     * remote desktop in the screen's native 32-bit format, updated only where
+     * the desktop changes, so that painting does not need to convert the
+     * whole desktop from the session's format on every frame. Costs 4 bytes
+     * of memory per desktop pixel. Enabled by default.
+     *
+     * Must be called before connectToHost().
+     */
+    void setDisplayMirrorEnabled(bool enabled);
+
+    /**
+     * Sets how the remote desktop is shown in the widget. The default is
+     * ScaleToFitMode.
+     */
+    void setDisplayMode(DisplayMode mode);
+    DisplayMode displayMode() const;
+
+    /**
+     * Moves the viewport shown in ViewportMode so that its top left corner
+     * is at @a offset of the remote desktop. The offset is limited so that
+     * the viewport stays within the remote desktop.
+     */
+    void setViewportOffset(const QPoint &offset);
+    QPoint viewportOffset() const;
+
+    /**
+     * Sets how the session is throttled while the widget is hidden or
+     * minimized. Painting is always stopped while hidden. The default is
+     * SuppressOutputWhenHidden. Takes effect when the widget is hidden next
+     * time.
+     */
+    void setHiddenSessionPolicy(HiddenSessionPolicy policy);
+
+    /**
+     * Enables or disables memory saving mode. When enabled, the framebuffer
+     * of the session is compressed in the background after the widget has
+     * been hidden for a couple of seconds or the remote desktop has not
+     * changed for a minute, and the mirror, scaled and thumbnail images are
+     * freed while the widget is hidden. Compressed parts of the framebuffer
+     * are decompressed when they are updated or shown again. Disabled by
+     * default.
+     */
+    void setMemorySavingEnabled(bool enabled);
+
+    /**
+     * Enables or disables frameUpdated() signal, through which embedding
+     * applications can follow the changes of the remote desktop and read
+     * only the changed pixels with FrameReadGuard. Disabled by default.
+     */
+    void setFrameStreamingEnabled(bool enabled);
+
     void connectToHost(const QString &host, quint16 port);
 
     virtual QSize sizeHint() const;
 
+    /**
+     * Returns current performance counters and latency statistics of the
+     * session. Latency "inputToPhoton" is the time from sending a mouse
+     * button or keyboard event until the first response to it was painted.
+     * Mouse moves are not measured.
+     *
+     * Counters "memoryBytes.*" tell the current memory usage of the
+     * session's framebuffer ("framebuffer" uncompressed and
+     * "framebufferCompressed" compressed) and of the images derived from it
+     * ("mirror", "scaled" and "thumbnail"). Counter
+     * "memoryBytes.allFramebuffers" tells the memory used by the
+     * framebuffers of all sessions of the process.
+     *
+     * Latency "audioBufferDepth" is the distribution of buffered audio when
+     * the audio device reads it. Counters "audioUnderruns" and
+     * "audioOverruns" count the times the buffer ran empty or had to drop
+     * audio because the device did not read it, and "audioFramesDropped" and
+     * "audioFramesInserted" the frames dropped or repeated to keep the
+     * buffer near its target latency. Latency "audioLatency" is the time from
+     * receiving audio until the audio device played it, which is also what
+     * the remote host is told. Counter "audioClockDriftPpm" tells how many
+     * parts per million the audio device plays faster than the system clock.
+     *
+     * Counters "channelBytes.*" and "channelPdus.*" tell the bytes and the
+     * complete PDUs received from each static virtual channel, e.g.
+     * "channelBytes.rdpsnd".
+     */
+    PerformanceReport performanceReport() const;
+
+    /**
+     * Sets interval in milliseconds for emitting performanceReported()
+     * signal. Interval of 0 (default) disables the signal.
+     */
+    void setPerformanceReportInterval(int msecs);
+
+    /**
+     * Sets memory budget in bytes for the framebuffers of all sessions of
+     * the process. A session whose framebuffer does not fit into the budget
+     * is shown black and its updates are dropped, until other sessions free
+     * memory, e.g. by disconnecting or compressing their framebuffers in
+     * memory saving mode. Budget of 0 (default) is unlimited.
+     */
+    static void setFramebufferMemoryBudget(qint64 bytes);
+    static qint64 framebufferMemoryBudget();
+
+    /**
+     * Takes a snapshot of the remote desktop and encodes it in @a format in
+     * a background thread. The snapshot is copy-on-write, so taking it does
+     * not stall receiving updates. Emits snapshotTaken() with the returned
+     * id when the snapshot has been encoded. Returns -1 if not connected.
+     */
+    int takeSnapshot(SnapshotFormat format = PngSnapshot);
+
+    /**
+     * Starts publishing frames of the remote desktop into a ring of
+     * @a slotCount frames in shared memory, from where other local
+     * processes can read them without copying. Each frame tells the area
+     * changed since the previous frame. The layout of the shared memory is
+     * described in sharedframering.h.
+     *
+     * Returns file descriptor of the shared memory, which can be passed to
+     * the other processes e.g. over a Unix domain socket, or -1 on failure.
+     * Supported only on Linux. The descriptor is closed by
+     * stopFrameExport().
+     */
+    int startFrameExport(int slotCount = 3);
+    void stopFrameExport();
+
+    /**
+     * Starts recording the remote desktop losslessly to file @a fileName,
+     * replacing the file if it exists. Only the changed areas of the desktop
+     * are stored, so recording an idle desktop costs next to nothing. The
+     * recording can be played with SessionPlayer. Returns false if the file
+     * cannot be opened.
+     */
+    bool startRecording(const QString &fileName);
+    void stopRecording();
+
+    /**
+     * Starts writing timeline of the update and render pipeline of all
+     * sessions to file @a fileName in Chrome's trace event format. Returns
+     * false if the file cannot be opened or if the library was built without
+     * WITH_TRACING option.
+     */
+    static bool startTracing(const QString &fileName);
+
+    /**
+     * Stops tracing started with startTracing() and finishes the trace file.
+     */
+    static void stopTracing();
+
 signals:
     /**
      * This signal is emitted when connecting to host fails or if already
@@ -24,6 +257,34 @@ signals:
      */
     void disconnected();
 
+    /**
+     * This signal is emitted periodically with current performance @a report
+     * if enabled with setPerformanceReportInterval().
+     */
+    void performanceReported(const PerformanceReport &report);
+
+    /**
+     * This signal is emitted when the viewport shown in ViewportMode has
+     * moved to @a offset.
+     */
+    void viewportOffsetChanged(const QPoint &offset);
+
+    /**
+     * This signal is emitted when snapshot @a id of the remote desktop of
+     * @a size has been encoded to @a data.
+     */
+    void snapshotTaken(int id, const QSize &size, const QByteArray &data);
+
+    /**
+     * This signal is emitted when the remote host has finished updating the
+     * remote desktop, if enabled with setFrameStreamingEnabled(). The
+     * @a damage is the area changed since the previous signal, and
+     * @a sequence increases by one with each signal. The pixels can be read
+     * with FrameReadGuard. When enabled and after the desktop is resized,
+     * the whole desktop is damaged.
+     */
+    void frameUpdated(quint64 sequence, const QRegion &damage);
+
 protected:
     virtual void paintEvent(QPaintEvent *event);
     virtual void mouseMoveEvent(QMouseEvent *event);
@@ -31,9 +292,13 @@ protected:
     virtual void mouseReleaseEvent(QMouseEvent *event);
     virtual void keyPressEvent(QKeyEvent *event);
     virtual void keyReleaseEvent(QKeyEvent *event);
+    virtual void wheelEvent(QWheelEvent *event);
     virtual void resizeEvent(QResizeEvent *event);
+    virtual void showEvent(QShowEvent *event);
+    virtual void hideEvent(QHideEvent *event);
 
 private:
+    friend class FrameReadGuard;
     Q_DECLARE_PRIVATE(RemoteDisplayWidget)
     RemoteDisplayWidgetPrivate* const d_ptr;
 };
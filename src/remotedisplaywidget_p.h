@@ -6,21 +6,43 @@
 #include <QQueue>
 #include <QMutex>
 #include <QTransform>
+#include <QMap>
+#include <QPair>
+#include <QRegion>
+#include <QFutureWatcher>
+#include "remotedisplaywidget.h"
 
 class RemoteDisplayWidget;
 class QThread;
 class FreeRdpClient;
 class RemoteScreenBuffer;
+class DisplayMirror;
 class ScaledScreenBuffer;
 class LetterboxedScreenBuffer;
+class ViewportScreenBuffer;
+class ThumbnailScreenBuffer;
+class FrameExporter;
+class SessionRecorder;
+class ClipboardRedirector;
+class ScreenBuffer;
+class PerformanceCounters;
+class InputLatencyTracker;
+class QTimer;
 
 class RemoteDisplayWidgetPrivate : public QObject {
     Q_OBJECT
 public:
     RemoteDisplayWidgetPrivate(RemoteDisplayWidget *q);
+    ~RemoteDisplayWidgetPrivate();
 
     QPoint mapToRemoteDesktop(const QPoint &local) const;
+    QPoint mapFromRemoteDesktop(const QPoint &remote) const;
     void resizeScreenBuffers();
+    ScreenBuffer *displayedBuffer() const;
+    QRect visibleDesktopArea() const;
+    void refreshStaleArea();
+    void setSessionVisible(bool visible);
+    PerformanceReport createReport() const;
 
     QPointer<QThread> processorThread;
     QPointer<FreeRdpClient> eventProcessor;
@@ -28,9 +50,40 @@ public:
     QRect translatedDesktopRect;
     QTransform translatedDesktopMapper;
     QPointer<RemoteScreenBuffer> remoteScreenBuffer;
+    QPointer<DisplayMirror> displayMirror;
     QPointer<ScaledScreenBuffer> scaledScreenBuffer;
     QPointer<LetterboxedScreenBuffer> letterboxedScreenBuffer;
+    QPointer<ViewportScreenBuffer> viewportScreenBuffer;
+    QPointer<ThumbnailScreenBuffer> thumbnailScreenBuffer;
+    QPointer<LetterboxedScreenBuffer> letterboxedThumbnailBuffer;
     bool repaintNeeded;
+    bool dynamicResolution;
+    bool displayMirrorEnabled;
+    RemoteDisplayWidget::DisplayMode displayMode;
+    RemoteDisplayWidget::HiddenSessionPolicy hiddenSessionPolicy;
+    bool sessionVisible;
+    // policy applied when the session was hidden
+    RemoteDisplayWidget::HiddenSessionPolicy appliedPolicy;
+    // area which may have changed while output was suppressed, refreshed
+    // when it becomes visible
+    QRegion staleArea;
+    bool memorySaving;
+    QPointer<QTimer> memorySavingTimer;
+    QPointer<QTimer> repaintTimer;
+    QPointer<QTimer> resizeTimer;
+    PerformanceCounters *performanceCounters;
+    InputLatencyTracker *inputLatencyTracker;
+    QPointer<QTimer> performanceReportTimer;
+    QPointer<FrameExporter> frameExporter;
+    QPointer<SessionRecorder> recorder;
+    QPointer<ClipboardRedirector> clipboardRedirector;
+    bool frameStreaming;
+    // damage consumer of the streaming API in the remote screen buffer
+    int streamingConsumer;
+    quint64 frameSequence;
+    int nextSnapshotId;
+    // id and size of the snapshots being encoded
+    QMap<QFutureWatcher<QByteArray>*, QPair<int, QSize> > pendingSnapshots;
 
     Q_DECLARE_PUBLIC(RemoteDisplayWidget)
     RemoteDisplayWidget* const q_ptr;
@@ -40,8 +93,14 @@ private slots:
     void onConnected();
     void onDisconnected();
     void onCursorChanged(const QCursor &cursor);
+    void onCursorMoved(const QPoint &pos);
     void onDesktopUpdated();
+    void onDesktopResized(quint16 width, quint16 height);
+    void onResizeTimeout();
     void onRepaintTimeout();
+    void onPerformanceReportTimeout();
+    void onMemorySavingTimeout();
+    void onSnapshotEncoded();
 };
 
 #endif // REMOTEDISPLAYWIDGET_P_H
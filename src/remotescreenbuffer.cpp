@@ -1,63 +1,782 @@
 #include "remotescreenbuffer.h"
 #include "freerdphelpers.h"
+#include "tilecodec.h"
+#include "framebuffermemory.h"
+#include "tracer.h"
 
 #include <QImage>
 #include <QDebug>
 #include <QPainter>
 #include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QReadWriteLock>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QAtomicInt>
+#include <QVector>
+#include <QFuture>
+#include <QMap>
+#include <QtConcurrentRun>
+
+// height of the horizontal strips the buffer is compressed in
+#define TILE_ROWS 64
+// times the tiles drawn to while compressing are compressed again
+#define MAX_COMPRESS_ATTEMPTS 3
+
+namespace {
+
+int bytesPerLine(int width, int bpp) {
+    // rows are aligned to cache lines, so that SIMD kernels can use aligned
+    // loads and a row never shares a cache line with another
+    return ((width * bpp + 511) / 512) * 64;
+}
+
+}
 
 class RemoteScreenBufferPrivate {
 public:
-    RemoteScreenBufferPrivate(RemoteScreenBuffer *q) : q_ptr(q) {
+    RemoteScreenBufferPrivate(RemoteScreenBuffer *q)
+        : q_ptr(q), compressedTileCount(0), layoutVersion(0), nextDamageConsumer(1) {
     }
 
     void initBuffer(int bpp) {
-        Q_Q(RemoteScreenBuffer);
         Q_ASSERT(isSizeAndFormatValid(bpp));
+        compressedTiles.clear();
+        compressedTileCount = 0;
+        bufferData.clear();
+        targetImage = QImage();
+        displayImage = QImage();
         if (isSizeAndFormatValid(bpp)) {
-            bufferData.resize(width * height * bpp);
-            targetImage = q->createImage();
-            targetImage.fill(0);
+            // new memory is zeroed, i.e. black
+            allocateBuffer();
         }
+        updateMemoryUsage();
+    }
+
+    QImage bufferImage() const {
+        return QImage(bufferData.data(), width, height, bytesPerLine(width, bpp), format);
+    }
+
+    /**
+     * Copies pixels of @a area to @a out, which points to the top left pixel
+     * of the area in the destination. Called under the read lock.
+     */
+    void copyPixels(const QRect &area, uchar *out, int stride) const {
+        int bufferStride = bytesPerLine(width, bpp);
+        int pixelBytes = (bpp + 7) / 8;
+        auto source = bufferData.data() + area.top() * bufferStride + area.left() * pixelBytes;
+        for (int y = 0; y < area.height(); y++) {
+            memcpy(out + y * stride, source + y * bufferStride, area.width() * pixelBytes);
+        }
+    }
+
+    /**
+     * Moves the rows of the buffer from @a oldStride to the current stride
+     * and clears the area outside of the old contents.
+     */
+    void relayoutBuffer(int oldWidth, int oldHeight, int oldStride) {
+        auto data = bufferData.data();
+        int stride = bytesPerLine(width, bpp);
+        int rows = qMin<int>(oldHeight, height);
+        int rowBytes = qMin<int>(oldWidth, width) * bpp / 8;
+
+        // when rows grow, start from the bottom so that the rows which are
+        // not yet moved are not overwritten
+        bool bottomUp = stride > oldStride;
+        for (int i = 0; i < rows; i++) {
+            int y = bottomUp ? rows - 1 - i : i;
+            auto row = data + y * stride;
+            memmove(row, data + y * oldStride, rowBytes);
+            memset(row + rowBytes, 0, stride - rowBytes);
+        }
+        memset(data + rows * stride, 0, (height - rows) * stride);
     }
 
     bool isSizeAndFormatValid(int bpp) const {
         return width > 0 && height > 0 && bppToImageFormat(bpp) != QImage::Format_Invalid;
     }
 
-    QByteArray bufferData;
+    bool isResident(const QRect &rect) const {
+        if (bufferData.isEmpty() && isSizeAndFormatValid(bpp)) {
+            return false;
+        }
+        if (compressedTileCount == 0 || rect.isEmpty()) {
+            return true;
+        }
+        int first = qMax(0, rect.top() / TILE_ROWS);
+        int last = qMin(compressedTiles.size() - 1, rect.bottom() / TILE_ROWS);
+        for (int i = first; i <= last; i++) {
+            if (!compressedTiles[i].isNull()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Locks the buffer for reading or drawing and decompresses the tiles
+     * under @a rect, if they are compressed. Returns false without locking
+     * if the buffer cannot be allocated within the memory budget.
+     */
+    bool lockResident(const QRect &rect) const {
+        bufferLock.lockForRead();
+        while (!isResident(rect)) {
+            bufferLock.unlock();
+            {
+                QWriteLocker locker(&bufferLock);
+                if (!decompressTiles(rect)) {
+                    return false;
+                }
+            }
+            bufferLock.lockForRead();
+        }
+        return true;
+    }
+
+    /**
+     * Like lockResident(const QRect &), but for each rectangle of @a region.
+     * The buffer is allocated even if the region is empty.
+     */
+    bool lockResident(const QRegion &region) const {
+        // the empty rect only allocates the buffer
+        auto rects = region.rects();
+        rects << QRect();
+        // the tiles are decompressed under the write lock, which can not be
+        // downgraded, so they are checked again under the read lock
+        bufferLock.lockForRead();
+        forever {
+            int i = 0;
+            while (i < rects.size() && isResident(rects[i])) {
+                i++;
+            }
+            if (i == rects.size()) {
+                return true;
+            }
+            bufferLock.unlock();
+            {
+                QWriteLocker locker(&bufferLock);
+                for (; i < rects.size(); i++) {
+                    if (!decompressTiles(rects[i])) {
+                        return false;
+                    }
+                }
+            }
+            bufferLock.lockForRead();
+        }
+    }
+
+    int tileCount() const {
+        return (height + TILE_ROWS - 1) / TILE_ROWS;
+    }
+
+    bool isTileCompressed(int tile) const {
+        return compressedTileCount > 0 && !compressedTiles[tile].isNull();
+    }
+
+    /**
+     * Invalidates the tiles being compressed after the size of the buffer
+     * has changed. Called under the write lock.
+     */
+    void layoutChanged() {
+        layoutVersion++;
+        tileVersions.resize(tileCount());
+    }
+
+    /**
+     * Marks the tiles under @a rect as drawn to. Called under the read lock
+     * after drawing.
+     */
+    void tilesDrawn(const QRect &rect) {
+        int first = qMax(0, rect.top() / TILE_ROWS);
+        int last = qMin(tileVersions.size() - 1, rect.bottom() / TILE_ROWS);
+        for (int i = first; i <= last; i++) {
+            tileVersions[i].ref();
+        }
+    }
+
+    /**
+     * Adds @a region to the damage of all consumers.
+     */
+    void addDamage(const QRegion &region) const {
+        QMutexLocker locker(&damageMutex);
+        damage += region;
+        for (auto i = consumerDamage.begin(); i != consumerDamage.end(); ++i) {
+            i.value() += region;
+        }
+    }
+
+    bool allocateBuffer() const;
+    void compressTiles();
+    bool decompressTiles(const QRect &rect) const;
+    void updateMemoryUsage() const;
+    void copyTile(FramebufferSnapshot *snapshot, int tile, bool copyPixels = true) const;
+    void preserveTiles(const QRect &rect) const;
+    void completeSnapshots() const;
+
+    mutable FramebufferMemory bufferData;
     quint16 width;
     quint16 height;
+    quint8 bpp;
     QImage::Format format;
-    QImage targetImage;
+    mutable QImage targetImage;
+    // separate from targetImage which is painted to in the RDP thread
+    mutable QImage displayImage;
+    mutable QMutex damageMutex;
+    mutable QRegion damage;
+    // damage of the consumers other than the screen buffer chain
+    mutable QMap<int, QRegion> consumerDamage;
+    int nextDamageConsumer;
+
+    // taken for reading when the buffer is drawn to or read, and for writing
+    // when it is compressed, decompressed or resized
+    mutable QReadWriteLock bufferLock;
+    // compressed tiles; a null tile is resident in the buffer. The buffer is
+    // freed when all tiles are compressed.
+    mutable QVector<QByteArray> compressedTiles;
+    mutable int compressedTileCount;
+    // changed whenever the buffer is resized
+    int layoutVersion;
+    // incremented whenever a tile is drawn to, so that compressTiles() can
+    // tell whether the tile changed while it was compressed
+    QVector<QAtomicInt> tileVersions;
+    QFuture<void> compression;
+    // counts the reads of the buffer, so that a compression during which the
+    // buffer was read is abandoned, as the buffer is in use again
+    mutable QAtomicInt readCount;
+    // count of lockPixels() calls not yet unlocked
+    mutable QAtomicInt activeReaders;
+    // copy handed out by createImage(const QRegion &), so that the images do
+    // not alias the buffer which is freed when compressed. Only the areas
+    // read are up to date.
+    mutable QImage readImage;
+    // updated under the lock, but readable without it
+    mutable QAtomicInt residentBytes;
+    mutable QAtomicInt compressedBytes;
+    // set while the buffer cannot be allocated within the memory budget
+    mutable QAtomicInt outOfMemory;
+
+    // snapshots which still share tiles with the buffer; taken after
+    // bufferLock, when both are needed
+    mutable QMutex snapshotMutex;
+    mutable QList<FramebufferSnapshot*> pendingSnapshots;
+    QAtomicInt pendingSnapshotCount;
 
 private:
     Q_DECLARE_PUBLIC(RemoteScreenBuffer)
     RemoteScreenBuffer* const q_ptr;
 };
 
+bool RemoteScreenBufferPrivate::allocateBuffer() const {
+    if (!bufferData.resize(bytesPerLine(width, bpp) * height)) {
+        if (outOfMemory.testAndSetRelaxed(0, 1)) {
+            qWarning() << "Framebuffer memory budget exceeded, dropping updates";
+        }
+        return false;
+    }
+    if (outOfMemory.testAndSetRelaxed(1, 0)) {
+        // the updates dropped meanwhile are missing, so the buffer is shown
+        // as a whole again
+        addDamage(QRect(0, 0, width, height));
+    }
+    targetImage = bufferImage();
+    displayImage = bufferImage();
+    updateMemoryUsage();
+    return true;
+}
+
+void RemoteScreenBufferPrivate::compressTiles() {
+    TRACE_SCOPE("compressFramebuffer");
+    int layout;
+    int reads;
+    int count;
+    int stride;
+    {
+        QReadLocker locker(&bufferLock);
+        if (bufferData.isEmpty() || !isSizeAndFormatValid(bpp)) {
+            return;
+        }
+        layout = layoutVersion;
+        reads = readCount;
+        count = tileCount();
+        stride = bytesPerLine(width, bpp);
+    }
+
+    // the tiles are compressed one at a time under the read lock, so that
+    // the buffer can be drawn to and read meanwhile. The write lock is taken
+    // only to replace the buffer with the tiles, if none of them was drawn
+    // to after it was compressed.
+    QVector<QByteArray> tiles(count);
+    QVector<int> versions(count);
+    for (int attempt = 0; attempt < MAX_COMPRESS_ATTEMPTS; attempt++) {
+        for (int i = 0; i < count; i++) {
+            QReadLocker locker(&bufferLock);
+            if (layoutVersion != layout || readCount != reads || bufferData.isEmpty()) {
+                return;
+            }
+            // the tiles still compressed from before are not in the buffer
+            if (isTileCompressed(i) || (!tiles[i].isNull() && versions[i] == tileVersions[i])) {
+                continue;
+            }
+            int rows = qMin(TILE_ROWS, height - i * TILE_ROWS);
+            versions[i] = tileVersions[i];
+            tiles[i] = TileCodec::compress((const char*)bufferData.data() + i * TILE_ROWS * stride, rows * stride);
+        }
+
+        QWriteLocker locker(&bufferLock);
+        // readers count the read under the read lock, so no read is missed
+        if (layoutVersion != layout || readCount != reads || activeReaders > 0 ||
+                bufferData.isEmpty()) {
+            return;
+        }
+        bool complete = true;
+        for (int i = 0; i < count && complete; i++) {
+            complete = isTileCompressed(i) || (!tiles[i].isNull() && versions[i] == tileVersions[i]);
+        }
+        if (!complete) {
+            continue;
+        }
+
+        compressedTiles.resize(count);
+        for (int i = 0; i < count; i++) {
+            if (compressedTiles[i].isNull()) {
+                compressedTiles[i] = tiles[i];
+            }
+        }
+        compressedTileCount = count;
+
+        targetImage = QImage();
+        displayImage = QImage();
+        bufferData.clear();
+        updateMemoryUsage();
+        return;
+    }
+}
+
+bool RemoteScreenBufferPrivate::decompressTiles(const QRect &rect) const {
+    if (bufferData.isEmpty() && isSizeAndFormatValid(bpp) && !allocateBuffer()) {
+        return false;
+    }
+    if (compressedTileCount == 0 || rect.isEmpty()) {
+        return true;
+    }
+
+    TRACE_SCOPE("decompressFramebuffer");
+    int stride = bytesPerLine(width, bpp);
+
+    auto data = (char*)bufferData.data();
+    int first = qMax(0, rect.top() / TILE_ROWS);
+    int last = qMin(compressedTiles.size() - 1, rect.bottom() / TILE_ROWS);
+    for (int i = first; i <= last; i++) {
+        auto &tile = compressedTiles[i];
+        if (tile.isNull()) {
+            continue;
+        }
+        int rows = qMin(TILE_ROWS, height - i * TILE_ROWS);
+        auto out = data + i * TILE_ROWS * stride;
+        if (!TileCodec::decompress(tile, out, rows * stride)) {
+            qWarning() << "Corrupt framebuffer tile" << i;
+            memset(out, 0, rows * stride);
+        }
+        tile = QByteArray();
+        compressedTileCount--;
+    }
+    if (compressedTileCount == 0) {
+        compressedTiles.clear();
+    }
+    updateMemoryUsage();
+    return true;
+}
+
+void RemoteScreenBufferPrivate::updateMemoryUsage() const {
+    int compressed = 0;
+    for (int i = 0; i < compressedTiles.size(); i++) {
+        compressed += compressedTiles[i].size();
+    }
+    residentBytes = (int)bufferData.size();
+    compressedBytes = compressed;
+}
+
+void RemoteScreenBufferPrivate::copyTile(FramebufferSnapshot *snapshot, int tile, bool copyPixels) const {
+    if (snapshot->copiedTiles[tile]) {
+        return;
+    }
+
+    // a buffer which could not be allocated is black, as is the snapshot
+    // image initially
+    if (copyPixels && !bufferData.isEmpty() &&
+            (compressedTileCount == 0 || compressedTiles[tile].isNull())) {
+        int stride = bytesPerLine(width, bpp);
+        auto &image = snapshot->snapshotImage;
+        int rowBytes = qMin(stride, image.bytesPerLine());
+        int last = qMin<int>(height, (tile + 1) * TILE_ROWS);
+        for (int y = tile * TILE_ROWS; y < last; y++) {
+            memcpy(image.scanLine(y), bufferData.data() + y * stride, rowBytes);
+        }
+    }
+
+    snapshot->copiedTiles[tile] = true;
+    if (--snapshot->remainingTiles == 0) {
+        pendingSnapshots.removeOne(snapshot);
+        pendingSnapshotCount.fetchAndAddRelaxed(-1);
+    }
+}
+
+void RemoteScreenBufferPrivate::preserveTiles(const QRect &rect) const {
+    if (pendingSnapshotCount == 0) {
+        return;
+    }
+
+    QMutexLocker locker(&snapshotMutex);
+    int first = qMax(0, rect.top() / TILE_ROWS);
+    int last = qMin(tileCount() - 1, rect.bottom() / TILE_ROWS);
+    // copied, as completed snapshots are removed from the list
+    auto snapshots = pendingSnapshots;
+    for (int i = 0; i < snapshots.size(); i++) {
+        for (int tile = first; tile <= last; tile++) {
+            copyTile(snapshots[i], tile);
+        }
+    }
+}
+
+void RemoteScreenBufferPrivate::completeSnapshots() const {
+    if (pendingSnapshotCount == 0) {
+        return;
+    }
+
+    // the tiles are copied from the buffer, so decompressed first
+    decompressTiles(QRect(0, 0, width, height));
+    QMutexLocker locker(&snapshotMutex);
+    auto snapshots = pendingSnapshots;
+    for (int i = 0; i < snapshots.size(); i++) {
+        for (int tile = 0; tile < tileCount(); tile++) {
+            copyTile(snapshots[i], tile);
+        }
+    }
+}
+
+FramebufferSnapshot::FramebufferSnapshot(RemoteScreenBufferPrivate *buffer, const QImage &image, int tileCount)
+    : buffer(buffer), snapshotImage(image), copiedTiles(tileCount, false), remainingTiles(tileCount) {
+}
+
+FramebufferSnapshot::~FramebufferSnapshot() {
+    if (remainingTiles > 0) {
+        QMutexLocker locker(&buffer->snapshotMutex);
+        if (remainingTiles > 0) {
+            buffer->pendingSnapshots.removeOne(this);
+            buffer->pendingSnapshotCount.fetchAndAddRelaxed(-1);
+        }
+    }
+}
+
+QImage FramebufferSnapshot::image() {
+    for (int tile = 0; tile < copiedTiles.size(); tile++) {
+        {
+            QMutexLocker locker(&buffer->snapshotMutex);
+            if (remainingTiles == 0) {
+                break;
+            }
+            if (copiedTiles[tile]) {
+                continue;
+            }
+        }
+
+        // one tile at a time, so that the RDP thread is not held up by
+        // copying the whole buffer
+        QRect tileRect(0, tile * TILE_ROWS, buffer->width, TILE_ROWS);
+        bool locked = buffer->lockResident(tileRect);
+        {
+            QMutexLocker locker(&buffer->snapshotMutex);
+            buffer->copyTile(this, tile, locked);
+        }
+        if (locked) {
+            buffer->bufferLock.unlock();
+        }
+    }
+    return snapshotImage;
+}
+
 RemoteScreenBuffer::RemoteScreenBuffer(quint16 width, quint16 height, quint8 bpp, QObject *parent)
     : QObject(parent), d_ptr(new RemoteScreenBufferPrivate(this)) {
     Q_D(RemoteScreenBuffer);
     d->width = width;
     d->height = height;
+    d->bpp = bpp;
     d->format = bppToImageFormat(bpp);
     d->initBuffer(bpp);
+    d->layoutChanged();
+    d->damage = QRect(0, 0, width, height);
 }
 
 RemoteScreenBuffer::~RemoteScreenBuffer() {
+    Q_D(RemoteScreenBuffer);
+    d->compression.waitForFinished();
+    {
+        QWriteLocker locker(&d->bufferLock);
+        d->completeSnapshots();
+    }
     delete d_ptr;
 }
 
 QImage RemoteScreenBuffer::createImage() const {
     Q_D(const RemoteScreenBuffer);
-    return QImage((uchar*)d->bufferData.data(), d->width, d->height, d->format);
+    if (!d->lockResident(QRect(0, 0, d->width, d->height))) {
+        return QImage();
+    }
+    d->readCount.ref();
+    // copied, as the buffer may be freed by compressing it as soon as it is
+    // unlocked
+    auto image = d->bufferData.isEmpty() ? QImage() : d->bufferImage().copy();
+    d->bufferLock.unlock();
+    return image;
+}
+
+QImage RemoteScreenBuffer::createImage(const QRegion &region) const {
+    Q_D(const RemoteScreenBuffer);
+    QRegion area = region & QRect(0, 0, d->width, d->height);
+    // only the tiles under the region are decompressed, the others are left
+    // as they are in the buffer
+    if (!d->lockResident(area)) {
+        return QImage();
+    }
+    d->readCount.ref();
+    if (d->bufferData.isEmpty()) {
+        d->bufferLock.unlock();
+        return QImage();
+    }
+
+    // only the region is copied, to the image kept from the previous call
+    if (d->readImage.size() != size() || d->readImage.format() != d->format) {
+        d->readImage = QImage(size(), d->format);
+    }
+    if (!d->readImage.isNull()) {
+        int pixelBytes = (d->bpp + 7) / 8;
+        int stride = d->readImage.bytesPerLine();
+        auto bits = d->readImage.bits();
+        auto rects = area.rects();
+        for (int i = 0; i < rects.size(); i++) {
+            auto rect = rects[i];
+            d->copyPixels(rect, bits + rect.top() * stride + rect.left() * pixelBytes, stride);
+        }
+    }
+    d->bufferLock.unlock();
+    return d->readImage;
+}
+
+QSize RemoteScreenBuffer::size() const {
+    Q_D(const RemoteScreenBuffer);
+    return QSize(d->width, d->height);
+}
+
+QImage::Format RemoteScreenBuffer::format() const {
+    Q_D(const RemoteScreenBuffer);
+    return d->format;
+}
+
+QSharedPointer<FramebufferSnapshot> RemoteScreenBuffer::takeSnapshot() {
+    Q_D(RemoteScreenBuffer);
+    QImage image(d->width, d->height, d->format);
+    image.fill(0);
+
+    QSharedPointer<FramebufferSnapshot> snapshot(
+        new FramebufferSnapshot(d, image, image.isNull() ? 0 : d->tileCount()));
+    if (snapshot->remainingTiles > 0) {
+        // registered while no update is being drawn, which waits at most
+        // for drawing a single rectangle
+        QWriteLocker bufferLocker(&d->bufferLock);
+        QMutexLocker locker(&d->snapshotMutex);
+        d->pendingSnapshots << snapshot.data();
+        d->pendingSnapshotCount.fetchAndAddRelaxed(1);
+    }
+    return snapshot;
+}
+
+bool RemoteScreenBuffer::readPixels(const QRect &rect, uchar *out, int stride) const {
+    Q_D(const RemoteScreenBuffer);
+    QRect area = rect & QRect(0, 0, d->width, d->height);
+    if (area.isEmpty()) {
+        return true;
+    }
+    if (!d->lockResident(area)) {
+        return false;
+    }
+    d->readCount.ref();
+
+    int pixelBytes = (d->bpp + 7) / 8;
+    out += (area.top() - rect.top()) * stride + (area.left() - rect.left()) * pixelBytes;
+    d->copyPixels(area, out, stride);
+    d->bufferLock.unlock();
+    return true;
+}
+
+bool RemoteScreenBuffer::lockPixels(const QRegion &region) const {
+    Q_D(const RemoteScreenBuffer);
+    if (!d->lockResident(region & QRect(0, 0, d->width, d->height))) {
+        return false;
+    }
+    if (d->bufferData.isEmpty()) {
+        d->bufferLock.unlock();
+        return false;
+    }
+    d->readCount.ref();
+    d->activeReaders.ref();
+    return true;
+}
+
+void RemoteScreenBuffer::unlockPixels() const {
+    Q_D(const RemoteScreenBuffer);
+    d->activeReaders.deref();
+    d->bufferLock.unlock();
+}
+
+const uchar *RemoteScreenBuffer::constBits() const {
+    Q_D(const RemoteScreenBuffer);
+    return d->bufferData.data();
+}
+
+int RemoteScreenBuffer::bytesPerLine() const {
+    Q_D(const RemoteScreenBuffer);
+    return ::bytesPerLine(d->width, d->bpp);
+}
+
+int RemoteScreenBuffer::addDamageConsumer() {
+    Q_D(RemoteScreenBuffer);
+    QMutexLocker locker(&d->damageMutex);
+    int consumer = d->nextDamageConsumer++;
+    d->consumerDamage[consumer] = QRect(0, 0, d->width, d->height);
+    return consumer;
+}
+
+void RemoteScreenBuffer::removeDamageConsumer(int consumer) {
+    Q_D(RemoteScreenBuffer);
+    QMutexLocker locker(&d->damageMutex);
+    d->consumerDamage.remove(consumer);
+}
+
+QRegion RemoteScreenBuffer::takeDamage(int consumer) {
+    Q_D(RemoteScreenBuffer);
+    QMutexLocker locker(&d->damageMutex);
+    auto i = d->consumerDamage.find(consumer);
+    if (i == d->consumerDamage.end()) {
+        return QRegion();
+    }
+    QRegion damage = i.value();
+    i.value() = QRegion();
+    return damage;
+}
+
+void RemoteScreenBuffer::render(QPainter *painter, const QRect &rect) const {
+    Q_D(const RemoteScreenBuffer);
+    if (!d->lockResident(rect)) {
+        painter->fillRect(rect, Qt::black);
+        return;
+    }
+    d->readCount.ref();
+    painter->drawImage(rect.topLeft(), d->displayImage, rect);
+    d->bufferLock.unlock();
+}
+
+void RemoteScreenBuffer::resize(quint16 width, quint16 height, quint8 bpp) {
+    Q_D(RemoteScreenBuffer);
+    auto format = bppToImageFormat(bpp);
+    if (width == d->width && height == d->height && format == d->format) {
+        return;
+    }
+
+    QWriteLocker bufferLocker(&d->bufferLock);
+    d->completeSnapshots();
+    // the contents are kept only in the same format, and they must be in
+    // the buffer for that
+    bool keepContents = format == d->format &&
+        d->decompressTiles(QRect(0, 0, d->width, d->height));
+
+    int oldWidth = d->width;
+    int oldHeight = d->height;
+    d->width = width;
+    d->height = height;
+    d->layoutChanged();
+
+    d->addDamage(QRect(0, 0, width, height));
+
+    if (!keepContents) {
+        d->bpp = bpp;
+        d->format = format;
+        d->initBuffer(bpp);
+        return;
+    }
+
+    if (!d->isSizeAndFormatValid(bpp)) {
+        return;
+    }
+
+    // the buffer is never shrunk, so that resizing back and forth does not
+    // allocate
+    int size = bytesPerLine(width, bpp) * height;
+    if (d->bufferData.size() < size && !d->bufferData.resize(size)) {
+        // the old and the new buffer together do not fit into the budget,
+        // so the contents are dropped and a new buffer is allocated alone
+        d->initBuffer(bpp);
+        return;
+    }
+    d->relayoutBuffer(oldWidth, oldHeight, bytesPerLine(oldWidth, bpp));
+    d->targetImage = d->bufferImage();
+    d->displayImage = d->bufferImage();
+    d->updateMemoryUsage();
+}
+
+void RemoteScreenBuffer::compress() {
+    Q_D(RemoteScreenBuffer);
+    // the copy for createImage() is freed even if the buffer stays in use,
+    // as it is recreated on the next call
+    d->readImage = QImage();
+    if (d->activeReaders > 0) {
+        return;
+    }
+    if (!d->compression.isRunning()) {
+        d->compression = QtConcurrent::run(d, &RemoteScreenBufferPrivate::compressTiles);
+    }
+}
+
+qint64 RemoteScreenBuffer::residentMemory() const {
+    Q_D(const RemoteScreenBuffer);
+    return d->residentBytes;
+}
+
+qint64 RemoteScreenBuffer::compressedMemory() const {
+    Q_D(const RemoteScreenBuffer);
+    return d->compressedBytes;
+}
+
+bool RemoteScreenBuffer::isOutOfMemory() const {
+    Q_D(const RemoteScreenBuffer);
+    return d->outOfMemory;
 }
 
 void RemoteScreenBuffer::addRectangle(const QRect &rect, const QByteArray &data) {
     Q_D(RemoteScreenBuffer);
+    TRACE_SCOPE("commitRectangle");
     QImage rectImg((uchar*)data.data(), rect.width(), rect.height(), d->format);
 
-    QPainter painter(&d->targetImage);
-    painter.drawImage(rect, rectImg);
+    if (!d->lockResident(rect)) {
+        return;
+    }
+    d->preserveTiles(rect);
+    {
+        QPainter painter(&d->targetImage);
+        painter.drawImage(rect, rectImg);
+    }
+    d->tilesDrawn(rect);
+    d->bufferLock.unlock();
+
+    // damage is added only after drawing, so that whoever takes it sees the
+    // new contents
+    d->addDamage(rect);
+}
+
+QRegion RemoteScreenBuffer::takeDamage() {
+    Q_D(RemoteScreenBuffer);
+    QMutexLocker locker(&d->damageMutex);
+    QRegion damage = d->damage;
+    d->damage = QRegion();
+    return damage;
 }
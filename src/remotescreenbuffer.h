@@ -2,22 +2,66 @@
 #define REMOTESCREENBUFFER_H
 
 #include <QObject>
+#include <QImage>
+#include <QVector>
+#include <QSharedPointer>
 #include "screenbuffer.h"
 #include "bitmaprectanglesink.h"
 
-class QImage;
 class QRect;
+class QRegion;
 class QByteArray;
 class RemoteScreenBufferPrivate;
 
+/**
+ * The FramebufferSnapshot class is a copy-on-write snapshot of a
+ * RemoteScreenBuffer, taken with RemoteScreenBuffer::takeSnapshot().
+ *
+ * Taking a snapshot does not copy the buffer. Instead, the RDP thread copies
+ * each tile of the buffer to the snapshot just before it draws to the tile
+ * for the first time after the snapshot, and image() copies the tiles which
+ * have not changed. Either way only one tile is copied at a time, so the RDP
+ * thread is not stalled by copying the whole buffer.
+ */
+class FramebufferSnapshot {
+public:
+    ~FramebufferSnapshot();
+
+    /**
+     * Returns the contents of the buffer at the time of the snapshot. Can be
+     * called in any thread, but the buffer must not be destroyed meanwhile.
+     */
+    QImage image();
+
+private:
+    Q_DISABLE_COPY(FramebufferSnapshot)
+    FramebufferSnapshot(RemoteScreenBufferPrivate *buffer, const QImage &image, int tileCount);
+
+    friend class RemoteScreenBuffer;
+    friend class RemoteScreenBufferPrivate;
+    // all of the below are guarded by the buffer's snapshot mutex
+    RemoteScreenBufferPrivate *buffer;
+    QImage snapshotImage;
+    QVector<bool> copiedTiles;
+    int remainingTiles;
+};
+
 /**
  * The RemoteScreenBuffer class is a screen buffer which contains the remote
  * host's whole display area.
  *
  * With addRectangle() the RDP handling thread updates the screen buffer.
  *
- * With createImage() the GUI thread can request for a QImage which provides
- * access to the buffer.
+ * With createImage() the GUI thread can request for a QImage which contains
+ * a copy of the buffer, or draw the buffer directly with render().
+ *
+ * To save memory while the session is idle or hidden, the buffer can be
+ * compressed with compress(). The buffer is compressed in horizontal tiles,
+ * which are decompressed lazily when they are drawn to or read again.
+ *
+ * The buffer is allocated from FramebufferMemory within the process-wide
+ * framebuffer memory budget. While the budget does not allow allocating
+ * it, updates are dropped and the buffer is drawn black.
  */
 class RemoteScreenBuffer : public QObject, public ScreenBuffer, public BitmapRectangleSink {
     Q_OBJECT
@@ -29,7 +73,112 @@ public:
     RemoteScreenBuffer(quint16 width, quint16 height, quint8 bpp, QObject *parent = 0);
     ~RemoteScreenBuffer();
 
+    /**
+     * Implemented from ScreenBuffer. The returned images are copies, which
+     * stay valid when the buffer is compressed or updated.
+     * createImage(const QRegion &) copies only the pixels under the region,
+     * to an image kept for the next call.
+     */
     virtual QImage createImage() const;
+    virtual QImage createImage(const QRegion &region) const;
+    virtual QSize size() const;
+    virtual void render(QPainter *painter, const QRect &rect) const;
+
+    QImage::Format format() const;
+
+    /**
+     * Resizes the screen buffer to @a width and @a height with @a bpp bits
+     * per pixel. The buffer is resized in place, so memory is allocated only
+     * if the buffer grows larger than it has been before. The part of the
+     * contents which fits into the new size is kept, unless the format
+     * changes.
+     *
+     * Note that this method must not be called while addRectangle() is
+     * running in another thread.
+     */
+    void resize(quint16 width, quint16 height, quint8 bpp);
+
+    /**
+     * Compresses the buffer in a background thread and frees the
+     * uncompressed buffer. The buffer can be drawn to and read meanwhile,
+     * but if it keeps changing or is read, it is left uncompressed. Nothing
+     * is done while the buffer is locked with lockPixels().
+     */
+    void compress();
+
+    /**
+     * Returns count of bytes allocated for the uncompressed buffer, which is
+     * 0 while the whole buffer is compressed.
+     */
+    qint64 residentMemory() const;
+
+    /**
+     * Returns count of bytes taken by the compressed tiles of the buffer.
+     */
+    qint64 compressedMemory() const;
+
+    /**
+     * Returns true if the buffer could not be allocated within the memory
+     * budget. Allocating is tried again on every update, and once it
+     * succeeds, the whole buffer is reported as damaged.
+     */
+    bool isOutOfMemory() const;
+
+    /**
+     * Implemented from ScreenBuffer. After construction and resize() the
+     * whole buffer is returned.
+     *
+     * Note that this method is thread-safe.
+     */
+    virtual QRegion takeDamage();
+
+    /**
+     * Registers a consumer of damage in addition to the screen buffers
+     * which take it with takeDamage(). Returns id of the consumer for
+     * takeDamage(int). Initially the whole buffer is damaged.
+     *
+     * Note that this method is thread-safe, as are the other consumer
+     * methods.
+     */
+    int addDamageConsumer();
+    void removeDamageConsumer(int consumer);
+
+    /**
+     * Returns damage of @a consumer since the previous call and clears it.
+     */
+    QRegion takeDamage(int consumer);
+
+    /**
+     * Takes a copy-on-write snapshot of the buffer's current contents.
+     */
+    QSharedPointer<FramebufferSnapshot> takeSnapshot();
+
+    /**
+     * Copies pixels of @a rect in the buffer's format to @a out, which
+     * points to the top left pixel of the rect in the destination and whose
+     * rows are @a stride bytes apart. Can be called in any thread while the
+     * RDP thread updates the buffer, in which case the pixels of a
+     * rectangle being drawn may be torn. Returns false if the buffer cannot
+     * be allocated within the memory budget.
+     */
+    bool readPixels(const QRect &rect, uchar *out, int stride) const;
+
+    /**
+     * Locks the buffer for reading, so that it is not resized or compressed
+     * until unlockPixels() is called, and decompresses the tiles under
+     * @a region if needed. Meanwhile the pixels under @a region can be read
+     * through constBits(), while the RDP thread may still draw updates, in
+     * which case the pixels of a rectangle being drawn may be torn. Returns
+     * false without locking if the buffer is not allocated.
+     *
+     * Note that render() and createImage() must not be called by the same
+     * thread while the buffer is locked.
+     */
+    bool lockPixels(const QRegion &region) const;
+    void unlockPixels() const;
+
+    const uchar *constBits() const;
+    int bytesPerLine() const;
 
     /**
      * Implemented from BitmapRectangleSink. Adds given bitmap rectangle to the
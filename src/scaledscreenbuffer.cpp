@@ -1,23 +1,111 @@
 #include "scaledscreenbuffer.h"
+#include "performancecounters.h"
 
 #include <QImage>
+#include <QPainter>
+#include <QRegion>
 #include <QSize>
 #include <QTransform>
+#include <qmath.h>
 
 class ScaledScreenBufferPrivate {
 public:
+    void synchronize() const;
+    QRect mapFromSource(const QRect &rect, const QSize &sourceSize) const;
+    QRect mapToSource(const QRect &rect, const QSize &sourceSize) const;
+
     ScreenBuffer *sourceBuffer;
+    PerformanceCounters *performanceCounters;
     QSize scaledSize;
     QTransform coordinateTransform;
+    mutable ImageScaler scaler;
+    mutable QImage scaledImage;
+    // damage of the scaled buffer not yet taken with takeDamage()
+    mutable QRegion damage;
 };
 
+void ScaledScreenBufferPrivate::synchronize() const {
+    auto sourceDamage = sourceBuffer->takeDamage();
+    auto sourceSize = sourceBuffer->size();
+    if (sourceSize == scaledSize || scaledSize.isEmpty()) {
+        // e.g. the remote desktop was resized to match the widget
+        scaledImage = QImage();
+        damage += sourceDamage;
+        return;
+    }
+
+    QRegion scaledDamage;
+    if (scaledImage.size() != scaledSize) {
+        scaledImage = QImage(scaledSize, QImage::Format_RGB32);
+        scaledDamage = scaledImage.rect();
+    } else {
+        auto rects = sourceDamage.rects();
+        for (int i = 0; i < rects.size(); i++) {
+            scaledDamage += mapFromSource(rects[i], sourceSize);
+        }
+    }
+    if (scaledDamage.isEmpty()) {
+        return;
+    }
+
+    LatencyTimer timer(performanceCounters, PerformanceCounters::ScaleLatency);
+    auto rects = scaledDamage.rects();
+    QRegion sourceArea;
+    for (int i = 0; i < rects.size(); i++) {
+        sourceArea += mapToSource(rects[i], sourceSize);
+    }
+    auto sourceImage = sourceBuffer->createImage(sourceArea);
+    if (ImageScaler::isFormatSupported(sourceImage.format())) {
+        for (int i = 0; i < rects.size(); i++) {
+            scaler.scale(sourceImage, &scaledImage, rects[i]);
+        }
+    } else {
+        QPainter painter(&scaledImage);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(scaledImage.rect(), sourceBuffer->createImage());
+        scaledDamage = scaledImage.rect();
+    }
+    damage += scaledDamage;
+}
+
+QRect ScaledScreenBufferPrivate::mapFromSource(const QRect &rect, const QSize &sourceSize) const {
+    qreal scaleX = (qreal)scaledSize.width() / sourceSize.width();
+    qreal scaleY = (qreal)scaledSize.height() / sourceSize.height();
+    // a source pixel affects also the neighbouring scaled pixels through the
+    // filter kernel
+    int marginX = qCeil(scaleX) + 1;
+    int marginY = qCeil(scaleY) + 1;
+
+    QPoint topLeft(qFloor(rect.left() * scaleX) - marginX,
+        qFloor(rect.top() * scaleY) - marginY);
+    QPoint bottomRight(qCeil((rect.right() + 1) * scaleX) + marginX - 1,
+        qCeil((rect.bottom() + 1) * scaleY) + marginY - 1);
+    return QRect(topLeft, bottomRight) & QRect(QPoint(0, 0), scaledSize);
+}
+
+QRect ScaledScreenBufferPrivate::mapToSource(const QRect &rect, const QSize &sourceSize) const {
+    qreal scaleX = (qreal)sourceSize.width() / scaledSize.width();
+    qreal scaleY = (qreal)sourceSize.height() / scaledSize.height();
+    // the filter kernel of a scaled pixel reads also the neighbouring
+    // source pixels
+    int marginX = qCeil(scaleX) + 1;
+    int marginY = qCeil(scaleY) + 1;
+
+    QPoint topLeft(qFloor(rect.left() * scaleX) - marginX,
+        qFloor(rect.top() * scaleY) - marginY);
+    QPoint bottomRight(qCeil((rect.right() + 1) * scaleX) + marginX - 1,
+        qCeil((rect.bottom() + 1) * scaleY) + marginY - 1);
+    return QRect(topLeft, bottomRight) & QRect(QPoint(0, 0), sourceSize);
+}
+
 ScaledScreenBuffer::ScaledScreenBuffer(ScreenBuffer *source, QObject *parent)
     : QObject(parent), d_ptr(new ScaledScreenBufferPrivate) {
     Q_D(ScaledScreenBuffer);
     d->sourceBuffer = source;
+    d->performanceCounters = nullptr;
     Q_ASSERT(d->sourceBuffer);
 
-    d->scaledSize = d->sourceBuffer->createImage().size();
+    d->scaledSize = d->sourceBuffer->size();
 }
 
 ScaledScreenBuffer::~ScaledScreenBuffer() {
@@ -26,21 +114,55 @@ ScaledScreenBuffer::~ScaledScreenBuffer() {
 
 QImage ScaledScreenBuffer::createImage() const {
     Q_D(const ScaledScreenBuffer);
-    auto sourceImage = d->sourceBuffer->createImage();
-    if (!sourceImage.isNull()) {
-        return sourceImage.scaled(d->scaledSize, Qt::IgnoreAspectRatio,
-            Qt::SmoothTransformation);
+    d->synchronize();
+    if (d->scaledImage.isNull()) {
+        return d->sourceBuffer->createImage();
     }
-    return QImage();
+    return d->scaledImage;
+}
+
+QImage ScaledScreenBuffer::createImage(const QRegion &region) const {
+    Q_D(const ScaledScreenBuffer);
+    d->synchronize();
+    if (d->scaledImage.isNull()) {
+        return d->sourceBuffer->createImage(region);
+    }
+    return d->scaledImage;
+}
+
+QSize ScaledScreenBuffer::size() const {
+    Q_D(const ScaledScreenBuffer);
+    return d->scaledSize;
+}
+
+void ScaledScreenBuffer::render(QPainter *painter, const QRect &rect) const {
+    Q_D(const ScaledScreenBuffer);
+    d->synchronize();
+    if (d->scaledImage.isNull()) {
+        d->sourceBuffer->render(painter, rect);
+    } else {
+        painter->drawImage(rect.topLeft(), d->scaledImage, rect);
+    }
+}
+
+QRegion ScaledScreenBuffer::takeDamage() {
+    Q_D(ScaledScreenBuffer);
+    d->synchronize();
+    QRegion damage = d->damage;
+    d->damage = QRegion();
+    return damage;
 }
 
 void ScaledScreenBuffer::scaleToFit(const QSize &size) {
     Q_D(ScaledScreenBuffer);
-    auto sourceImage = d->sourceBuffer->createImage();
-    if (!sourceImage.isNull()) {
-        QSize sourceSize = sourceImage.size();
+    QSize sourceSize = d->sourceBuffer->size();
+    if (!sourceSize.isEmpty()) {
         d->scaledSize = sourceSize;
         d->scaledSize.scale(size, Qt::KeepAspectRatio);
+        // the source may have changed without this buffer pulling its damage,
+        // so everything is scaled again
+        d->scaledImage = QImage();
+        d->damage = QRect(QPoint(0, 0), d->scaledSize);
 
         qreal scaleX = (qreal)sourceSize.width() / (qreal)d->scaledSize.width();
         qreal scaleY = (qreal)sourceSize.height() / (qreal)d->scaledSize.height();
@@ -49,7 +171,33 @@ void ScaledScreenBuffer::scaleToFit(const QSize &size) {
     }
 }
 
+QPoint ScaledScreenBuffer::mapFromSource(const QPoint &point) const {
+    Q_D(const ScaledScreenBuffer);
+    return d->coordinateTransform.inverted().map(point);
+}
+
 QPoint ScaledScreenBuffer::mapToSource(const QPoint &point) const {
     Q_D(const ScaledScreenBuffer);
     return d->coordinateTransform.map(point);
 }
+
+void ScaledScreenBuffer::setScaleQuality(ImageScaler::Quality quality) {
+    Q_D(ScaledScreenBuffer);
+    d->scaler.setQuality(quality);
+}
+
+void ScaledScreenBuffer::setPerformanceCounters(PerformanceCounters *counters) {
+    Q_D(ScaledScreenBuffer);
+    d->performanceCounters = counters;
+}
+
+void ScaledScreenBuffer::releaseMemory() {
+    Q_D(ScaledScreenBuffer);
+    // allocated and scaled as a whole again on the next synchronize()
+    d->scaledImage = QImage();
+}
+
+qint64 ScaledScreenBuffer::memoryUsage() const {
+    Q_D(const ScaledScreenBuffer);
+    return d->scaledImage.byteCount();
+}
@@ -3,8 +3,10 @@
 
 #include <QObject>
 #include "screenbuffer.h"
+#include "imagescaler.h"
 
 class ScaledScreenBufferPrivate;
+class PerformanceCounters;
 class QSize;
 class QPoint;
 
@@ -14,6 +16,10 @@ class QPoint;
  *
  * The class also provides functionality to map coordinates in the scaled
  * buffer to coordinates in the source buffer.
+ *
+ * The scaled image is kept between frames and only the areas damaged in the
+ * source buffer are scaled again. If the source buffer already has the
+ * scaled size, the source buffer is passed through as is.
  */
 class ScaledScreenBuffer : public QObject, public ScreenBuffer {
     Q_OBJECT
@@ -22,6 +28,10 @@ public:
     ~ScaledScreenBuffer();
 
     virtual QImage createImage() const;
+    virtual QImage createImage(const QRegion &region) const;
+    virtual QSize size() const;
+    virtual void render(QPainter *painter, const QRect &rect) const;
+    virtual QRegion takeDamage();
 
     /**
      * Scales the screen buffer's dimensions to fit the given @a size.
@@ -36,6 +46,35 @@ public:
      */
     QPoint mapToSource(const QPoint &point) const;
 
+    /**
+     * Maps given @a point in the source screen buffer's image to a point in
+     * this buffer.
+     */
+    QPoint mapFromSource(const QPoint &point) const;
+
+    /**
+     * Sets @a quality of the scaling filter. The default is
+     * ImageScaler::Box, which averages all source pixels covered by a scaled
+     * pixel.
+     */
+    void setScaleQuality(ImageScaler::Quality quality);
+
+    /**
+     * Sets @a counters where time spent in scaling is recorded to.
+     */
+    void setPerformanceCounters(PerformanceCounters *counters);
+
+    /**
+     * Frees the scaled image, which is built again from the source buffer when
+     * the buffer is drawn next time.
+     */
+    void releaseMemory();
+
+    /**
+     * Returns count of bytes allocated for the scaled image.
+     */
+    qint64 memoryUsage() const;
+
 private:
     Q_DECLARE_PRIVATE(ScaledScreenBuffer)
     ScaledScreenBufferPrivate* const d_ptr;
@@ -2,9 +2,18 @@
 #define SCREENBUFFER_H
 
 class QImage;
+class QPainter;
+class QRect;
+class QRegion;
+class QSize;
 
 /**
  * Common interface for screen buffer classes.
+ *
+ * Screen buffers are composed into a pipeline where each buffer draws from
+ * the buffer below it. Painting the pipeline's top buffer with render()
+ * draws only the requested area and does not create intermediate images,
+ * and takeDamage() tells which area needs painting.
  */
 class ScreenBuffer {
 public:
@@ -14,6 +23,30 @@ public:
      * The returned image can also be null in case of error.
      */
     virtual QImage createImage() const = 0;
+
+    /**
+     * Like createImage(), but only the pixels under @a region are guaranteed
+     * to be up to date. Screen buffers which keep their display compressed
+     * or convert it lazily only need to prepare that area.
+     */
+    virtual QImage createImage(const QRegion &region) const = 0;
+
+    /**
+     * Returns size of the screen buffer's display.
+     */
+    virtual QSize size() const = 0;
+
+    /**
+     * Draws area @a rect of the screen buffer's display with @a painter,
+     * so that the display's origin is at the painter's origin.
+     */
+    virtual void render(QPainter *painter, const QRect &rect) const = 0;
+
+    /**
+     * Returns the area of the display which has changed since the previous
+     * call and clears it.
+     */
+    virtual QRegion takeDamage() = 0;
 };
 
 #endif // SCREENBUFFER_H
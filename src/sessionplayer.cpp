@@ -0,0 +1,286 @@
+#include "sessionplayer.h"
+#include "recordingformat.h"
+#include "tilecodec.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QVector>
+#include <string.h>
+
+#define MAX_TILE_SIZE 1024
+
+namespace {
+
+int bytesPerPixel(QImage::Format format) {
+    switch (format) {
+    case QImage::Format_RGB16:
+    case QImage::Format_RGB555:
+        return 2;
+    case QImage::Format_RGB888:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+qint64 paddedSize(qint64 size) {
+    return (size + 7) / 8 * 8;
+}
+
+}
+
+class SessionPlayerPrivate {
+public:
+    SessionPlayerPrivate() : data(nullptr), size(0), tileSize(0), current(-1) {
+    }
+
+    const RecordingFrame *frame(int index) const {
+        return (const RecordingFrame*)(data + index_[index].offset);
+    }
+
+    qint64 frameLength(qint64 offset) const;
+    bool readIndex();
+    void scanFrames();
+    bool decodeFrame(int index);
+
+    QFile file;
+    const uchar *data;
+    qint64 size;
+    int tileSize;
+    QVector<RecordingIndexEntry> index_;
+    int current;
+    QImage image;
+    QByteArray tileBuffer;
+};
+
+qint64 SessionPlayerPrivate::frameLength(qint64 offset) const {
+    // the offset may come from a damaged index, so it is checked without
+    // overflowing and for the alignment of the structures
+    if (offset < (qint64)sizeof(RecordingHeader) || offset % 8 != 0 ||
+            offset > size - (qint64)sizeof(RecordingFrame)) {
+        return -1;
+    }
+    auto frame = (const RecordingFrame*)(data + offset);
+    if (frame->magic != RecordingFrame::Magic) {
+        return -1;
+    }
+
+    qint64 length = sizeof(RecordingFrame);
+    for (quint32 i = 0; i < frame->tileCount; i++) {
+        if (offset + length + (qint64)sizeof(RecordingTile) > size) {
+            return -1;
+        }
+        auto tile = (const RecordingTile*)(data + offset + length);
+        length += sizeof(RecordingTile) + paddedSize(tile->size);
+    }
+    return offset + length <= size ? length : -1;
+}
+
+bool SessionPlayerPrivate::readIndex() {
+    if (size < (qint64)(sizeof(RecordingHeader) + sizeof(RecordingTrailer))) {
+        return false;
+    }
+    auto trailer = (const RecordingTrailer*)(data + size - sizeof(RecordingTrailer));
+    if (trailer->magic != RecordingTrailer::Magic) {
+        return false;
+    }
+
+    // the trailer of a damaged recording may hold anything, so every field
+    // is checked against the file size before the sum of them is
+    qint64 available = size - sizeof(RecordingHeader) - sizeof(RecordingTrailer);
+    if (trailer->frameCount > available / (qint64)sizeof(RecordingIndexEntry)) {
+        return false;
+    }
+    qint64 indexSize = (qint64)trailer->frameCount * sizeof(RecordingIndexEntry);
+    if (trailer->indexOffset < sizeof(RecordingHeader) || trailer->indexOffset % 8 != 0 ||
+            trailer->indexOffset != (quint64)(size - sizeof(RecordingTrailer) - indexSize)) {
+        return false;
+    }
+
+    auto entries = (const RecordingIndexEntry*)(data + trailer->indexOffset);
+    index_.resize(trailer->frameCount);
+    for (quint32 i = 0; i < trailer->frameCount; i++) {
+        // a negative offset after the conversion is beyond the file
+        if (entries[i].offset >= (quint64)size || frameLength(entries[i].offset) < 0) {
+            return false;
+        }
+        index_[i] = entries[i];
+    }
+    return true;
+}
+
+void SessionPlayerPrivate::scanFrames() {
+    index_.clear();
+    qint64 offset = sizeof(RecordingHeader);
+    forever {
+        qint64 length = frameLength(offset);
+        if (length < 0) {
+            break;
+        }
+        RecordingIndexEntry entry;
+        entry.timestamp = ((const RecordingFrame*)(data + offset))->timestamp;
+        entry.offset = offset;
+        index_ << entry;
+        offset += length;
+    }
+}
+
+bool SessionPlayerPrivate::decodeFrame(int index) {
+    auto header = frame(index);
+    QSize frameSize(header->width, header->height);
+    auto format = (QImage::Format)header->format;
+    if (header->flags & RecordingFrame::Keyframe || image.size() != frameSize ||
+            image.format() != format) {
+        image = QImage(frameSize, format);
+        if (image.isNull()) {
+            return false;
+        }
+        image.fill(0);
+    }
+
+    int columns = (frameSize.width() + tileSize - 1) / tileSize;
+    int rows = (frameSize.height() + tileSize - 1) / tileSize;
+    int pixelBytes = bytesPerPixel(format);
+    tileBuffer.resize(tileSize * tileSize * pixelBytes);
+
+    auto position = (const uchar*)(header + 1);
+    for (quint32 i = 0; i < header->tileCount; i++) {
+        auto tile = (const RecordingTile*)position;
+        position += sizeof(RecordingTile);
+        if (tile->column >= columns || tile->row >= rows) {
+            return false;
+        }
+
+        QRect tileRect(tile->column * tileSize, tile->row * tileSize, tileSize, tileSize);
+        tileRect &= image.rect();
+        int stride = tileRect.width() * pixelBytes;
+        // wrapped without copying, the compressed data is in the mapped file
+        auto compressed = QByteArray::fromRawData((const char*)position, tile->size);
+        if (!TileCodec::decompress(compressed, tileBuffer.data(), stride * tileRect.height())) {
+            return false;
+        }
+        for (int y = 0; y < tileRect.height(); y++) {
+            memcpy(image.scanLine(tileRect.top() + y) + tileRect.left() * pixelBytes,
+                tileBuffer.constData() + y * stride, stride);
+        }
+        position += paddedSize(tile->size);
+    }
+    return true;
+}
+
+SessionPlayer::SessionPlayer() : d_ptr(new SessionPlayerPrivate) {
+}
+
+SessionPlayer::~SessionPlayer() {
+    close();
+    delete d_ptr;
+}
+
+bool SessionPlayer::open(const QString &fileName) {
+    Q_D(SessionPlayer);
+    close();
+
+    d->file.setFileName(fileName);
+    if (!d->file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open recording" << fileName << d->file.errorString();
+        return false;
+    }
+    d->size = d->file.size();
+    d->data = d->size >= (qint64)sizeof(RecordingHeader) ? d->file.map(0, d->size) : nullptr;
+    if (!d->data) {
+        close();
+        return false;
+    }
+
+    auto header = (const RecordingHeader*)d->data;
+    char codec[sizeof(header->codec) + 1] = {};
+    memcpy(codec, header->codec, sizeof(header->codec));
+    if (header->magic != RecordingHeader::Magic || header->version != RecordingHeader::Version ||
+            header->tileSize == 0 || header->tileSize > MAX_TILE_SIZE || strcmp(codec, TileCodec::algorithm()) != 0) {
+        qWarning() << "Unsupported recording" << fileName;
+        close();
+        return false;
+    }
+    d->tileSize = header->tileSize;
+
+    if (!d->readIndex()) {
+        d->scanFrames();
+    }
+    return true;
+}
+
+void SessionPlayer::close() {
+    Q_D(SessionPlayer);
+    if (d->data) {
+        d->file.unmap((uchar*)d->data);
+    }
+    d->file.close();
+    d->data = nullptr;
+    d->size = 0;
+    d->index_.clear();
+    d->current = -1;
+    d->image = QImage();
+}
+
+int SessionPlayer::frameCount() const {
+    Q_D(const SessionPlayer);
+    return d->index_.size();
+}
+
+qint64 SessionPlayer::frameTimestamp(int frame) const {
+    Q_D(const SessionPlayer);
+    if (frame < 0 || frame >= d->index_.size()) {
+        return -1;
+    }
+    return d->index_[frame].timestamp;
+}
+
+int SessionPlayer::frameAt(qint64 msecs) const {
+    Q_D(const SessionPlayer);
+    // binary search for the last frame at or before msecs
+    int low = 0;
+    int high = d->index_.size();
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (d->index_[middle].timestamp <= msecs) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low - 1;
+}
+
+bool SessionPlayer::seek(int frame) {
+    Q_D(SessionPlayer);
+    if (frame < 0 || frame >= d->index_.size()) {
+        return false;
+    }
+
+    int keyframe = frame;
+    while (keyframe > 0 && !(d->frame(keyframe)->flags & RecordingFrame::Keyframe)) {
+        keyframe--;
+    }
+    // continuing from the current frame is cheaper than from the keyframe
+    int first = d->current >= keyframe && d->current <= frame ? d->current + 1 : keyframe;
+    for (int i = first; i <= frame; i++) {
+        if (!d->decodeFrame(i)) {
+            qWarning() << "Corrupt frame" << i << "in recording" << d->file.fileName();
+            d->current = -1;
+            d->image = QImage();
+            return false;
+        }
+        d->current = i;
+    }
+    return true;
+}
+
+int SessionPlayer::currentFrame() const {
+    Q_D(const SessionPlayer);
+    return d->current;
+}
+
+QImage SessionPlayer::image() const {
+    Q_D(const SessionPlayer);
+    return d->image;
+}
@@ -0,0 +1,65 @@
+#ifndef SESSIONPLAYER_H
+#define SESSIONPLAYER_H
+
+#include <QImage>
+#include "global.h"
+
+class SessionPlayerPrivate;
+class QString;
+
+/**
+ * The SessionPlayer class plays session recordings made with
+ * RemoteDisplayWidget::startRecording().
+ *
+ * The recording is mapped to memory and frames are decoded on demand.
+ * Seeking decodes the frames from the nearest keyframe before the target
+ * frame, which is at most 100 frames, or continues from the current frame
+ * when seeking forward within the same stretch.
+ */
+class REMOTEDISPLAYSHARED_EXPORT SessionPlayer {
+public:
+    SessionPlayer();
+    ~SessionPlayer();
+
+    /**
+     * Opens recording @a fileName. Returns false if the file cannot be
+     * opened, is not a recording or was recorded with a compression
+     * algorithm which this build does not support. A recording which was
+     * not finished, e.g. because of a crash, is played up to its last
+     * complete frame.
+     */
+    bool open(const QString &fileName);
+    void close();
+
+    int frameCount() const;
+
+    /**
+     * Returns milliseconds from the start of the recording to @a frame.
+     */
+    qint64 frameTimestamp(int frame) const;
+
+    /**
+     * Returns the last frame shown at @a msecs from the start of the
+     * recording.
+     */
+    int frameAt(qint64 msecs) const;
+
+    /**
+     * Decodes @a frame, after which it is returned by image(). Returns false
+     * if the frame does not exist or is corrupt.
+     */
+    bool seek(int frame);
+    int currentFrame() const;
+
+    /**
+     * Returns the current frame in the format it was recorded in.
+     */
+    QImage image() const;
+
+private:
+    Q_DISABLE_COPY(SessionPlayer)
+    Q_DECLARE_PRIVATE(SessionPlayer)
+    SessionPlayerPrivate* const d_ptr;
+};
+
+#endif // SESSIONPLAYER_H
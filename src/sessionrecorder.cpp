@@ -0,0 +1,230 @@
+#include "sessionrecorder.h"
+#include "remotescreenbuffer.h"
+#include "recordingformat.h"
+#include "tilecodec.h"
+#include "tracer.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFuture>
+#include <QImage>
+#include <QRegion>
+#include <QTimer>
+#include <QVector>
+#include <QtConcurrentRun>
+#include <string.h>
+
+#define RECORD_INTERVAL_MSEC 100
+#define KEYFRAME_INTERVAL_FRAMES 100
+#define TILE_SIZE 64
+
+namespace {
+
+int bytesPerPixel(QImage::Format format) {
+    switch (format) {
+    case QImage::Format_RGB16:
+    case QImage::Format_RGB555:
+        return 2;
+    case QImage::Format_RGB888:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+}
+
+class SessionRecorderPrivate {
+public:
+    SessionRecorderPrivate()
+        : source(nullptr), consumer(0), frameFormat(QImage::Format_Invalid),
+          framesSinceKeyframe(0), failed(false) {
+    }
+
+    void recordFrame();
+    bool write(const void *data, qint64 size);
+    void finish();
+
+    RemoteScreenBuffer *source;
+    int consumer;
+    QFile file;
+    QElapsedTimer clock;
+    QSize frameSize;
+    QImage::Format frameFormat;
+    int framesSinceKeyframe;
+    bool failed;
+    QVector<RecordingIndexEntry> index;
+    QByteArray tileBuffer;
+    QFuture<void> recording;
+    QTimer timer;
+};
+
+bool SessionRecorderPrivate::write(const void *data, qint64 size) {
+    if (!failed && file.write((const char*)data, size) != size) {
+        qWarning() << "Cannot write recording" << file.fileName() << file.errorString();
+        failed = true;
+    }
+    return !failed;
+}
+
+void SessionRecorderPrivate::recordFrame() {
+    auto damage = source->takeDamage(consumer);
+    auto size = source->size();
+    auto format = source->format();
+    bool keyframe = size != frameSize || format != frameFormat ||
+        framesSinceKeyframe >= KEYFRAME_INTERVAL_FRAMES;
+    // the first frame is always recorded, the others only when changed
+    if (failed || size.isEmpty() || (damage.isEmpty() && frameSize.isValid())) {
+        return;
+    }
+
+    TRACE_SCOPE("recordFrame");
+    int columns = (size.width() + TILE_SIZE - 1) / TILE_SIZE;
+    int rows = (size.height() + TILE_SIZE - 1) / TILE_SIZE;
+
+    QVector<bool> damagedTiles(columns * rows, keyframe);
+    int tileCount = keyframe ? columns * rows : 0;
+    if (!keyframe) {
+        auto rects = damage.rects();
+        for (int i = 0; i < rects.size(); i++) {
+            auto rect = rects[i] & QRect(QPoint(0, 0), size);
+            for (int row = rect.top() / TILE_SIZE; row <= rect.bottom() / TILE_SIZE; row++) {
+                for (int column = rect.left() / TILE_SIZE; column <= rect.right() / TILE_SIZE; column++) {
+                    if (!damagedTiles[row * columns + column]) {
+                        damagedTiles[row * columns + column] = true;
+                        tileCount++;
+                    }
+                }
+            }
+        }
+    }
+
+    RecordingIndexEntry entry;
+    entry.timestamp = clock.elapsed();
+    entry.offset = file.pos();
+
+    RecordingFrame frame;
+    frame.magic = RecordingFrame::Magic;
+    frame.flags = keyframe ? RecordingFrame::Keyframe : 0;
+    frame.timestamp = entry.timestamp;
+    frame.width = size.width();
+    frame.height = size.height();
+    frame.format = format;
+    frame.tileCount = tileCount;
+    if (!write(&frame, sizeof(frame))) {
+        return;
+    }
+
+    int pixelBytes = bytesPerPixel(format);
+    tileBuffer.resize(TILE_SIZE * TILE_SIZE * pixelBytes);
+    for (int i = 0; i < damagedTiles.size(); i++) {
+        if (!damagedTiles[i]) {
+            continue;
+        }
+        QRect tileRect(i % columns * TILE_SIZE, i / columns * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+        tileRect &= QRect(QPoint(0, 0), size);
+        int stride = tileRect.width() * pixelBytes;
+        source->readPixels(tileRect, (uchar*)tileBuffer.data(), stride);
+        auto compressed = TileCodec::compress(tileBuffer.constData(), stride * tileRect.height());
+
+        RecordingTile tile;
+        tile.column = i % columns;
+        tile.row = i / columns;
+        tile.size = compressed.size();
+        static const char padding[8] = {};
+        write(&tile, sizeof(tile));
+        write(compressed.constData(), compressed.size());
+        write(padding, (8 - compressed.size() % 8) % 8);
+    }
+
+    index << entry;
+    frameSize = size;
+    frameFormat = format;
+    framesSinceKeyframe = keyframe ? 1 : framesSinceKeyframe + 1;
+}
+
+void SessionRecorderPrivate::finish() {
+    if (!file.isOpen()) {
+        return;
+    }
+
+    RecordingTrailer trailer;
+    trailer.indexOffset = file.pos();
+    trailer.frameCount = index.size();
+    trailer.magic = RecordingTrailer::Magic;
+    write(index.constData(), index.size() * sizeof(RecordingIndexEntry));
+    write(&trailer, sizeof(trailer));
+    file.close();
+    index.clear();
+}
+
+SessionRecorder::SessionRecorder(QObject *parent)
+    : QObject(parent), d_ptr(new SessionRecorderPrivate) {
+    Q_D(SessionRecorder);
+    d->timer.setInterval(RECORD_INTERVAL_MSEC);
+    connect(&d->timer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+}
+
+SessionRecorder::~SessionRecorder() {
+    stop();
+    setSource(nullptr);
+    delete d_ptr;
+}
+
+bool SessionRecorder::start(const QString &fileName) {
+    Q_D(SessionRecorder);
+    stop();
+
+    d->file.setFileName(fileName);
+    if (!d->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Cannot open recording" << fileName << d->file.errorString();
+        return false;
+    }
+
+    RecordingHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RecordingHeader::Magic;
+    header.version = RecordingHeader::Version;
+    header.tileSize = TILE_SIZE;
+    strncpy(header.codec, TileCodec::algorithm(), sizeof(header.codec) - 1);
+    d->failed = false;
+    if (!d->write(&header, sizeof(header))) {
+        d->file.close();
+        return false;
+    }
+
+    // the first frame is a keyframe of the whole buffer
+    d->frameSize = QSize();
+    d->framesSinceKeyframe = 0;
+    d->clock.start();
+    d->timer.start();
+    return true;
+}
+
+void SessionRecorder::stop() {
+    Q_D(SessionRecorder);
+    d->timer.stop();
+    d->recording.waitForFinished();
+    d->finish();
+}
+
+void SessionRecorder::setSource(RemoteScreenBuffer *source) {
+    Q_D(SessionRecorder);
+    d->recording.waitForFinished();
+    if (d->source) {
+        d->source->removeDamageConsumer(d->consumer);
+    }
+    d->source = source;
+    if (d->source) {
+        d->consumer = d->source->addDamageConsumer();
+    }
+}
+
+void SessionRecorder::onTimeout() {
+    Q_D(SessionRecorder);
+    // a frame still being written delays the next one
+    if (d->source && !d->recording.isRunning()) {
+        d->recording = QtConcurrent::run(d, &SessionRecorderPrivate::recordFrame);
+    }
+}
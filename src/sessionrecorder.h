@@ -0,0 +1,56 @@
+#ifndef SESSIONRECORDER_H
+#define SESSIONRECORDER_H
+
+#include <QObject>
+
+class SessionRecorderPrivate;
+class RemoteScreenBuffer;
+class QString;
+
+/**
+ * The SessionRecorder class records a remote screen buffer losslessly to a
+ * file, which can be played with SessionPlayer.
+ *
+ * The buffer is divided into tiles and a frame is recorded whenever the
+ * buffer has been damaged, at most 10 times per second. Each frame contains
+ * only the tiles under the damage, except for keyframes, which contain all
+ * tiles and are recorded every 100 frames and when the buffer's size or
+ * format changes. The tiles are compressed with TileCodec. An idle desktop
+ * adds nothing to the file.
+ *
+ * The tiles are read, compressed and written in a background thread, so the
+ * RDP thread is not held up by recording. The file format is described in
+ * recordingformat.h.
+ */
+class SessionRecorder : public QObject {
+    Q_OBJECT
+public:
+    SessionRecorder(QObject *parent = 0);
+    ~SessionRecorder();
+
+    /**
+     * Starts recording to file @a fileName, replacing the file if it
+     * exists. Returns false if the file cannot be opened.
+     */
+    bool start(const QString &fileName);
+
+    /**
+     * Stops recording and finishes the file by writing its index.
+     */
+    void stop();
+
+    /**
+     * Sets the screen buffer to record. The buffer must outlive the recorder
+     * or be replaced before it is destroyed.
+     */
+    void setSource(RemoteScreenBuffer *source);
+
+private slots:
+    void onTimeout();
+
+private:
+    Q_DECLARE_PRIVATE(SessionRecorder)
+    SessionRecorderPrivate* const d_ptr;
+};
+
+#endif // SESSIONRECORDER_H
@@ -0,0 +1,78 @@
+#ifndef SHAREDFRAMERING_H
+#define SHAREDFRAMERING_H
+
+#include <QtGlobal>
+
+/**
+ * Layout of the shared memory ring of frames published with
+ * RemoteDisplayWidget::startFrameExport().
+ *
+ * The shared memory starts with a SharedFrameRingHeader, followed by
+ * slotCount slots of slotSize bytes each, starting at slotsOffset. Each slot
+ * starts with a SharedFrameSlot, and the frame's pixels are at pixelsOffset
+ * from the start of the slot, in rows of stride bytes in the QImage::Format
+ * given by format. Frames are written to the slots in turn, so frame n is in
+ * slot n % slotCount.
+ *
+ * Each slot is guarded by a sequence lock. A reader reads the slot's
+ * sequence, which is odd while the slot is being written, then reads the
+ * frame straight from the shared memory, and finally checks that the
+ * sequence has not changed. If it has, the frame was overwritten meanwhile
+ * and must be read again from the latest slot.
+ *
+ * The pixels of a frame are complete, but a rectangle which was being drawn
+ * when the frame was published may be torn. Its damage is then reported
+ * again in the next frame.
+ */
+struct SharedFrameRingHeader {
+    enum {
+        Magic = 0x52464452, // "RDFR"
+        Version = 1
+    };
+
+    quint32 magic;
+    quint32 version;
+    quint32 slotCount;
+    quint32 reserved;
+    quint64 slotsOffset;
+    quint64 slotSize;
+    /**
+     * Count of frames published so far. The latest frame is in slot
+     * (publishedFrames - 1) % slotCount.
+     */
+    volatile quint64 publishedFrames;
+};
+
+struct SharedFrameRect {
+    qint32 x;
+    qint32 y;
+    qint32 width;
+    qint32 height;
+};
+
+struct SharedFrameSlot {
+    enum {
+        MaxDamageRects = 64
+    };
+
+    /**
+     * Sequence lock of the slot, odd while the slot is being written.
+     */
+    volatile quint64 sequence;
+    quint64 frameNumber;
+    quint64 pixelsOffset;
+    quint32 width;
+    quint32 height;
+    quint32 stride;
+    quint32 format;
+    /**
+     * Count of rects in damageRects, the area changed since the previous
+     * frame. If there are more than MaxDamageRects rects, their bounding
+     * rect is given instead.
+     */
+    quint32 damageRectCount;
+    quint32 reserved;
+    SharedFrameRect damageRects[MaxDamageRects];
+};
+
+#endif // SHAREDFRAMERING_H
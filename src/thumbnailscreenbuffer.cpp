@@ -0,0 +1,201 @@
+#include "thumbnailscreenbuffer.h"
+#include "imagescaler.h"
+#include "performancecounters.h"
+#include "tracer.h"
+
+#include <QImage>
+#include <QPainter>
+#include <QRegion>
+#include <QTransform>
+#include <QVector>
+#include <qmath.h>
+
+class ThumbnailScreenBufferPrivate {
+public:
+    void synchronize() const;
+    void buildPyramid(const QSize &sourceSize) const;
+    static QRect mapRect(const QRect &rect, const QSize &from, const QSize &to);
+
+    ScreenBuffer *sourceBuffer;
+    PerformanceCounters *performanceCounters;
+    QSize thumbnailSize;
+    QTransform coordinateTransform;
+    // source size which the pyramid is built for
+    mutable QSize pyramidSourceSize;
+    mutable QVector<QImage> levels;
+    // one scaler for each level and the last one for the thumbnail
+    mutable QVector<ImageScaler> scalers;
+    mutable QImage thumbnailImage;
+    // damage of the thumbnail not yet taken with takeDamage()
+    mutable QRegion damage;
+};
+
+void ThumbnailScreenBufferPrivate::buildPyramid(const QSize &sourceSize) const {
+    levels.clear();
+    QSize levelSize = sourceSize;
+    forever {
+        QSize next((levelSize.width() + 1) / 2, (levelSize.height() + 1) / 2);
+        if (next.width() < thumbnailSize.width() || next.height() < thumbnailSize.height()) {
+            break;
+        }
+        levels << QImage(next, QImage::Format_RGB32);
+        levelSize = next;
+    }
+
+    scalers.resize(levels.size() + 1);
+    thumbnailImage = QImage(thumbnailSize, QImage::Format_RGB32);
+    pyramidSourceSize = sourceSize;
+}
+
+QRect ThumbnailScreenBufferPrivate::mapRect(const QRect &rect, const QSize &from, const QSize &to) {
+    qreal scaleX = (qreal)to.width() / from.width();
+    qreal scaleY = (qreal)to.height() / from.height();
+    // one extra pixel on each side for the filter kernel's support
+    QPoint topLeft(qFloor(rect.left() * scaleX) - 1, qFloor(rect.top() * scaleY) - 1);
+    QPoint bottomRight(qCeil((rect.right() + 1) * scaleX), qCeil((rect.bottom() + 1) * scaleY));
+    return QRect(topLeft, bottomRight) & QRect(QPoint(0, 0), to);
+}
+
+void ThumbnailScreenBufferPrivate::synchronize() const {
+    auto sourceDamage = sourceBuffer->takeDamage();
+    auto sourceSize = sourceBuffer->size();
+    if (sourceSize.isEmpty() || thumbnailSize.isEmpty()) {
+        return;
+    }
+    if (pyramidSourceSize != sourceSize || thumbnailImage.size() != thumbnailSize) {
+        buildPyramid(sourceSize);
+        sourceDamage = QRect(QPoint(0, 0), sourceSize);
+    }
+    if (sourceDamage.isEmpty()) {
+        return;
+    }
+
+    TRACE_SCOPE("updateThumbnail");
+    LatencyTimer timer(performanceCounters, PerformanceCounters::ScaleLatency);
+
+    // each level is computed from the previous one, only under the damage
+    // propagated from the level above
+    QImage image;
+    auto levelDamage = sourceDamage;
+    for (int i = 0; i <= levels.size(); i++) {
+        auto target = i < levels.size() ? &levels[i] : &thumbnailImage;
+        auto levelSize = i > 0 ? image.size() : sourceSize;
+
+        QRegion targetDamage;
+        auto rects = levelDamage.rects();
+        for (int j = 0; j < rects.size(); j++) {
+            targetDamage += mapRect(rects[j], levelSize, target->size());
+        }
+
+        if (i == 0) {
+            // the source pixels which the filter reads for the damaged area
+            QRegion sourceArea;
+            rects = targetDamage.rects();
+            for (int j = 0; j < rects.size(); j++) {
+                sourceArea += mapRect(rects[j], target->size(), sourceSize);
+            }
+            image = sourceBuffer->createImage(sourceArea);
+        }
+
+        rects = targetDamage.rects();
+        for (int j = 0; j < rects.size(); j++) {
+            scalers[i].scale(image, target, rects[j]);
+        }
+
+        image = *target;
+        levelDamage = targetDamage;
+    }
+    damage += levelDamage;
+}
+
+ThumbnailScreenBuffer::ThumbnailScreenBuffer(ScreenBuffer *source, QObject *parent)
+    : QObject(parent), d_ptr(new ThumbnailScreenBufferPrivate) {
+    Q_D(ThumbnailScreenBuffer);
+    d->sourceBuffer = source;
+    d->performanceCounters = nullptr;
+    Q_ASSERT(d->sourceBuffer);
+}
+
+ThumbnailScreenBuffer::~ThumbnailScreenBuffer() {
+    delete d_ptr;
+}
+
+QImage ThumbnailScreenBuffer::createImage() const {
+    Q_D(const ThumbnailScreenBuffer);
+    d->synchronize();
+    return d->thumbnailImage;
+}
+
+QImage ThumbnailScreenBuffer::createImage(const QRegion &region) const {
+    Q_UNUSED(region);
+    return createImage();
+}
+
+QSize ThumbnailScreenBuffer::size() const {
+    Q_D(const ThumbnailScreenBuffer);
+    return d->thumbnailSize;
+}
+
+void ThumbnailScreenBuffer::render(QPainter *painter, const QRect &rect) const {
+    Q_D(const ThumbnailScreenBuffer);
+    d->synchronize();
+    painter->drawImage(rect.topLeft(), d->thumbnailImage, rect);
+}
+
+QRegion ThumbnailScreenBuffer::takeDamage() {
+    Q_D(ThumbnailScreenBuffer);
+    d->synchronize();
+    QRegion damage = d->damage;
+    d->damage = QRegion();
+    return damage;
+}
+
+void ThumbnailScreenBuffer::scaleToFit(const QSize &size) {
+    Q_D(ThumbnailScreenBuffer);
+    QSize sourceSize = d->sourceBuffer->size();
+    if (!sourceSize.isEmpty()) {
+        d->thumbnailSize = sourceSize;
+        d->thumbnailSize.scale(size, Qt::KeepAspectRatio);
+        // the source may have changed without this buffer pulling its damage,
+        // so the pyramid is built again
+        d->pyramidSourceSize = QSize();
+        d->damage = QRect(QPoint(0, 0), d->thumbnailSize);
+
+        qreal scaleX = (qreal)sourceSize.width() / (qreal)d->thumbnailSize.width();
+        qreal scaleY = (qreal)sourceSize.height() / (qreal)d->thumbnailSize.height();
+        d->coordinateTransform.reset();
+        d->coordinateTransform.scale(scaleX, scaleY);
+    }
+}
+
+QPoint ThumbnailScreenBuffer::mapFromSource(const QPoint &point) const {
+    Q_D(const ThumbnailScreenBuffer);
+    return d->coordinateTransform.inverted().map(point);
+}
+
+QPoint ThumbnailScreenBuffer::mapToSource(const QPoint &point) const {
+    Q_D(const ThumbnailScreenBuffer);
+    return d->coordinateTransform.map(point);
+}
+
+void ThumbnailScreenBuffer::setPerformanceCounters(PerformanceCounters *counters) {
+    Q_D(ThumbnailScreenBuffer);
+    d->performanceCounters = counters;
+}
+
+void ThumbnailScreenBuffer::releaseMemory() {
+    Q_D(ThumbnailScreenBuffer);
+    d->levels.clear();
+    d->thumbnailImage = QImage();
+    // built again on the next synchronize()
+    d->pyramidSourceSize = QSize();
+}
+
+qint64 ThumbnailScreenBuffer::memoryUsage() const {
+    Q_D(const ThumbnailScreenBuffer);
+    qint64 bytes = d->thumbnailImage.byteCount();
+    for (int i = 0; i < d->levels.size(); i++) {
+        bytes += d->levels[i].byteCount();
+    }
+    return bytes;
+}
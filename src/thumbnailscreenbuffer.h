@@ -0,0 +1,79 @@
+#ifndef THUMBNAILSCREENBUFFER_H
+#define THUMBNAILSCREENBUFFER_H
+
+#include <QObject>
+#include "screenbuffer.h"
+
+class ThumbnailScreenBufferPrivate;
+class PerformanceCounters;
+class QPoint;
+class QSize;
+
+/**
+ * The ThumbnailScreenBuffer class is a wrapper which scales given source
+ * screen buffer down to a thumbnail while keeping its aspect ratio.
+ *
+ * The buffer keeps a mipmap pyramid of the source buffer, where each level
+ * is half the size of the previous one (1/2, 1/4, 1/8...), down to the
+ * smallest level which is still larger than the thumbnail. The thumbnail is
+ * scaled from that level. When the source buffer changes, only the pyramid
+ * cells under the damage are computed again, so each change costs about as
+ * much as the damaged area of the source buffer, and an idle source costs
+ * nothing regardless of the thumbnail size.
+ *
+ * The class also provides functionality to map coordinates in the thumbnail
+ * to coordinates in the source buffer.
+ */
+class ThumbnailScreenBuffer : public QObject, public ScreenBuffer {
+    Q_OBJECT
+public:
+    ThumbnailScreenBuffer(ScreenBuffer *source, QObject *parent = 0);
+    ~ThumbnailScreenBuffer();
+
+    virtual QImage createImage() const;
+    virtual QImage createImage(const QRegion &region) const;
+    virtual QSize size() const;
+    virtual void render(QPainter *painter, const QRect &rect) const;
+    virtual QRegion takeDamage();
+
+    /**
+     * Sets size of the thumbnail so that it fits the given @a size while
+     * keeping the aspect ratio of the source buffer.
+     */
+    void scaleToFit(const QSize &size);
+
+    /**
+     * Maps given @a point in the thumbnail to a point in the source screen
+     * buffer's image.
+     */
+    QPoint mapToSource(const QPoint &point) const;
+
+    /**
+     * Maps given @a point in the source screen buffer's image to a point in
+     * this buffer.
+     */
+    QPoint mapFromSource(const QPoint &point) const;
+
+    /**
+     * Sets @a counters where time spent in updating the pyramid is recorded
+     * to.
+     */
+    void setPerformanceCounters(PerformanceCounters *counters);
+
+    /**
+     * Frees the mipmap pyramid and the thumbnail, which is built again from the source buffer when
+     * the buffer is drawn next time.
+     */
+    void releaseMemory();
+
+    /**
+     * Returns count of bytes allocated for the mipmap pyramid and the thumbnail.
+     */
+    qint64 memoryUsage() const;
+
+private:
+    Q_DECLARE_PRIVATE(ThumbnailScreenBuffer)
+    ThumbnailScreenBufferPrivate* const d_ptr;
+};
+
+#endif // THUMBNAILSCREENBUFFER_H
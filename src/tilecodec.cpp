@@ -0,0 +1,50 @@
+#include "tilecodec.h"
+#include "config.h"
+
+#include <string.h>
+
+#ifdef WITH_LZ4
+#include <lz4.h>
+#endif
+
+// fastest zlib level, only used when built without LZ4
+#define ZLIB_COMPRESSION_LEVEL 1
+
+#ifdef WITH_LZ4
+
+QByteArray TileCodec::compress(const char *data, int size) {
+    QByteArray compressed;
+    compressed.resize(LZ4_compressBound(size));
+    int length = LZ4_compress_default(data, compressed.data(), size, compressed.size());
+    // copied so that the worst case bound is not kept allocated
+    return QByteArray(compressed.constData(), length);
+}
+
+bool TileCodec::decompress(const QByteArray &compressed, char *out, int size) {
+    return LZ4_decompress_safe(compressed.constData(), out, compressed.size(), size) == size;
+}
+
+const char *TileCodec::algorithm() {
+    return "lz4";
+}
+
+#else
+
+QByteArray TileCodec::compress(const char *data, int size) {
+    return qCompress((const uchar*)data, size, ZLIB_COMPRESSION_LEVEL);
+}
+
+bool TileCodec::decompress(const QByteArray &compressed, char *out, int size) {
+    auto data = qUncompress(compressed);
+    if (data.size() != size) {
+        return false;
+    }
+    memcpy(out, data.constData(), size);
+    return true;
+}
+
+const char *TileCodec::algorithm() {
+    return "zlib";
+}
+
+#endif // WITH_LZ4
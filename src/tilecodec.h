@@ -0,0 +1,35 @@
+#ifndef TILECODEC_H
+#define TILECODEC_H
+
+#include <QByteArray>
+
+/**
+ * The TileCodec class compresses tiles of screen buffers, e.g. framebuffers
+ * of idle sessions, in memory.
+ *
+ * The tiles are compressed with LZ4 if the library was built with it,
+ * otherwise with zlib through qCompress() at its fastest level. Both keep up
+ * with hundreds of megabytes per second, and desktops, which are mostly
+ * uniform areas and text, compress to a fraction of their size.
+ */
+class TileCodec {
+public:
+    /**
+     * Compresses @a size bytes of @a data.
+     */
+    static QByteArray compress(const char *data, int size);
+
+    /**
+     * Decompresses @a compressed data of a tile to @a out, which must have
+     * room for @a size bytes. Returns false if the data is corrupt or does
+     * not decompress to exactly @a size bytes.
+     */
+    static bool decompress(const QByteArray &compressed, char *out, int size);
+
+    /**
+     * Returns name of the compression algorithm.
+     */
+    static const char *algorithm();
+};
+
+#endif // TILECODEC_H
@@ -0,0 +1,211 @@
+#include "tracer.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+#define RING_SIZE 65536
+#define FLUSH_INTERVAL_MSEC 100
+
+namespace {
+
+struct TraceEvent {
+    const char *name;
+    qint64 start;
+    qint64 duration;
+    quint64 threadId;
+};
+
+struct TraceSlot {
+    QAtomicInt sequence;
+    TraceEvent event;
+};
+
+/**
+ * Bounded multi-producer single-consumer ring buffer of trace events, after
+ * Dmitry Vyukov's bounded MPMC queue. Each slot carries a sequence number
+ * which tells whether the slot is free for the producer at given position or
+ * filled for the consumer.
+ */
+class TraceRing {
+public:
+    TraceRing() : slots(new TraceSlot[RING_SIZE]), dequeuePos(0) {
+        for (int i = 0; i < RING_SIZE; i++) {
+            slots[i].sequence = i;
+        }
+    }
+
+    bool enqueue(const TraceEvent &event) {
+        int pos = enqueuePos;
+        TraceSlot *slot;
+        forever {
+            slot = &slots[pos & (RING_SIZE - 1)];
+            int diff = slot->sequence.fetchAndAddAcquire(0) - pos;
+            if (diff == 0) {
+                if (enqueuePos.testAndSetRelaxed(pos, pos + 1)) {
+                    break;
+                }
+                pos = enqueuePos;
+            } else if (diff < 0) {
+                // full, the writer thread has not caught up
+                return false;
+            } else {
+                pos = enqueuePos;
+            }
+        }
+        slot->event = event;
+        slot->sequence.fetchAndStoreRelease(pos + 1);
+        return true;
+    }
+
+    bool dequeue(TraceEvent *event) {
+        auto slot = &slots[dequeuePos & (RING_SIZE - 1)];
+        if (slot->sequence.fetchAndAddAcquire(0) != dequeuePos + 1) {
+            return false;
+        }
+        *event = slot->event;
+        slot->sequence.fetchAndStoreRelease(dequeuePos + RING_SIZE);
+        dequeuePos++;
+        return true;
+    }
+
+private:
+    TraceSlot *slots;
+    QAtomicInt enqueuePos;
+    int dequeuePos;
+};
+
+class TraceWriter : public QThread {
+public:
+    TraceWriter(QFile *file) : file(file), firstEvent(true) {
+    }
+
+    void requestStop() {
+        stopRequested = 1;
+    }
+
+protected:
+    virtual void run() {
+        file->write("[\n");
+        while (!stopRequested) {
+            flush();
+            msleep(FLUSH_INTERVAL_MSEC);
+        }
+        flush();
+        file->write("\n]\n");
+        file->close();
+    }
+
+private:
+    void flush();
+
+    QFile *file;
+    bool firstEvent;
+    QAtomicInt stopRequested;
+};
+
+TraceRing *ring = nullptr;
+QElapsedTimer clock;
+QMutex controlMutex;
+QFile *traceFile = nullptr;
+TraceWriter *writer = nullptr;
+QAtomicInt droppedEvents;
+
+void TraceWriter::flush() {
+    TraceEvent event;
+    while (ring->dequeue(&event)) {
+        auto line = QString("%1{\"name\":\"%2\",\"cat\":\"remotedisplay\",\"ph\":\"X\","
+            "\"ts\":%3,\"dur\":%4,\"pid\":%5,\"tid\":%6}")
+            .arg(firstEvent ? "" : ",\n")
+            .arg(event.name)
+            .arg(event.start / 1000.0, 0, 'f', 3)
+            .arg(event.duration / 1000.0, 0, 'f', 3)
+            .arg(QCoreApplication::applicationPid())
+            .arg(event.threadId);
+        file->write(line.toLatin1());
+        firstEvent = false;
+    }
+}
+
+}
+
+volatile bool Tracer::enabled = false;
+
+bool Tracer::start(const QString &fileName) {
+#ifdef WITH_TRACING
+    QMutexLocker locker(&controlMutex);
+    if (writer) {
+        qWarning() << "Tracing already started";
+        return false;
+    }
+
+    traceFile = new QFile(fileName);
+    if (!traceFile->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed to open trace file" << fileName;
+        delete traceFile;
+        traceFile = nullptr;
+        return false;
+    }
+
+    if (!ring) {
+        // the ring is never freed, as spans started before stop() may still
+        // be pushed to it after stopping
+        ring = new TraceRing;
+        clock.start();
+    }
+
+    // discard spans left over from previous trace
+    TraceEvent event;
+    while (ring->dequeue(&event)) {
+    }
+
+    droppedEvents = 0;
+    writer = new TraceWriter(traceFile);
+    writer->start(QThread::LowPriority);
+    enabled = true;
+    return true;
+#else
+    Q_UNUSED(fileName);
+    qWarning() << "Tracing support is not compiled in, build with WITH_TRACING enabled";
+    return false;
+#endif
+}
+
+void Tracer::stop() {
+    QMutexLocker locker(&controlMutex);
+    if (!writer) {
+        return;
+    }
+    enabled = false;
+
+    writer->requestStop();
+    writer->wait();
+    delete writer;
+    writer = nullptr;
+    delete traceFile;
+    traceFile = nullptr;
+
+    if (droppedEvents > 0) {
+        qWarning() << "Trace ring buffer overflowed," << (int)droppedEvents << "spans were dropped";
+    }
+}
+
+qint64 Tracer::now() {
+    return clock.nsecsElapsed();
+}
+
+void Tracer::addSpan(const char *name, qint64 start, qint64 duration) {
+    TraceEvent event;
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    event.threadId = (quint64)(quintptr)QThread::currentThreadId();
+    if (!ring->enqueue(event)) {
+        droppedEvents.fetchAndAddRelaxed(1);
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "config.h"
+#include <QtGlobal>
+
+class QString;
+
+/**
+ * The Tracer class records timed spans of the update and render pipeline and
+ * writes them to a file in Chrome's trace event format, which can be viewed
+ * with chrome://tracing or Perfetto.
+ *
+ * Spans are recorded with the TRACE_SCOPE() macro. Recording pushes the span
+ * to a lock-free ring buffer, from where a background thread writes them to
+ * the file. If the ring buffer is full, the span is dropped instead of
+ * blocking the recording thread.
+ *
+ * Tracing is compiled in only if WITH_TRACING is defined, otherwise
+ * TRACE_SCOPE() expands to nothing. When compiled in but not started, the cost
+ * of a span is a single check of a flag.
+ */
+class Tracer {
+public:
+    /**
+     * Starts writing trace events to file @a fileName. Returns false if the
+     * file cannot be opened or if tracing is not compiled in.
+     */
+    static bool start(const QString &fileName);
+
+    /**
+     * Stops tracing and finishes writing the trace file.
+     */
+    static void stop();
+
+    static bool isEnabled() {
+        return enabled;
+    }
+
+    /**
+     * Returns current time in nanoseconds on the tracer's clock.
+     */
+    static qint64 now();
+
+    /**
+     * Adds complete span with @a name which started at @a start and lasted
+     * @a duration nanoseconds. The @a name must be a string literal.
+     */
+    static void addSpan(const char *name, qint64 start, qint64 duration);
+
+private:
+    static volatile bool enabled;
+};
+
+/**
+ * The TraceScope class records a span from its construction to its
+ * destruction. Use through TRACE_SCOPE() macro.
+ */
+class TraceScope {
+public:
+    TraceScope(const char *name) : name(name), start(-1) {
+        if (Tracer::isEnabled()) {
+            start = Tracer::now();
+        }
+    }
+
+    ~TraceScope() {
+        if (start >= 0) {
+            Tracer::addSpan(name, start, Tracer::now() - start);
+        }
+    }
+
+private:
+    const char *name;
+    qint64 start;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#ifdef WITH_TRACING
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+#endif // TRACER_H
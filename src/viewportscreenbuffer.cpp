@@ -0,0 +1,126 @@
+#include "viewportscreenbuffer.h"
+
+#include <QImage>
+#include <QPainter>
+#include <QRegion>
+
+class ViewportScreenBufferPrivate {
+public:
+    QPoint boundedOffset(const QPoint &offset) const;
+
+    ScreenBuffer *sourceBuffer;
+    QSize size;
+    QPoint offset;
+    // damage of the buffer not yet taken with takeDamage()
+    QRegion damage;
+};
+
+QPoint ViewportScreenBufferPrivate::boundedOffset(const QPoint &offset) const {
+    auto sourceSize = sourceBuffer->size();
+    int maxX = qMax(0, sourceSize.width() - size.width());
+    int maxY = qMax(0, sourceSize.height() - size.height());
+    return QPoint(qBound(0, offset.x(), maxX), qBound(0, offset.y(), maxY));
+}
+
+ViewportScreenBuffer::ViewportScreenBuffer(ScreenBuffer *source, QObject *parent)
+    : QObject(parent), d_ptr(new ViewportScreenBufferPrivate) {
+    Q_D(ViewportScreenBuffer);
+    d->sourceBuffer = source;
+    Q_ASSERT(d->sourceBuffer);
+}
+
+ViewportScreenBuffer::~ViewportScreenBuffer() {
+    delete d_ptr;
+}
+
+QImage ViewportScreenBuffer::createImage() const {
+    Q_D(const ViewportScreenBuffer);
+    if (!d->size.isEmpty()) {
+        QImage image(d->size, QImage::Format_ARGB32_Premultiplied);
+        QPainter painter(&image);
+        render(&painter, image.rect());
+        return image;
+    }
+    return QImage();
+}
+
+QImage ViewportScreenBuffer::createImage(const QRegion &region) const {
+    Q_UNUSED(region);
+    return createImage();
+}
+
+QSize ViewportScreenBuffer::size() const {
+    Q_D(const ViewportScreenBuffer);
+    return d->size;
+}
+
+void ViewportScreenBuffer::render(QPainter *painter, const QRect &rect) const {
+    Q_D(const ViewportScreenBuffer);
+    // part of the viewport covered by the source buffer, which always starts
+    // from the viewport's top left corner
+    QRect visible(QPoint(0, 0), d->sourceBuffer->size() - QSize(d->offset.x(), d->offset.y()));
+    visible &= QRect(QPoint(0, 0), d->size);
+
+    auto right = QRect(visible.right() + 1, 0, d->size.width() - visible.width(), d->size.height()) & rect;
+    auto bottom = QRect(0, visible.bottom() + 1, visible.width(), d->size.height() - visible.height()) & rect;
+    if (!right.isEmpty()) {
+        painter->fillRect(right, Qt::black);
+    }
+    if (!bottom.isEmpty()) {
+        painter->fillRect(bottom, Qt::black);
+    }
+
+    auto sourcePart = visible & rect;
+    if (!sourcePart.isEmpty()) {
+        painter->translate(-d->offset);
+        d->sourceBuffer->render(painter, sourcePart.translated(d->offset));
+        painter->translate(d->offset);
+    }
+}
+
+QRegion ViewportScreenBuffer::takeDamage() {
+    Q_D(ViewportScreenBuffer);
+    QRegion damage = d->damage;
+    auto sourceDamage = d->sourceBuffer->takeDamage();
+    if (!sourceDamage.isEmpty()) {
+        // damage outside of the viewport is dropped here
+        damage += sourceDamage.translated(-d->offset) & QRect(QPoint(0, 0), d->size);
+    }
+    d->damage = QRegion();
+    return damage;
+}
+
+QPoint ViewportScreenBuffer::mapFromSource(const QPoint &point) const {
+    Q_D(const ViewportScreenBuffer);
+    return point - d->offset;
+}
+
+QPoint ViewportScreenBuffer::mapToSource(const QPoint &point) const {
+    Q_D(const ViewportScreenBuffer);
+    auto sourceSize = d->sourceBuffer->size();
+    QPoint p = point + d->offset;
+    p.setX(qBound(0, p.x(), sourceSize.width() - 1));
+    p.setY(qBound(0, p.y(), sourceSize.height() - 1));
+    return p;
+}
+
+void ViewportScreenBuffer::resize(const QSize &size) {
+    Q_D(ViewportScreenBuffer);
+    d->size = size;
+    d->offset = d->boundedOffset(d->offset);
+    d->damage = QRect(QPoint(0, 0), size);
+}
+
+void ViewportScreenBuffer::setOffset(const QPoint &offset) {
+    Q_D(ViewportScreenBuffer);
+    auto bounded = d->boundedOffset(offset);
+    if (bounded != d->offset) {
+        d->offset = bounded;
+        d->damage = QRect(QPoint(0, 0), d->size);
+    }
+}
+
+QPoint ViewportScreenBuffer::offset() const {
+    Q_D(const ViewportScreenBuffer);
+    return d->offset;
+}
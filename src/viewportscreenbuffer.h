@@ -0,0 +1,63 @@
+#ifndef VIEWPORTSCREENBUFFER_H
+#define VIEWPORTSCREENBUFFER_H
+
+#include <QObject>
+#include "screenbuffer.h"
+
+class ViewportScreenBufferPrivate;
+class QPoint;
+class QSize;
+
+/**
+ * The ViewportScreenBuffer class is a wrapper which shows a part of the
+ * source buffer in 1:1 scale. The position of the viewport in the source
+ * buffer is set with setOffset().
+ *
+ * Only the visible part of the source buffer is ever drawn, so the cost of
+ * the viewport depends on its size and not on the source buffer's size.
+ * Areas outside of the source buffer are filled with black.
+ *
+ * The class also provides functionality to map coordinates in this buffer
+ * to coordinates in the source buffer.
+ */
+class ViewportScreenBuffer : public QObject, public ScreenBuffer {
+    Q_OBJECT
+public:
+    ViewportScreenBuffer(ScreenBuffer *source, QObject *parent = 0);
+    ~ViewportScreenBuffer();
+
+    virtual QImage createImage() const;
+    virtual QImage createImage(const QRegion &region) const;
+    virtual QSize size() const;
+    virtual void render(QPainter *painter, const QRect &rect) const;
+    virtual QRegion takeDamage();
+
+    /**
+     * Maps given @a point in this buffer to a point in the source buffer.
+     */
+    QPoint mapToSource(const QPoint &point) const;
+
+    /**
+     * Maps given @a point in the source buffer to a point in this buffer.
+     */
+    QPoint mapFromSource(const QPoint &point) const;
+
+    /**
+     * Resizes the viewport to @a size. The whole buffer is damaged.
+     */
+    void resize(const QSize &size);
+
+    /**
+     * Moves the viewport's top left corner to @a offset in the source
+     * buffer. The offset is limited so that the viewport stays within the
+     * source buffer when possible.
+     */
+    void setOffset(const QPoint &offset);
+    QPoint offset() const;
+
+private:
+    Q_DECLARE_PRIVATE(ViewportScreenBuffer)
+    ViewportScreenBufferPrivate* const d_ptr;
+};
+
+#endif // VIEWPORTSCREENBUFFER_H
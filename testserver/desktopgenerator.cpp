@@ -0,0 +1,77 @@
+#include "desktopgenerator.h"
+
+#include <QPainter>
+#include <QLinearGradient>
+
+#define BOX_SIZE 128
+#define MARKER_SIZE 16
+#define KEY_INDICATOR_SIZE 32
+
+DesktopGenerator::DesktopGenerator(int width, int height)
+    : desktop(width, height, QImage::Format_RGB16),
+      box(0, 0, BOX_SIZE, BOX_SIZE), velocity(7, 5),
+      keyIndicatorToggled(false), keyIndicatorOn(false) {
+    QPainter painter(&desktop);
+    paintBackground(&painter, desktop.rect());
+}
+
+const QImage &DesktopGenerator::image() const {
+    return desktop;
+}
+
+QRegion DesktopGenerator::advance() {
+    QRegion damage;
+    QPainter painter(&desktop);
+
+    // erase the box from its old position and move it, bouncing off the
+    // edges of the desktop
+    auto oldBox = box;
+    paintBackground(&painter, oldBox);
+    box.translate(velocity);
+    if (box.left() < 0 || box.right() >= desktop.width()) {
+        velocity.setX(-velocity.x());
+        box.translate(2 * velocity.x(), 0);
+    }
+    if (box.top() < 0 || box.bottom() >= desktop.height()) {
+        velocity.setY(-velocity.y());
+        box.translate(0, 2 * velocity.y());
+    }
+    painter.fillRect(box, Qt::red);
+    damage += oldBox;
+    damage += box;
+
+    foreach (auto pos, pendingMarkers) {
+        QRect marker(0, 0, MARKER_SIZE, MARKER_SIZE);
+        marker.moveCenter(pos);
+        marker &= desktop.rect();
+        painter.fillRect(marker, Qt::yellow);
+        damage += marker;
+    }
+    pendingMarkers.clear();
+
+    if (keyIndicatorToggled) {
+        QRect indicator(desktop.width() - KEY_INDICATOR_SIZE, 0,
+            KEY_INDICATOR_SIZE, KEY_INDICATOR_SIZE);
+        painter.fillRect(indicator, keyIndicatorOn ? Qt::green : Qt::black);
+        damage += indicator;
+        keyIndicatorToggled = false;
+    }
+
+    return damage & desktop.rect();
+}
+
+void DesktopGenerator::addMarker(const QPoint &pos) {
+    pendingMarkers << pos;
+}
+
+void DesktopGenerator::toggleKeyIndicator() {
+    keyIndicatorOn = !keyIndicatorOn;
+    keyIndicatorToggled = true;
+}
+
+void DesktopGenerator::paintBackground(QPainter *painter, const QRect &rect) {
+    QLinearGradient gradient(0, 0, desktop.width(), desktop.height());
+    gradient.setColorAt(0, Qt::darkBlue);
+    gradient.setColorAt(1, Qt::darkCyan);
+    painter->fillRect(rect, gradient);
+}
@@ -0,0 +1,57 @@
+#ifndef DESKTOPGENERATOR_H
+#define DESKTOPGENERATOR_H
+
+#include <QImage>
+#include <QRegion>
+#include <QList>
+#include <QPoint>
+
+class QPainter;
+
+/**
+ * The DesktopGenerator class produces synthetic desktop content for the test
+ * server.
+ *
+ * The desktop consists of a static gradient background, a box bouncing around
+ * the screen and markers painted at positions where the client has pressed
+ * mouse buttons. Each call to advance() moves the animation one frame forward
+ * and returns the region which changed, so only that needs to be sent.
+ */
+class DesktopGenerator {
+public:
+    DesktopGenerator(int width, int height);
+
+    /**
+     * Returns the current desktop image in RGB16 format.
+     */
+    const QImage &image() const;
+
+    /**
+     * Advances the animation by one frame and returns the damaged region.
+     */
+    QRegion advance();
+
+    /**
+     * Paints a marker at @a pos which is shown on the next frame. Used to
+     * give immediate visual feedback for input round-trip measurements.
+     */
+    void addMarker(const QPoint &pos);
+
+    /**
+     * Toggles color of a small area in the corner of the desktop. Used as
+     * feedback for keyboard input.
+     */
+    void toggleKeyIndicator();
+
+private:
+    void paintBackground(QPainter *painter, const QRect &rect);
+
+    QImage desktop;
+    QRect box;
+    QPoint velocity;
+    QList<QPoint> pendingMarkers;
+    bool keyIndicatorToggled;
+    bool keyIndicatorOn;
+};
+
+#endif // DESKTOPGENERATOR_H
@@ -0,0 +1,105 @@
+#include <QApplication>
+#include <QStringList>
+#include <QDebug>
+#include <freerdp/listener.h>
+
+#include <sys/select.h>
+#include <errno.h>
+
+#include "testpeer.h"
+
+namespace {
+
+TestServerSettings settings;
+
+void peerAccepted(freerdp_listener *instance, freerdp_peer *client) {
+    auto peer = new TestPeer(client, settings);
+    QObject::connect(peer, SIGNAL(finished()), peer, SLOT(deleteLater()));
+    peer->start();
+}
+
+bool waitForConnections(freerdp_listener *listener) {
+    int rcount = 0;
+    void* rfds[32];
+    memset(rfds, 0, sizeof(rfds));
+
+    if (!listener->GetFileDescriptor(listener, rfds, &rcount)) {
+        qWarning() << "Failed to get listener file descriptor";
+        return false;
+    }
+
+    int maxFd = 0;
+    fd_set rfdsSet;
+    FD_ZERO(&rfdsSet);
+    for (int i = 0; i < rcount; i++) {
+        int fd = (int)(long)(rfds[i]);
+        maxFd = qMax(maxFd, fd);
+        FD_SET(fd, &rfdsSet);
+    }
+    if (maxFd == 0) {
+        return false;
+    }
+
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 100 * 1000;
+    if (select(maxFd + 1, &rfdsSet, NULL, NULL, &timeout) == -1) {
+        if (!(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS || errno == EINTR)) {
+            qWarning() << "select failed";
+            return false;
+        }
+    }
+
+    return listener->CheckFileDescriptor(listener);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    // QPainter is used for generating the desktop, but no windows are shown
+    QApplication a(argc, argv, false);
+
+    auto args = a.arguments();
+    args.removeFirst();
+    quint16 port = 3389;
+
+    while (!args.isEmpty()) {
+        auto arg = args.takeFirst();
+        if (arg == "--cert" && !args.isEmpty()) {
+            settings.certificateFile = args.takeFirst();
+        } else if (arg == "--key" && !args.isEmpty()) {
+            settings.keyFile = args.takeFirst();
+        } else if (arg == "--fps" && !args.isEmpty()) {
+            settings.framesPerSecond = args.takeFirst().toInt();
+        } else if (arg == "--no-audio") {
+            settings.audioEnabled = false;
+        } else if (arg == "--no-pointer") {
+            settings.pointerEnabled = false;
+        } else if (!arg.startsWith("--")) {
+            port = arg.toInt();
+        } else {
+            qCritical("Usage: RemoteDisplayTestServer [--cert <file>] [--key <file>] "
+                "[--fps <frames per second>] [--no-audio] [--no-pointer] [port]");
+            return -1;
+        }
+    }
+
+    auto listener = freerdp_listener_new();
+    listener->PeerAccepted = peerAccepted;
+
+    if (!listener->Open(listener, NULL, port)) {
+        qCritical() << "Failed to listen on port" << port;
+        freerdp_listener_free(listener);
+        return -1;
+    }
+    qDebug() << "Listening on port" << port;
+
+    while (waitForConnections(listener)) {
+        // deletes finished peers
+        QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+    }
+
+    listener->Close(listener);
+    freerdp_listener_free(listener);
+    return 0;
+}
@@ -0,0 +1,443 @@
+#include "testpeer.h"
+#include "desktopgenerator.h"
+
+#include <freerdp/channels/wtsvc.h>
+#include <freerdp/codec/audio.h>
+#include <freerdp/input.h>
+
+#include <QDebug>
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include <qmath.h>
+
+#include <sys/select.h>
+#include <errno.h>
+
+#define TILE_SIZE 64
+#define TILES_PER_UPDATE 16
+#define POINTER_SIZE 32
+#define POINTER_COUNT 2
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_CHANNELS 2
+#define AUDIO_CHUNK_MSEC 20
+#define AUDIO_TONE_HZ 440.0
+
+namespace {
+
+struct TestPeerContext {
+    rdpContext context;
+    TestPeer *self;
+    WTSVirtualChannelManager *vcm;
+    RdpsndServerContext *rdpsnd;
+};
+
+TestPeerContext* getPeerContext(rdpContext *context) {
+    return reinterpret_cast<TestPeerContext*>(context);
+}
+
+TestPeerContext* getPeerContext(freerdp_peer *client) {
+    return getPeerContext(client->context);
+}
+
+AUDIO_FORMAT audioFormats[] = {
+    { WAVE_FORMAT_PCM, AUDIO_CHANNELS, AUDIO_SAMPLE_RATE,
+      AUDIO_SAMPLE_RATE * AUDIO_CHANNELS * 2, AUDIO_CHANNELS * 2, 16, 0, NULL }
+};
+
+/**
+ * Builds a 24 bpp pointer image and its AND mask in the bottom-up layout
+ * expected by the RDP pointer updates. Pointer 0 is a filled square and
+ * pointer 1 is a cross.
+ */
+void buildPointer(int index, QByteArray *xorMask, QByteArray *andMask) {
+    int xorStride = POINTER_SIZE * 3;
+    int andStride = POINTER_SIZE / 8;
+    xorMask->fill(0, xorStride * POINTER_SIZE);
+    andMask->fill(0xff, andStride * POINTER_SIZE);
+
+    for (int y = 0; y < POINTER_SIZE; y++) {
+        int row = POINTER_SIZE - 1 - y;
+        for (int x = 0; x < POINTER_SIZE; x++) {
+            bool opaque = index == 0 ?
+                (x < POINTER_SIZE / 2 && y < POINTER_SIZE / 2) :
+                (qAbs(x - POINTER_SIZE / 2) < 2 || qAbs(y - POINTER_SIZE / 2) < 2);
+            if (!opaque) {
+                continue;
+            }
+            andMask->data()[row * andStride + x / 8] &= ~(0x80 >> (x % 8));
+            memset(xorMask->data() + row * xorStride + x * 3, index == 0 ? 0xff : 0x00, 3);
+        }
+    }
+}
+
+void sendTiles(freerdp_peer *client, QVector<BITMAP_DATA> *tiles) {
+    if (tiles->isEmpty()) {
+        return;
+    }
+    BITMAP_UPDATE update;
+    memset(&update, 0, sizeof(update));
+    update.count = update.number = tiles->size();
+    update.rectangles = tiles->data();
+    client->update->BitmapUpdate(client->context, &update);
+    tiles->clear();
+}
+
+}
+
+TestServerSettings::TestServerSettings()
+    : certificateFile("server.crt"), keyFile("server.key"),
+      framesPerSecond(30), audioEnabled(true), pointerEnabled(true) {
+}
+
+TestPeer::TestPeer(freerdp_peer *client, const TestServerSettings &settings, QObject *parent)
+    : QThread(parent), client(client), settings(settings), generator(nullptr),
+      activated(false), outputSuppressed(false), audioActivated(false),
+      pointerIndex(0), audioPhase(0), audioFramesSent(0), framesSent(0),
+      rectanglesSent(0), bytesSent(0), inputEventsReceived(0) {
+    connectTimer.start();
+
+    client->ContextSize = sizeof(TestPeerContext);
+    client->ContextNew = ContextNewCallback;
+    client->ContextFree = ContextFreeCallback;
+    freerdp_peer_context_new(client);
+    getPeerContext(client)->self = this;
+
+    auto clientSettings = client->settings;
+    clientSettings->CertificateFile = _strdup(settings.certificateFile.toLocal8Bit().data());
+    clientSettings->PrivateKeyFile = _strdup(settings.keyFile.toLocal8Bit().data());
+    clientSettings->RdpKeyFile = _strdup(settings.keyFile.toLocal8Bit().data());
+    clientSettings->NlaSecurity = FALSE;
+    clientSettings->RemoteFxCodec = FALSE;
+    clientSettings->NSCodec = FALSE;
+    clientSettings->ColorDepth = 16;
+    clientSettings->SuppressOutput = TRUE;
+    clientSettings->RefreshRect = TRUE;
+
+    client->PostConnect = PostConnectCallback;
+    client->Activate = ActivateCallback;
+    client->input->KeyboardEvent = KeyboardEventCallback;
+    client->input->MouseEvent = MouseEventCallback;
+    client->update->RefreshRect = RefreshRectCallback;
+    client->update->SuppressOutput = SuppressOutputCallback;
+}
+
+TestPeer::~TestPeer() {
+    freerdp_peer_context_free(client);
+    freerdp_peer_free(client);
+    delete generator;
+}
+
+void TestPeer::run() {
+    client->Initialize(client);
+    qDebug() << "Client connected from" << client->hostname;
+
+    int frameInterval = 1000 / qMax(settings.framesPerSecond, 1);
+    frameTimer.start();
+    statisticsTimer.start();
+
+    forever {
+        int timeout = activated ? qMax(frameInterval - (int)frameTimer.elapsed(), 0) : 1000;
+        if (audioActivated) {
+            timeout = qMin(timeout, AUDIO_CHUNK_MSEC / 2);
+        }
+        if (!waitForEvents(timeout)) {
+            break;
+        }
+        if (!activated) {
+            continue;
+        }
+
+        if (frameTimer.elapsed() >= frameInterval) {
+            frameTimer.restart();
+            sendFrame();
+        }
+        sendAudio();
+
+        if (statisticsTimer.elapsed() >= 1000) {
+            printStatistics();
+            sendPointers();
+            statisticsTimer.restart();
+        }
+    }
+
+    qDebug() << "Client disconnected";
+    client->Disconnect(client);
+}
+
+bool TestPeer::waitForEvents(int timeout) {
+    int rcount = 0;
+    void* rfds[32];
+    memset(rfds, 0, sizeof(rfds));
+
+    auto vcm = getPeerContext(client)->vcm;
+    if (!client->GetFileDescriptor(client, rfds, &rcount)) {
+        qWarning() << "Failed to get peer file descriptor";
+        return false;
+    }
+    WTSVirtualChannelManagerGetFileDescriptor(vcm, rfds, &rcount);
+
+    int maxFd = 0;
+    fd_set rfdsSet;
+    FD_ZERO(&rfdsSet);
+    for (int i = 0; i < rcount; i++) {
+        int fd = (int)(long)(rfds[i]);
+        maxFd = qMax(maxFd, fd);
+        FD_SET(fd, &rfdsSet);
+    }
+    if (maxFd == 0) {
+        return false;
+    }
+
+    timeval tv;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    if (select(maxFd + 1, &rfdsSet, NULL, NULL, &tv) == -1) {
+        if (!(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS || errno == EINTR)) {
+            qWarning() << "select failed";
+            return false;
+        }
+    }
+
+    if (!client->CheckFileDescriptor(client)) {
+        return false;
+    }
+    if (!WTSVirtualChannelManagerCheckFileDescriptor(vcm)) {
+        return false;
+    }
+    return true;
+}
+
+void TestPeer::sendFrame() {
+    pendingRefresh += generator->advance();
+    if (outputSuppressed || pendingRefresh.isEmpty()) {
+        return;
+    }
+
+    sendRegion(pendingRefresh);
+    pendingRefresh = QRegion();
+    framesSent++;
+}
+
+void TestPeer::sendRegion(const QRegion &region) {
+    auto image = generator->image();
+    QVector<BITMAP_DATA> tiles;
+    QList<QByteArray> tileData;
+
+    foreach (auto rect, region.rects()) {
+        for (int ty = rect.top(); ty <= rect.bottom(); ty += TILE_SIZE) {
+            for (int tx = rect.left(); tx <= rect.right(); tx += TILE_SIZE) {
+                QRect tile(tx, ty, qMin(TILE_SIZE, rect.right() - tx + 1),
+                    qMin(TILE_SIZE, rect.bottom() - ty + 1));
+
+                // uncompressed bitmaps are sent bottom-up with rows padded
+                // to four bytes
+                int stride = (tile.width() * 2 + 3) & ~3;
+                QByteArray data(stride * tile.height(), 0);
+                for (int y = 0; y < tile.height(); y++) {
+                    memcpy(data.data() + (tile.height() - 1 - y) * stride,
+                        image.constScanLine(tile.top() + y) + tile.left() * 2,
+                        tile.width() * 2);
+                }
+                tileData << data;
+
+                BITMAP_DATA bitmap;
+                memset(&bitmap, 0, sizeof(bitmap));
+                bitmap.destLeft = tile.left();
+                bitmap.destTop = tile.top();
+                bitmap.destRight = tile.right();
+                bitmap.destBottom = tile.bottom();
+                bitmap.width = tile.width();
+                bitmap.height = tile.height();
+                bitmap.bitsPerPixel = 16;
+                bitmap.compressed = FALSE;
+                bitmap.bitmapLength = data.size();
+                bitmap.bitmapDataStream = (BYTE*)tileData.last().data();
+                tiles << bitmap;
+
+                rectanglesSent++;
+                bytesSent += data.size();
+
+                if (tiles.size() == TILES_PER_UPDATE) {
+                    sendTiles(client, &tiles);
+                    tileData.clear();
+                }
+            }
+        }
+    }
+    sendTiles(client, &tiles);
+}
+
+void TestPeer::sendPointers() {
+    if (!settings.pointerEnabled) {
+        return;
+    }
+    auto pointer = client->update->pointer;
+
+    if (pointerIndex < POINTER_COUNT) {
+        // send each pointer once as new pointer, after that switch between
+        // them with cached pointer updates
+        QByteArray xorMask, andMask;
+        buildPointer(pointerIndex, &xorMask, &andMask);
+
+        POINTER_NEW_UPDATE update;
+        memset(&update, 0, sizeof(update));
+        update.xorBpp = 24;
+        update.colorPtrAttr.cacheIndex = pointerIndex;
+        update.colorPtrAttr.xPos = POINTER_SIZE / 2;
+        update.colorPtrAttr.yPos = POINTER_SIZE / 2;
+        update.colorPtrAttr.width = POINTER_SIZE;
+        update.colorPtrAttr.height = POINTER_SIZE;
+        update.colorPtrAttr.lengthXorMask = xorMask.size();
+        update.colorPtrAttr.lengthAndMask = andMask.size();
+        update.colorPtrAttr.xorMaskData = (BYTE*)xorMask.data();
+        update.colorPtrAttr.andMaskData = (BYTE*)andMask.data();
+        pointer->PointerNew(client->context, &update);
+    } else {
+        POINTER_CACHED_UPDATE update;
+        update.cacheIndex = pointerIndex % POINTER_COUNT;
+        pointer->PointerCached(client->context, &update);
+    }
+    pointerIndex++;
+}
+
+void TestPeer::sendAudio() {
+    if (!audioActivated) {
+        return;
+    }
+    auto rdpsnd = getPeerContext(client)->rdpsnd;
+
+    // keep one chunk ahead of real time
+    qint64 due = (audioTimer.elapsed() + AUDIO_CHUNK_MSEC) * AUDIO_SAMPLE_RATE / 1000;
+    int chunkFrames = AUDIO_SAMPLE_RATE * AUDIO_CHUNK_MSEC / 1000;
+    QVector<qint16> samples(chunkFrames * AUDIO_CHANNELS);
+
+    while (audioFramesSent < due) {
+        for (int i = 0; i < chunkFrames; i++) {
+            qint16 value = (qint16)(qSin(audioPhase) * 8000);
+            audioPhase += 2 * M_PI * AUDIO_TONE_HZ / AUDIO_SAMPLE_RATE;
+            for (int c = 0; c < AUDIO_CHANNELS; c++) {
+                samples[i * AUDIO_CHANNELS + c] = value;
+            }
+        }
+        audioPhase = fmod(audioPhase, 2 * M_PI);
+
+        if (!rdpsnd->SendSamples(rdpsnd, samples.constData(), chunkFrames)) {
+            audioActivated = false;
+            return;
+        }
+        audioFramesSent += chunkFrames;
+        bytesSent += samples.size() * sizeof(qint16);
+    }
+}
+
+void TestPeer::printStatistics() {
+    qDebug("frames/s: %llu, rects/s: %llu, kB/s: %llu, input events/s: %llu",
+        framesSent, rectanglesSent, bytesSent / 1024, inputEventsReceived);
+    framesSent = 0;
+    rectanglesSent = 0;
+    bytesSent = 0;
+    inputEventsReceived = 0;
+}
+
+void TestPeer::ContextNewCallback(freerdp_peer *client, rdpContext *context) {
+    auto peerContext = getPeerContext(context);
+    peerContext->self = nullptr;
+    peerContext->rdpsnd = nullptr;
+    peerContext->vcm = WTSCreateVirtualChannelManager(client);
+}
+
+void TestPeer::ContextFreeCallback(freerdp_peer *client, rdpContext *context) {
+    auto peerContext = getPeerContext(context);
+    if (peerContext->rdpsnd) {
+        rdpsnd_server_context_free(peerContext->rdpsnd);
+    }
+    WTSDestroyVirtualChannelManager(peerContext->vcm);
+}
+
+BOOL TestPeer::PostConnectCallback(freerdp_peer *client) {
+    auto context = getPeerContext(client);
+    auto self = context->self;
+    auto clientSettings = client->settings;
+
+    self->generator = new DesktopGenerator(clientSettings->DesktopWidth,
+        clientSettings->DesktopHeight);
+
+    if (self->settings.audioEnabled &&
+            WTSVirtualChannelManagerIsChannelJoined(context->vcm, "rdpsnd")) {
+        auto rdpsnd = context->rdpsnd = rdpsnd_server_context_new(context->vcm);
+        rdpsnd->data = self;
+        rdpsnd->server_formats = audioFormats;
+        rdpsnd->num_server_formats = sizeof(audioFormats) / sizeof(audioFormats[0]);
+        rdpsnd->src_format = audioFormats[0];
+        rdpsnd->Activated = AudioActivatedCallback;
+        rdpsnd->Initialize(rdpsnd);
+    }
+    return TRUE;
+}
+
+BOOL TestPeer::ActivateCallback(freerdp_peer *client) {
+    auto self = getPeerContext(client)->self;
+    qDebug() << "Client activated in" << self->connectTimer.elapsed() << "ms";
+
+    self->activated = true;
+    self->pendingRefresh = self->generator->image().rect();
+    self->sendPointers();
+    return TRUE;
+}
+
+void TestPeer::KeyboardEventCallback(rdpInput *input, UINT16 flags, UINT16 code) {
+    auto self = getPeerContext(input->context)->self;
+    self->inputEventsReceived++;
+
+    if (!(flags & KBD_FLAGS_RELEASE) && self->generator) {
+        self->generator->toggleKeyIndicator();
+        self->sendFrame();
+    }
+}
+
+void TestPeer::MouseEventCallback(rdpInput *input, UINT16 flags, UINT16 x, UINT16 y) {
+    auto self = getPeerContext(input->context)->self;
+    self->inputEventsReceived++;
+
+    if ((flags & PTR_FLAGS_DOWN) && self->generator) {
+        self->generator->addMarker(QPoint(x, y));
+        self->sendFrame();
+    }
+}
+
+void TestPeer::RefreshRectCallback(rdpContext *context, BYTE count, RECTANGLE_16 *areas) {
+    auto self = getPeerContext(context)->self;
+    for (int i = 0; i < count; i++) {
+        self->pendingRefresh += QRect(QPoint(areas[i].left, areas[i].top),
+            QPoint(areas[i].right, areas[i].bottom));
+    }
+}
+
+void TestPeer::SuppressOutputCallback(rdpContext *context, BYTE allow, RECTANGLE_16 *area) {
+    auto self = getPeerContext(context)->self;
+    self->outputSuppressed = !allow;
+    if (allow && area) {
+        self->pendingRefresh += QRect(QPoint(area->left, area->top),
+            QPoint(area->right, area->bottom));
+    }
+}
+
+void TestPeer::AudioActivatedCallback(RdpsndServerContext *context) {
+    auto self = (TestPeer*)context->data;
+
+    for (int i = 0; i < context->num_client_formats; i++) {
+        auto format = &context->client_formats[i];
+        if (format->wFormatTag == WAVE_FORMAT_PCM &&
+                format->nSamplesPerSec == AUDIO_SAMPLE_RATE &&
+                format->nChannels == AUDIO_CHANNELS &&
+                format->wBitsPerSample == 16) {
+            context->SelectFormat(context, i);
+            self->audioActivated = true;
+            self->audioFramesSent = 0;
+            self->audioTimer.start();
+            return;
+        }
+    }
+    qWarning() << "Client does not support the test tone's audio format";
+}
@@ -0,0 +1,87 @@
+#ifndef TESTPEER_H
+#define TESTPEER_H
+
+#include <QThread>
+#include <QString>
+#include <QRegion>
+#include <QElapsedTimer>
+#include <freerdp/freerdp.h>
+#include <freerdp/listener.h>
+#include <freerdp/server/rdpsnd.h>
+
+class DesktopGenerator;
+
+/**
+ * Settings shared by all peers of the test server.
+ */
+struct TestServerSettings {
+    TestServerSettings();
+
+    QString certificateFile;
+    QString keyFile;
+    int framesPerSecond;
+    bool audioEnabled;
+    bool pointerEnabled;
+};
+
+/**
+ * The TestPeer class serves a single RDP client connected to the test server.
+ *
+ * Each peer runs in its own thread. It streams generated desktop content as
+ * uncompressed 16 bpp bitmap updates, cycles the mouse pointer between a set of
+ * cached pointers and plays back a sine tone through rdpsnd.
+ *
+ * Mouse button presses are echoed back as markers painted at the pressed
+ * position and key presses toggle an indicator in the top-right corner, so
+ * that the client can measure input round-trip times. Connect time and
+ * throughput are printed once per second.
+ */
+class TestPeer : public QThread {
+    Q_OBJECT
+public:
+    TestPeer(freerdp_peer *client, const TestServerSettings &settings, QObject *parent = 0);
+    ~TestPeer();
+
+protected:
+    virtual void run();
+
+private:
+    bool waitForEvents(int timeout);
+    void sendFrame();
+    void sendRegion(const QRegion &region);
+    void sendPointers();
+    void sendAudio();
+    void printStatistics();
+
+    static void ContextNewCallback(freerdp_peer *client, rdpContext *context);
+    static void ContextFreeCallback(freerdp_peer *client, rdpContext *context);
+    static BOOL PostConnectCallback(freerdp_peer *client);
+    static BOOL ActivateCallback(freerdp_peer *client);
+    static void KeyboardEventCallback(rdpInput *input, UINT16 flags, UINT16 code);
+    static void MouseEventCallback(rdpInput *input, UINT16 flags, UINT16 x, UINT16 y);
+    static void RefreshRectCallback(rdpContext *context, BYTE count, RECTANGLE_16 *areas);
+    static void SuppressOutputCallback(rdpContext *context, BYTE allow, RECTANGLE_16 *area);
+    static void AudioActivatedCallback(RdpsndServerContext *context);
+
+    freerdp_peer *client;
+    TestServerSettings settings;
+    DesktopGenerator *generator;
+    bool activated;
+    bool outputSuppressed;
+    bool audioActivated;
+    QRegion pendingRefresh;
+    int pointerIndex;
+    double audioPhase;
+
+    QElapsedTimer connectTimer;
+    QElapsedTimer frameTimer;
+    QElapsedTimer audioTimer;
+    QElapsedTimer statisticsTimer;
+    qint64 audioFramesSent;
+    quint64 framesSent;
+    quint64 rectanglesSent;
+    quint64 bytesSent;
+    quint64 inputEventsReceived;
+};
+
+#endif // TESTPEER_H